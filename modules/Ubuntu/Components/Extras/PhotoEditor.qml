@@ -42,6 +42,7 @@ Item {
             objectName: "cropButton"
             text: i18n.dtr("ubuntu-ui-extras", "Crop")
             iconSource: Qt.resolvedUrl("PhotoEditor/assets/edit_crop.png")
+            enabled: !photoData.busy && !stack.loading
             onTriggered: {
                 photoData.isLongOperation = false;
                 cropper.start("image://photo/" + photoData.path);
@@ -51,6 +52,8 @@ Item {
             objectName: "rotateButton"
             text: i18n.dtr("ubuntu-ui-extras", "Rotate")
             iconSource: Qt.resolvedUrl("PhotoEditor/assets/edit_rotate_right.png")
+            // Rotations queue up behind the edit in progress
+            enabled: !stack.loading
             onTriggered: {
                 photoData.isLongOperation = false;
                 photoData.rotateRight()
@@ -60,6 +63,7 @@ Item {
             objectName: "exposureButton"
             text: i18n.tr("Exposure")
             iconSource: Qt.resolvedUrl("PhotoEditor/assets/edit_exposure.png")
+            enabled: !photoData.busy && !stack.loading
             onTriggered: {
                 photoData.isLongOperation = false;
                 exposureSelector.start("image://photo/" + photoData.path);
@@ -106,16 +110,12 @@ Item {
 
     PhotoData {
         id: photoData
+        // Edits go to the history of the session, which saves them on close
+        history: stack.history
         onDataChanged: image.reload()
         property bool isLongOperation: false
 
-        onEditFinished: {
-            console.log("Edit finished")
-            // If we are editing exposure we don't need to checkpoint at every
-            // edit, and the exposure UI will checkpoint when the user confirms.
-            if (exposureSelector.opacity > 0) exposureSelector.reload()
-            else stack.checkpoint()
-        }
+        onEditFinished: console.log("Edit finished")
     }
 
     Loader {
@@ -155,20 +155,13 @@ Item {
         anchors.fill: parent
         opacity: 0.0
         enabled: !photoData.busy
-        onExposureChanged: {
-            // Restore the starting version of the image, otherwise we will
-            // accumulate compensations over the previous ones.
-            stack.restoreSnapshot(stack.level)
-            photoData.exposureCompensation(exposure)
-        }
+        // The slider only changes the preview; the photo gets edited, and the edit
+        // added to the history of the session, when the user confirms.
         onConfirm: {
-            stack.checkpoint();
-            exposureSelector.opacity = 0.0
-        }
-        onCancel: {
-            stack.restoreSnapshot(stack.level)
             exposureSelector.opacity = 0.0
+            if (exposure != 0.0) photoData.exposureCompensation(exposure)
         }
+        onCancel: exposureSelector.opacity = 0.0
         visible: opacity > 0
     }
 
@@ -182,7 +175,6 @@ Item {
         visible: opacity > 0.0
         opacity: (exposureSelector.opacity == 0 && cropper.opacity == 0) ? 1.0 : 0.0
 
-        enabled: !photoData.busy
         toolActions: {
             // This is necessary because QML does not let us declare a list with
             // mixed component declarations and identifiers, like this:
@@ -233,7 +225,9 @@ Item {
         id: busyIndicator
         anchors.centerIn: parent
         text: i18n.dtr("ubuntu-ui-extras", "Enhancing photo...")
-        running: photoData.busy
+        // The result of an edit shows while it gets saved
+        running: (photoData.busy && !photoData.saving) || stack.loading
         longOperation: photoData.isLongOperation
+        progress: photoData.stage ? photoData.progress : -1
     }
 }
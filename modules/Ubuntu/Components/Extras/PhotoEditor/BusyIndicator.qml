@@ -22,6 +22,8 @@ Item {
     property alias text: label.text
     property alias running: spinner.running
     property bool longOperation: false
+    // From 0.0 to 1.0, or less than that if it isn't known
+    property real progress: -1
 
     visible: running
 
@@ -53,5 +55,16 @@ Item {
             horizontalAlignment: Text.AlignHCenter
             visible: longOperation
         }
+
+        ProgressBar {
+            id: progressBar
+            objectName: "busyProgressBar"
+            anchors.horizontalCenter: parent.horizontalCenter
+            visible: longOperation
+            indeterminate: busy.progress < 0
+            minimumValue: 0.0
+            maximumValue: 1.0
+            value: Math.max(0.0, busy.progress)
+        }
     }
 }
@@ -16,96 +16,81 @@
 
 import QtQuick 2.9
 import Ubuntu.Components 1.3
-import Ubuntu.Components.Extras 0.2
+import Ubuntu.Components.Extras 0.3
 
 Item {
     property PhotoData data
     property bool actionsEnabled: true
-    property var items: []
-    property int level: 0
-    property string editingSessionPath
+    property alias history: editHistory
+    readonly property int level: editHistory.level
     property string currentFile
     property string originalFile
     property string pristineFile
     property bool modified: level > 0 || _revertedInThisSession
+    // Ended sessions are still being written to their photos
+    readonly property bool saving: editHistory.saving
+    // The photo is decoded in the background before it can be edited
+    readonly property bool loading: editHistory.loading
 
     property bool _revertedInThisSession
     property bool _pristineFileExists
 
     signal revertRequested
+    signal photoSaved(string photo, bool success)
 
-    function startEditingSession(original) {
-        var originalFileName = FileUtils.nameFromPath(original);
-        var baseName = FileUtils.parentDirectory(original) +
-                       "/.photo_editing." + originalFileName + ".";
-        editingSessionPath = FileUtils.createTemporaryDirectory(baseName);
-        if (editingSessionPath == "") return false;
+    // The edits are kept in memory, and only written to the photo when the
+    // session ends
+    PhotoEditHistory {
+        id: editHistory
+        onSaved: photoSaved(path, success)
+    }
 
+    function startEditingSession(original) {
         originalFile = original;
-        currentFile = editingSessionPath + "/current";
+        currentFile = original;
 
-        pristineFile = FileUtils.parentDirectory(original) +
-                       "/.original/" + originalFileName
-        _revertedInThisSession = false;
-        _pristineFileExists = FileUtils.exists(pristineFile)
+        // The photo gets decoded in the background, once the previous
+        // session of it, if still being saved, has written it
+        var started = editHistory.start(original);
 
-        FileUtils.copy(originalFile, currentFile)
+        // The pristine copies are kept in a cache store shared by all
+        // photos, rather than next to them
+        pristineFile = FileUtils.pristineFile(original);
+        _revertedInThisSession = false;
+        _pristineFileExists = pristineFile != "";
 
-        items = [createSnapshot(0)];
-        level = 0;
-        return true;
+        return started;
     }
 
     function endEditingSession(saveIfModified) {
         if (saveIfModified && modified) { // file modified
+            // The files are written in the background, one operation after
+            // the other in the order they are started, so the session can
+            // end right away without holding up the UI
+
             // if we don't have a copy of the very first original, create one
             if (!_pristineFileExists) {
-                FileUtils.createDirectory(FileUtils.parentDirectory(pristineFile));
-                FileUtils.copy(originalFile, pristineFile);
-            } else {
-                // if we reverted to original (and made no other changes)
-                // we don't need to keep the pristine copy around
-                if (_revertedInThisSession && level <= 0) {
-                    FileUtils.remove(pristineFile);
-                }
+                FileUtils.keepPristineAsync(originalFile);
             }
 
-            FileUtils.copy(currentFile, originalFile); // actually save
-        }
-
-        FileUtils.removeDirectory(editingSessionPath, true); // clear editing cache
-        editingSessionPath = originalFile = pristineFile = currentFile = "";
-    }
-
-    function createSnapshot(name) {
-        var snapshotFile = editingSessionPath + "/edit." + name;
-        FileUtils.copy(currentFile, snapshotFile);
-        return snapshotFile;
-    }
+            editHistory.saveAsync(); // actually save
 
-    function restoreSnapshot(name) {
-        var snapshotFile = editingSessionPath + "/edit." + name;
-        FileUtils.copy(snapshotFile, currentFile);
-        data.refreshFromDisk();
-    }
+            // if we reverted to original (and made no other changes)
+            // we don't need to keep the pristine copy around
+            if (_pristineFileExists && _revertedInThisSession && level <= 0) {
+                FileUtils.discardPristineAsync(originalFile);
+            }
+        }
 
-    function checkpoint() {
-        level++;
-        items = items.slice(0, level);
-        items.push(createSnapshot(items.length));
+        editHistory.end();
+        originalFile = pristineFile = currentFile = "";
     }
 
     function revertToPristine() {
-        if (!FileUtils.exists(pristineFile)) {
-            restoreSnapshot(0);
-            items = items.slice(0, 1);
-            level = 0;
+        if (!_pristineFileExists || !FileUtils.exists(pristineFile)) {
+            editHistory.clear();
         } else {
-            FileUtils.copy(pristineFile, currentFile);
-            data.refreshFromDisk();
-            items = [];
-            checkpoint();
-            level = 0;
+            editHistory.rebase(pristineFile);
             _revertedInThisSession = true;
         }
     }
@@ -113,21 +98,21 @@ Item {
     property Action undoAction: Action {
             text: i18n.dtr("ubuntu-ui-extras", "Undo")
             iconName: "undo"
-            enabled: items.length > 0 && level > 0 && actionsEnabled
-            onTriggered: restoreSnapshot(--level);
+            enabled: editHistory.canUndo && actionsEnabled && !loading
+            onTriggered: editHistory.undo();
     }
 
     property Action redoAction: Action {
             text: i18n.dtr("ubuntu-ui-extras", "Redo")
             iconName: "redo"
-            enabled: level < items.length - 1 && actionsEnabled
-            onTriggered: restoreSnapshot(++level);
+            enabled: editHistory.canRedo && actionsEnabled && !loading
+            onTriggered: editHistory.redo();
     }
 
     property Action revertAction: Action {
             text: i18n.dtr("ubuntu-ui-extras", "Revert to original")
             iconSource: Qt.resolvedUrl("assets/edit_revert.png")
-            enabled: actionsEnabled &&
+            enabled: actionsEnabled && !loading &&
                      (level > 0 || (!_revertedInThisSession && _pristineFileExists))
             onTriggered: revertRequested()
     }
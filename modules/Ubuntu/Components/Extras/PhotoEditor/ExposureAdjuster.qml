@@ -26,6 +26,7 @@ Rectangle {
 
     property alias exposure: exposureSelector.value
     property bool enabled
+    property string target
 
     signal confirm()
     signal cancel()
@@ -36,6 +37,9 @@ Rectangle {
         fillMode: Image.PreserveAspectFit
         asynchronous: true
         cache: false
+        // The provider renders these from a copy of the photo it keeps in
+        // memory, so they are quick enough to follow the slider.
+        source: adjuster.target ? adjuster.target + "?exposure=" + adjuster.exposure.toFixed(2) : ""
         sourceSize {
             width: targetImage.width
             height: targetImage.height
@@ -51,7 +55,7 @@ Rectangle {
 
         Slider {
             id: exposureSelector
-            live: false
+            live: true
             minimumValue: -1.0
             maximumValue: +1.0
             value: 0.0
@@ -72,7 +76,7 @@ Rectangle {
                 text: i18n.dtr("ubuntu-ui-extras", "Cancel")
                 enabled: adjuster.enabled
                 onTriggered: {
-                    targetImage.source = "";
+                    adjuster.target = "";
                     cancel();
                 }
             }
@@ -81,7 +85,7 @@ Rectangle {
                 color: theme.palette.normal.positive
                 enabled: adjuster.enabled
                 onTriggered: {
-                    targetImage.source = "";
+                    adjuster.target = "";
                     confirm();
                 }
             }
@@ -89,16 +93,8 @@ Rectangle {
     }
 
     function start(target) {
-        targetImage.source = target;
         exposure = 0.0;
+        adjuster.target = target;
         opacity = 1.0;
     }
-
-    function reload() {
-        var path = targetImage.source;
-        targetImage.asynchronous = false;
-        targetImage.source = "";
-        targetImage.asynchronous = true;
-        targetImage.source = path;
-    }
 }
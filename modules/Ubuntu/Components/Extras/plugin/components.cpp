@@ -19,8 +19,12 @@
 #include "components.h"
 #include "example/example-model.h"
 
+#include "photoeditor/photo-batch-editor.h"
 #include "photoeditor/photo-data.h"
+#include "photoeditor/photo-edit-history.h"
 #include "photoeditor/photo-image-provider.h"
+#include "photoeditor/photo-pre-enhancer.h"
+#include "photoeditor/photo-validator.h"
 #include "photoeditor/file-utils.h"
 
 #include "tabsbar/drag-helper.h"
@@ -34,6 +38,10 @@ void Components::registerTypes(const char *uri)
     qmlRegisterType<PhotoData>(uri, 0, 2, "PhotoData");
     qmlRegisterSingletonType<FileUtils>(uri, 0, 2, "FileUtils",
                                         exportFileUtilsSingleton);
+    qmlRegisterType<PhotoBatchEditor>(uri, 0, 3, "PhotoBatchEditor");
+    qmlRegisterType<PhotoValidator>(uri, 0, 3, "PhotoValidator");
+    qmlRegisterType<PhotoEditHistory>(uri, 0, 3, "PhotoEditHistory");
+    qmlRegisterType<PhotoPreEnhancer>(uri, 0, 3, "PhotoPreEnhancer");
 
     // TabsBar component
     qmlRegisterType<DragHelper>(uri, 0, 3, "DragHelper");
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "band-executor.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+const int BandExecutor::MIN_BAND_HEIGHT = 16;
+
+namespace {
+// More bands than workers, so that a worker which got delayed by the
+// scheduler does not hold everybody else back.
+const int BANDS_PER_THREAD = 4;
+
+QThreadPool* bandPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
+struct BandJob
+{
+    std::function<void(int, int)> function;
+    int height;
+    int bandHeight;
+    int bands;
+    QAtomicInt next;
+    QAtomicInt remaining;
+    QMutex mutex;
+    QWaitCondition finished;
+};
+
+void processBands(BandJob* job)
+{
+    int band;
+    while ((band = job->next.fetchAndAddOrdered(1)) < job->bands) {
+        int first = band * job->bandHeight;
+        int last = qMin(first + job->bandHeight, job->height);
+        job->function(first, last);
+
+        if (!job->remaining.deref()) {
+            QMutexLocker locker(&job->mutex);
+            job->finished.wakeAll();
+        }
+    }
+}
+
+class BandRunnable : public QRunnable
+{
+public:
+    BandRunnable(const QSharedPointer<BandJob>& job) : m_job(job) { }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        processBands(m_job.data());
+    }
+
+private:
+    // Shared, as a runnable that gets scheduled late may still look at the
+    // job after the caller has returned.
+    QSharedPointer<BandJob> m_job;
+};
+} // namespace
+
+/*!
+ * \brief BandExecutor::maxThreadCount
+ * \return the number of threads, including the caller, that work on bands
+ */
+int BandExecutor::maxThreadCount()
+{
+    return bandPool()->maxThreadCount();
+}
+
+/*!
+ * \brief BandExecutor::setMaxThreadCount
+ * Defaults to QThread::idealThreadCount(). Setting it to 1 runs all the bands
+ * on the calling thread.
+ * \param count
+ */
+void BandExecutor::setMaxThreadCount(int count)
+{
+    bandPool()->setMaxThreadCount(qMax(1, count));
+}
+
+/*!
+ * \brief BandExecutor::run
+ * Calls function(first, last) for consecutive, non overlapping bands of rows
+ * covering [0, height), and returns once all of them are done.
+ * \param height
+ * \param function
+ */
+void BandExecutor::run(int height, const std::function<void(int, int)>& function)
+{
+    if (height <= 0)
+        return;
+
+    int threads = maxThreadCount();
+    if (threads <= 1 || height < 2 * MIN_BAND_HEIGHT) {
+        function(0, height);
+        return;
+    }
+
+    QSharedPointer<BandJob> job(new BandJob);
+    job->function = function;
+    job->height = height;
+    job->bandHeight = qMax(MIN_BAND_HEIGHT,
+                           (height + threads * BANDS_PER_THREAD - 1) /
+                           (threads * BANDS_PER_THREAD));
+    job->bands = (height + job->bandHeight - 1) / job->bandHeight;
+    job->next.store(0);
+    job->remaining.store(job->bands);
+
+    int helpers = qMin(threads, job->bands) - 1;
+    for (int i = 0; i < helpers; i++)
+        bandPool()->start(new BandRunnable(job));
+
+    processBands(job.data());
+
+    QMutexLocker locker(&job->mutex);
+    while (job->remaining.load() > 0)
+        job->finished.wait(&job->mutex);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_BAND_EXECUTOR_H_
+#define GALLERY_BAND_EXECUTOR_H_
+
+#include <functional>
+
+/*!
+ * \brief The BandExecutor class
+ *
+ * Splits a range of scanlines in horizontal bands and runs a function over
+ * them on a dedicated thread pool. The calling thread works on bands too, so
+ * that nested or concurrent calls always make progress.
+ *
+ * Each band is handed to exactly one invocation of the function and bands
+ * never overlap, so kernels that only write to their own rows produce the
+ * same result whatever the number of workers.
+ */
+class BandExecutor
+{
+public:
+    static const int MIN_BAND_HEIGHT;
+
+    static int maxThreadCount();
+    static void setMaxThreadCount(int count);
+
+    static void run(int height, const std::function<void(int, int)>& function);
+};
+
+#endif // GALLERY_BAND_EXECUTOR_H_
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "color-lut.h"
+#include "band-executor.h"
+#include "imaging.h"
+
+#include <QtGlobal>
+
+#include <cstring>
+
+const int ColorLut::DEFAULT_GRID_SIZE = 33;
+
+namespace {
+/*
+ * Interpolates one channel along the path c0 -> c1 -> c2 -> c3 of a
+ * tetrahedron, with weights f1 >= f2 >= f3 in 16 bit fixed point. The result
+ * is a convex combination of the four values, so it stays within [0, 255].
+ */
+inline int interpolate(int c0, int c1, int c2, int c3, int f1, int f2, int f3)
+{
+    return ((c0 << 16) + f1 * (c1 - c0) + f2 * (c2 - c1) + f3 * (c3 - c2) +
+            0x8000) >> 16;
+}
+} // namespace
+
+/*!
+ * \brief ColorLut::ColorLut
+ * A null table, see compile()
+ */
+ColorLut::ColorLut()
+    : m_gridSize(0)
+{
+    for (int i = 0; i < 256; i++) {
+        m_cell[i] = 0;
+        m_fraction[i] = 0;
+    }
+}
+
+/*!
+ * \brief ColorLut::ColorLut
+ * \param gridSize number of nodes along each axis of the RGB cube
+ */
+ColorLut::ColorLut(int gridSize)
+    : m_gridSize(qBound(2, gridSize, 256)),
+      m_nodes(m_gridSize * m_gridSize * m_gridSize)
+{
+    const int cells = m_gridSize - 1;
+    for (int i = 0; i < 256; i++) {
+        int position = (i * cells * 65536 + 127) / 255;
+        m_cell[i] = qMin(position >> 16, cells - 1);
+        m_fraction[i] = position - (m_cell[i] << 16);
+    }
+}
+
+/*!
+ * \brief ColorLut::compile
+ * Samples the function on every node of the grid. The function only sees
+ * opaque pixels and its alpha output is ignored.
+ * \param function
+ * \param gridSize
+ * \return
+ */
+ColorLut ColorLut::compile(const Function& function, int gridSize)
+{
+    ColorLut lut(gridSize);
+
+    const int n = lut.m_gridSize;
+    QRgb* node = lut.m_nodes.data();
+    for (int b = 0; b < n; b++) {
+        for (int g = 0; g < n; g++) {
+            for (int r = 0; r < n; r++) {
+                *node++ = function(qRgb(qRound(r * 255.0 / (n - 1)),
+                                        qRound(g * 255.0 / (n - 1)),
+                                        qRound(b * 255.0 / (n - 1))));
+            }
+        }
+    }
+
+    return lut;
+}
+
+/*!
+ * \brief ColorLut::folded
+ * Returns a table that applies this one and then the given function. The
+ * function is only evaluated on the grid nodes, so folding another adjustment
+ * in is as cheap as compiling a table.
+ * \param function
+ * \return
+ */
+ColorLut ColorLut::folded(const Function& function) const
+{
+    ColorLut lut(*this);
+
+    QRgb* node = lut.m_nodes.data();
+    for (int i = 0; i < lut.m_nodes.size(); i++)
+        node[i] = function(qRgb(qRed(node[i]), qGreen(node[i]), qBlue(node[i])));
+
+    return lut;
+}
+
+/*!
+ * \brief ColorLut::isNull
+ * \return
+ */
+bool ColorLut::isNull() const
+{
+    return m_gridSize == 0;
+}
+
+/*!
+ * \brief ColorLut::gridSize
+ * \return
+ */
+int ColorLut::gridSize() const
+{
+    return m_gridSize;
+}
+
+/*!
+ * \brief ColorLut::map
+ * Looks up a single pixel. Alpha is carried over untouched, and a null table
+ * leaves the pixel as it is.
+ * \param pixel
+ * \return
+ */
+QRgb ColorLut::map(QRgb pixel) const
+{
+    if (isNull())
+        return pixel;
+
+    const int n = m_gridSize;
+    const int r = qRed(pixel);
+    const int g = qGreen(pixel);
+    const int b = qBlue(pixel);
+    const int fr = m_fraction[r];
+    const int fg = m_fraction[g];
+    const int fb = m_fraction[b];
+
+    const int dr = 1;
+    const int dg = n;
+    const int db = n * n;
+
+    // Pick the tetrahedron of the cell that contains the pixel, by walking
+    // first along the axis with the largest fraction.
+    int first, second, f1, f2, f3;
+    if (fr >= fg) {
+        if (fg >= fb) {
+            first = dr; second = dr + dg; f1 = fr; f2 = fg; f3 = fb;
+        } else if (fr >= fb) {
+            first = dr; second = dr + db; f1 = fr; f2 = fb; f3 = fg;
+        } else {
+            first = db; second = db + dr; f1 = fb; f2 = fr; f3 = fg;
+        }
+    } else {
+        if (fr >= fb) {
+            first = dg; second = dg + dr; f1 = fg; f2 = fr; f3 = fb;
+        } else if (fg >= fb) {
+            first = dg; second = dg + db; f1 = fg; f2 = fb; f3 = fr;
+        } else {
+            first = db; second = db + dg; f1 = fb; f2 = fg; f3 = fr;
+        }
+    }
+
+    const QRgb* cell = m_nodes.constData() +
+            (m_cell[b] * n + m_cell[g]) * n + m_cell[r];
+    const QRgb c0 = cell[0];
+    const QRgb c1 = cell[first];
+    const QRgb c2 = cell[second];
+    const QRgb c3 = cell[dr + dg + db];
+
+    return (pixel & 0xff000000) |
+            (interpolate(qRed(c0), qRed(c1), qRed(c2), qRed(c3), f1, f2, f3) << 16) |
+            (interpolate(qGreen(c0), qGreen(c1), qGreen(c2), qGreen(c3), f1, f2, f3) << 8) |
+            interpolate(qBlue(c0), qBlue(c1), qBlue(c2), qBlue(c3), f1, f2, f3);
+}
+
+/*!
+ * \brief ColorLut::transformScanLine
+ * The source and destination may be the same line.
+ * \param source
+ * \param destination
+ * \param width
+ */
+void ColorLut::transformScanLine(const QRgb* source, QRgb* destination,
+                                 int width) const
+{
+    if (isNull()) {
+        if (destination != source)
+            memmove(destination, source, width * sizeof(QRgb));
+        return;
+    }
+
+    QRgb last_source = 0;
+    QRgb last_result = map(last_source);
+
+    for (int i = 0; i < width; i++) {
+        const QRgb pixel = source[i];
+        if (pixel != last_source) {
+            last_result = map(pixel);
+            last_source = pixel;
+        }
+        destination[i] = last_result;
+    }
+}
+
+/*!
+ * \brief ColorLut::apply
+ * Transforms the image in place, converting it to a 32 bit format first if
+ * needed.
+ * \param image
+ */
+void ColorLut::apply(QImage& image) const
+{
+    if (isNull() || image.isNull())
+        return;
+
+    if (image.format() != scanLineFormat(image))
+        image = image.convertToFormat(scanLineFormat(image));
+
+    uchar* bits = image.bits();
+    const int stride = image.bytesPerLine();
+    const int width = image.width();
+    const ColorLut* lut = this;
+    BandExecutor::run(image.height(), [=](int first, int last) {
+        for (int j = first; j < last; j++) {
+            QRgb* line = reinterpret_cast<QRgb*>(bits + j * stride);
+            lut->transformScanLine(line, line, width);
+        }
+    });
+}
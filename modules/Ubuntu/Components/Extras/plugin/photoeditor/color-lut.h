@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_COLOR_LUT_H_
+#define GALLERY_COLOR_LUT_H_
+
+#include <QImage>
+#include <QRgb>
+#include <QVector>
+
+#include <functional>
+
+/*!
+ * \brief The ColorLut class
+ *
+ * A colour transformation sampled on a regular grid of the RGB cube, and
+ * applied with tetrahedral interpolation between the grid nodes. Any chain of
+ * per pixel adjustments compiles into one table, so applying all of them costs
+ * a single lookup per pixel.
+ */
+class ColorLut
+{
+public:
+    static const int DEFAULT_GRID_SIZE;
+
+    typedef std::function<QRgb(QRgb)> Function;
+
+    ColorLut();
+
+    static ColorLut compile(const Function& function,
+                            int gridSize = DEFAULT_GRID_SIZE);
+
+    ColorLut folded(const Function& function) const;
+
+    bool isNull() const;
+    int gridSize() const;
+
+    QRgb map(QRgb pixel) const;
+    void transformScanLine(const QRgb* source, QRgb* destination,
+                           int width) const;
+    void apply(QImage& image) const;
+
+private:
+    explicit ColorLut(int gridSize);
+
+    int m_gridSize;
+    QVector<QRgb> m_nodes;
+    // Per channel value: index of the grid cell and 16 bit fixed point
+    // position within it.
+    int m_cell[256];
+    int m_fraction[256];
+};
+
+#endif // GALLERY_COLOR_LUT_H_
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-existence-cache.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QStringList>
+
+// Each watch takes one of the inotify watches of the user, which are shared
+// by all the applications
+const int FileExistenceCache::MAX_DIRECTORIES = 256;
+
+namespace {
+enum Answer {
+    ANSWER_NO,
+    ANSWER_YES,
+    ANSWER_UNKNOWN
+};
+
+struct Directory
+{
+    Directory() : watched(false), listed(false), missing(false), used(0) { }
+
+    // Changes to the directory get noticed, or it is missing
+    bool watched;
+    bool listed;
+    bool missing;
+    quint64 used;
+    QSet<QString> names;
+};
+
+struct Cache
+{
+    Cache() : clock(0) { }
+
+    QMutex mutex;
+    QHash<QString, Directory> directories;
+    quint64 clock;
+};
+
+Cache* cache()
+{
+    static Cache instance;
+    return &instance;
+}
+
+void list(Directory* directory, const QString& path)
+{
+    directory->listed = true;
+    directory->names.clear();
+
+    QDir dir(path);
+    directory->missing = !dir.exists();
+    if (directory->missing)
+        return;
+
+    QStringList names = dir.entryList(QDir::AllEntries | QDir::Hidden | QDir::System |
+                                      QDir::NoDotAndDotDot);
+    directory->names = QSet<QString>::fromList(names);
+}
+
+void requestWatch(Cache* c, QObject* watcher, const QString& path)
+{
+    if (c->directories.count() >= FileExistenceCache::MAX_DIRECTORIES) {
+        QHash<QString, Directory>::const_iterator oldest = c->directories.constBegin();
+        for (QHash<QString, Directory>::const_iterator i = c->directories.constBegin();
+             i != c->directories.constEnd(); ++i) {
+            if (i.value().used < oldest.value().used)
+                oldest = i;
+        }
+        QMetaObject::invokeMethod(watcher, "unwatch", Qt::QueuedConnection,
+                                  Q_ARG(QString, oldest.key()));
+        c->directories.remove(oldest.key());
+    }
+
+    Directory directory;
+    directory.used = ++c->clock;
+    c->directories.insert(path, directory);
+    QMetaObject::invokeMethod(watcher, "watch", Qt::QueuedConnection, Q_ARG(QString, path));
+}
+
+Answer lookup(Cache* c, QObject* watcher, const QString& path, const QString& name)
+{
+    QHash<QString, Directory>::iterator i = c->directories.find(path);
+    if (i == c->directories.end()) {
+        requestWatch(c, watcher, path);
+        return ANSWER_UNKNOWN;
+    }
+
+    Directory& directory = i.value();
+    directory.used = ++c->clock;
+    if (!directory.watched)
+        return ANSWER_UNKNOWN;
+    if (!directory.listed)
+        list(&directory, path);
+    if (!directory.missing)
+        return directory.names.contains(name) ? ANSWER_YES : ANSWER_NO;
+
+    // Only the parent can tell whether a missing directory is still missing
+    QFileInfo info(path);
+    QString parent = info.absolutePath();
+    if (parent == path)
+        return ANSWER_UNKNOWN;
+    Answer answer = lookup(c, watcher, parent, info.fileName());
+    if (answer == ANSWER_NO)
+        return ANSWER_NO;
+    if (answer == ANSWER_YES)
+        c->directories.remove(path); // to be watched again
+    return ANSWER_UNKNOWN;
+}
+
+void forget(Cache* c, const QString& path)
+{
+    QHash<QString, Directory>::iterator i = c->directories.find(path);
+    if (i == c->directories.end())
+        return;
+
+    if (i.value().missing) {
+        c->directories.erase(i);
+    } else {
+        i.value().listed = false;
+        i.value().names.clear();
+    }
+}
+} // namespace
+
+FileExistenceCache::FileExistenceCache()
+    : m_watcher(0)
+{
+}
+
+FileExistenceCache* FileExistenceCache::instance()
+{
+    static FileExistenceCache* instance = 0;
+    static QMutex mutex;
+
+    QMutexLocker locker(&mutex);
+    if (!instance && QCoreApplication::instance()) {
+        instance = new FileExistenceCache();
+        instance->moveToThread(QCoreApplication::instance()->thread());
+    }
+    return instance;
+}
+
+/*!
+ * \brief FileExistenceCache::exists
+ * \param path
+ * \return whether the file or directory exists, from memory once its
+ * directory is watched
+ */
+bool FileExistenceCache::exists(const QString& path)
+{
+    QFileInfo info(path);
+    QString name = info.fileName();
+    FileExistenceCache* watcher = instance();
+    if (name.isEmpty() || !watcher)
+        return info.exists();
+
+    Answer answer;
+    {
+        Cache* c = cache();
+        QMutexLocker locker(&c->mutex);
+        answer = lookup(c, watcher, info.absolutePath(), name);
+    }
+
+    if (answer == ANSWER_UNKNOWN)
+        return info.exists();
+    return answer == ANSWER_YES;
+}
+
+/*!
+ * \brief FileExistenceCache::confirm
+ * Looks for a file on the disk, for when a stale answer would lose work,
+ * like that the original of a photo is still there before writing over the
+ * photo. A file that turns out to be gone gets its directory listed again.
+ * \param path
+ * \return whether the file or directory exists right now
+ */
+bool FileExistenceCache::confirm(const QString& path)
+{
+    if (QFileInfo::exists(path))
+        return true;
+
+    invalidate(path);
+    return false;
+}
+
+/*!
+ * \brief FileExistenceCache::invalidate
+ * Throws away what is known about the directory of a file, and about its
+ * parent, so that a change this process just made to the file is seen
+ * without waiting for the watcher.
+ * \param path
+ */
+void FileExistenceCache::invalidate(const QString& path)
+{
+    QFileInfo info(path);
+    QString directory = info.absolutePath();
+
+    Cache* c = cache();
+    QMutexLocker locker(&c->mutex);
+    forget(c, directory);
+    forget(c, QFileInfo(directory).absolutePath());
+}
+
+/*!
+ * \brief FileExistenceCache::isWatched
+ * \param directory
+ * \return whether files in the directory are looked for in memory
+ */
+bool FileExistenceCache::isWatched(const QString& directory)
+{
+    Cache* c = cache();
+    QMutexLocker locker(&c->mutex);
+    return c->directories.value(QFileInfo(directory).absoluteFilePath()).watched;
+}
+
+void FileExistenceCache::watch(const QString& directory)
+{
+    if (!m_watcher) {
+        m_watcher = new QFileSystemWatcher(this);
+        connect(m_watcher, SIGNAL(directoryChanged(QString)),
+                this, SLOT(directoryChanged(QString)));
+    }
+
+    bool watching = m_watcher->directories().contains(directory) ||
+            m_watcher->addPath(directory);
+
+    Cache* c = cache();
+    QMutexLocker locker(&c->mutex);
+    QHash<QString, Directory>::iterator i = c->directories.find(directory);
+    if (i == c->directories.end()) {
+        // Forgotten in the meantime
+        if (watching)
+            m_watcher->removePath(directory);
+        return;
+    }
+
+    // A directory that exists but can't be watched, say for lack of inotify
+    // watches, is looked in on the disk
+    if (watching || !QFileInfo(directory).isDir()) {
+        i.value().watched = true;
+        i.value().listed = false;
+    }
+}
+
+void FileExistenceCache::unwatch(const QString& directory)
+{
+    Cache* c = cache();
+    QMutexLocker locker(&c->mutex);
+    if (m_watcher && !c->directories.contains(directory))
+        m_watcher->removePath(directory);
+}
+
+void FileExistenceCache::directoryChanged(const QString& directory)
+{
+    Cache* c = cache();
+    QMutexLocker locker(&c->mutex);
+    QHash<QString, Directory>::iterator i = c->directories.find(directory);
+    if (i == c->directories.end())
+        return;
+
+    // The watch goes with a directory that got removed
+    if (!m_watcher->directories().contains(directory)) {
+        i.value().listed = true;
+        i.value().missing = true;
+        i.value().names.clear();
+        return;
+    }
+
+    i.value().listed = false;
+    i.value().names.clear();
+}
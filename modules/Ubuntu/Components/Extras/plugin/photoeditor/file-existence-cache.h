@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_FILE_EXISTENCE_CACHE_H_
+#define GALLERY_FILE_EXISTENCE_CACHE_H_
+
+#include <QObject>
+#include <QString>
+
+class QFileSystemWatcher;
+
+/*!
+ * \brief The FileExistenceCache class
+ *
+ * Tells whether files exist from listings of their directories kept in
+ * memory, which a QFileSystemWatcher throws away as soon as anything, in
+ * this process or another, changes in the directories. A missing directory
+ * is known to stay missing through the listing of its parent.
+ *
+ * The watches are set up on the thread of the application, so until one is,
+ * and where there is no application, files are looked for on the disk.
+ * Changes made by this process are only seen once the application gets to
+ * them, unless invalidate() is called for them right away, and so are
+ * changes made by other processes while the application is busy; answers
+ * that work gets thrown away on are to be checked with confirm().
+ */
+class FileExistenceCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MAX_DIRECTORIES;
+
+    static bool exists(const QString& path);
+    static bool confirm(const QString& path);
+    static void invalidate(const QString& path);
+    static bool isWatched(const QString& directory);
+
+private Q_SLOTS:
+    void watch(const QString& directory);
+    void unwatch(const QString& directory);
+    void directoryChanged(const QString& directory);
+
+private:
+    FileExistenceCache();
+    static FileExistenceCache* instance();
+
+    QFileSystemWatcher* m_watcher;
+};
+
+#endif // GALLERY_FILE_EXISTENCE_CACHE_H_
@@ -15,26 +15,188 @@
  */
 
 #include "file-utils.h"
+#include "photo-caches.h"
 
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QRunnable>
 #include <QTemporaryDir>
+#include <QThreadPool>
 
-FileUtils::FileUtils(QObject *parent) :
-    QObject(parent)
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+namespace {
+const size_t COPY_CHUNK_SIZE = 1024 * 1024;
+
+// The most Linux transfers in one call
+const size_t MAX_TRANSFER = 0x7ffff000;
+
+enum Transfer {
+    TRANSFER_DONE,
+    TRANSFER_UNSUPPORTED,
+    TRANSFER_FAILED
+};
+
+/*
+ * What the file systems or the kernel don't support; the next way of copying
+ * picks up from where the file positions are.
+ */
+Transfer failure(int error)
 {
+    switch (error) {
+    case ENOSYS:
+    case EXDEV:
+    case EINVAL:
+    case EOPNOTSUPP:
+#if EOPNOTSUPP != ENOTSUP
+    case ENOTSUP:
+#endif
+    case ENOTTY:
+        return TRANSFER_UNSUPPORTED;
+    default:
+        return TRANSFER_FAILED;
+    }
 }
 
-bool FileUtils::createDirectory(QString path) const
-{ 
-    if (path.isEmpty()) return false;
+ssize_t copyFileRange(int source, int destination, size_t length)
+{
+#ifdef __NR_copy_file_range
+    return ::syscall(__NR_copy_file_range, source, NULL, destination, NULL, length, 0);
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(destination);
+    Q_UNUSED(length);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
 
-    return QDir(path).mkpath(".");
+// Shares the blocks of the source on btrfs and xfs, without copying them
+Transfer reflink(int source, int destination)
+{
+    if (::ioctl(destination, FICLONE, source) == 0)
+        return TRANSFER_DONE;
+    return failure(errno);
 }
 
-QString FileUtils::createTemporaryDirectory(QString pathTemplate) const
+// Lets the file system copy on its side, or at least within the kernel
+Transfer copyInKernel(int source, int destination)
+{
+    while (true) {
+        ssize_t copied = copyFileRange(source, destination, MAX_TRANSFER);
+        if (copied == 0)
+            return TRANSFER_DONE;
+        if (copied < 0 && errno != EINTR)
+            return failure(errno);
+    }
+}
+
+Transfer sendFile(int source, int destination)
+{
+    while (true) {
+        ssize_t copied = ::sendfile(destination, source, NULL, MAX_TRANSFER);
+        if (copied == 0)
+            return TRANSFER_DONE;
+        if (copied < 0 && errno != EINTR)
+            return failure(errno);
+    }
+}
+
+Transfer copyChunks(int source, int destination)
+{
+    QByteArray buffer(COPY_CHUNK_SIZE, Qt::Uninitialized);
+    while (true) {
+        ssize_t count = ::read(source, buffer.data(), buffer.size());
+        if (count == 0)
+            return TRANSFER_DONE;
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return TRANSFER_FAILED;
+        }
+
+        const char* data = buffer.constData();
+        while (count > 0) {
+            ssize_t written = ::write(destination, data, count);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return TRANSFER_FAILED;
+            }
+            data += written;
+            count -= written;
+        }
+    }
+}
+
+// A single thread, so that the operations happen in the order they were
+// started; storage is the bottleneck anyway.
+class IOPool : public QThreadPool
+{
+public:
+    IOPool() { setMaxThreadCount(1); }
+};
+
+QThreadPool* ioPool()
+{
+    static IOPool pool;
+    return &pool;
+}
+
+class FileOperation : public QRunnable
+{
+public:
+    explicit FileOperation(const std::function<QVariant()>& operation)
+        : m_operation(operation)
+    {
+        m_result.reportStarted();
+    }
+
+    QFuture<QVariant> future()
+    {
+        return m_result.future();
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QVariant result = m_operation();
+        m_result.reportResult(result);
+        m_result.reportFinished();
+    }
+
+private:
+    std::function<QVariant()> m_operation;
+    QFutureInterface<QVariant> m_result;
+};
+
+QJSValue toScriptValue(const QVariant& value)
+{
+    switch (value.type()) {
+    case QVariant::Bool:
+        return QJSValue(value.toBool());
+    case QVariant::String:
+        return QJSValue(value.toString());
+    default:
+        return QJSValue(QJSValue::UndefinedValue);
+    }
+}
+
+QString makeTemporaryDirectory(const QString& pathTemplate)
 {
     QTemporaryDir dir(pathTemplate);
     if (!dir.isValid()) return QString();
@@ -43,7 +205,7 @@ QString FileUtils::createTemporaryDirectory(QString pathTemplate) const
     return dir.path();
 }
 
-bool FileUtils::removeDirectory(QString path, bool recursive) const
+bool removeDirectoryAt(const QString& path, bool recursive)
 {
     if (path.isEmpty()) return false;
 
@@ -51,58 +213,205 @@ bool FileUtils::removeDirectory(QString path, bool recursive) const
     return (recursive) ? dir.removeRecursively() : dir.rmdir(".");
 }
 
-bool FileUtils::remove(QString path) const
+bool renameFile(const QString& sourceFile, const QString& destinationFile)
 {
-    if (path.isEmpty()) return false;
-    return QFile::remove(path);
+    if (sourceFile.isEmpty() || destinationFile.isEmpty()) return false;
+
+    // Within a file system nothing gets copied, even over an existing file,
+    // which keeps its permissions as it did when it was written over.
+    bool replacing = QFileInfo(destinationFile).exists();
+    QFile::Permissions permissions = QFile::permissions(destinationFile);
+    if (::rename(QFile::encodeName(sourceFile).constData(),
+                 QFile::encodeName(destinationFile).constData()) == 0) {
+        if (replacing)
+            QFile::setPermissions(destinationFile, permissions);
+        return true;
+    }
+    if (errno != EXDEV) return false;
+
+    return FileUtils::copyFile(sourceFile, destinationFile) && QFile::remove(sourceFile);
 }
+} // namespace
 
-bool FileUtils::copy(QString sourceFile, QString destinationFile) const
+FileUtils::FileUtils(QObject *parent) :
+    QObject(parent),
+    m_lastOperation(0)
 {
-    if (sourceFile.isEmpty() || destinationFile.isEmpty()) return false;
+}
 
-    if (QFileInfo(destinationFile).exists()) {
-        QFile src(sourceFile);
-        QFile dst(destinationFile);
+/*!
+ * \brief FileUtils::run
+ * Runs an operation on the I/O thread, once those started before it are
+ * done.
+ * \param operation called on the I/O thread
+ * \return the result of the operation, to come
+ */
+QFuture<QVariant> FileUtils::run(const std::function<QVariant()>& operation)
+{
+    FileOperation* task = new FileOperation(operation);
+    QFuture<QVariant> future = task->future();
+    ioPool()->start(task);
+    return future;
+}
 
-        if (!src.open(QIODevice::ReadOnly) || !dst.open(QIODevice::WriteOnly)) {
-            return false;
-        }
+/*!
+ * \brief FileUtils::waitForOperations
+ * Blocks until all the operations started so far are done.
+ */
+void FileUtils::waitForOperations()
+{
+    ioPool()->waitForDone();
+}
 
-        if (dst.write(src.readAll()) < 0) {
-            return false;
-        }
+/*!
+ * \brief FileUtils::copyContents
+ * Copies a file into another with as little work as the file systems
+ * allow: sharing its blocks if they can, otherwise copying within the
+ * kernel, and only as a last resort through a buffer of fixed size. Memory
+ * use doesn't grow with the size of the file either way.
+ * \param sourceHandle an open file, at its start
+ * \param destinationHandle an empty file open for writing
+ * \return
+ */
+bool FileUtils::copyContents(int sourceHandle, int destinationHandle)
+{
+    Transfer transfer = reflink(sourceHandle, destinationHandle);
+    if (transfer == TRANSFER_UNSUPPORTED)
+        transfer = copyInKernel(sourceHandle, destinationHandle);
+    if (transfer == TRANSFER_UNSUPPORTED)
+        transfer = sendFile(sourceHandle, destinationHandle);
+    if (transfer == TRANSFER_UNSUPPORTED)
+        transfer = copyChunks(sourceHandle, destinationHandle);
+    return transfer == TRANSFER_DONE;
+}
 
-        src.close();
-        dst.close();
-        return true;
+/*!
+ * \brief FileUtils::copyFile
+ * Copies a file as copyContents() does, overwriting the destination if it
+ * exists. A new destination gets the permissions of the source; an existing
+ * one keeps its own.
+ * \param sourceFile
+ * \param destinationFile
+ * \return
+ */
+bool FileUtils::copyFile(const QString& sourceFile, const QString& destinationFile)
+{
+    int source = ::open(QFile::encodeName(sourceFile).constData(), O_RDONLY | O_CLOEXEC);
+    if (source < 0)
+        return false;
+
+    struct stat info;
+    if (::fstat(source, &info) != 0 || !S_ISREG(info.st_mode)) {
+        ::close(source);
+        return false;
     }
 
-    return QFile::copy(sourceFile, destinationFile);
+    QByteArray destinationName = QFile::encodeName(destinationFile);
+    bool existed = QFileInfo::exists(destinationFile);
+    int destination = ::open(destinationName.constData(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                             info.st_mode & 07777);
+    if (destination < 0) {
+        ::close(source);
+        return false;
+    }
+
+    bool copied = copyContents(source, destination);
+    ::close(source);
+    copied = (::close(destination) == 0) && copied;
+
+    if (!copied) {
+        qWarning() << "Error copying" << sourceFile << "to" << destinationFile;
+        if (!existed)
+            ::unlink(destinationName.constData());
+    }
+    return copied;
 }
 
-bool FileUtils::rename(QString sourceFile, QString destinationFile) const
+/*!
+ * \brief FileUtils::snapshotFile
+ * Keeps the current contents of a file under another name, without copying
+ * them where the file system allows: the snapshot shares the blocks of the
+ * file on btrfs and xfs, copied on write, and is a copy everywhere else. It
+ * is never another link to the file, as the snapshot would then change with
+ * anything writing into the file in place, like metadata being updated.
+ * \param sourceFile
+ * \param destinationFile the snapshot, replaced if it exists
+ * \return
+ */
+bool FileUtils::snapshotFile(const QString& sourceFile, const QString& destinationFile)
 {
-    if (sourceFile.isEmpty() || destinationFile.isEmpty()) return false;
+    QByteArray sourceName = QFile::encodeName(sourceFile);
+    QByteArray snapshotName = QFile::encodeName(destinationFile);
 
-    if (QFileInfo(destinationFile).exists()) {
-        QFile src(sourceFile);
-        QFile dst(destinationFile);
+    int source = ::open(sourceName.constData(), O_RDONLY | O_CLOEXEC);
+    if (source < 0)
+        return false;
 
-        if (!src.open(QIODevice::ReadOnly) || !dst.open(QIODevice::WriteOnly)) {
-            return false;
-        }
+    struct stat info;
+    if (::fstat(source, &info) != 0 || !S_ISREG(info.st_mode)) {
+        ::close(source);
+        return false;
+    }
 
-        if (dst.write(src.readAll()) < 0) {
-            return false;
-        }
+    ::unlink(snapshotName.constData());
 
-        src.close();
-        dst.close();
-        return QFile::remove(sourceFile);
+    int snapshot = ::open(snapshotName.constData(),
+                          O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, info.st_mode & 07777);
+    if (snapshot >= 0) {
+        bool cloned = reflink(source, snapshot) == TRANSFER_DONE;
+        cloned = (::close(snapshot) == 0) && cloned;
+        if (cloned) {
+            ::close(source);
+            return true;
+        }
+        ::unlink(snapshotName.constData());
     }
+    ::close(source);
+
+    return copyFile(sourceFile, destinationFile);
+}
+
+bool FileUtils::createDirectory(QString path) const
+{ 
+    if (path.isEmpty()) return false;
+
+    return QDir(path).mkpath(".");
+}
+
+QString FileUtils::createTemporaryDirectory(QString pathTemplate) const
+{
+    return makeTemporaryDirectory(pathTemplate);
+}
+
+bool FileUtils::removeDirectory(QString path, bool recursive) const
+{
+    return removeDirectoryAt(path, recursive);
+}
+
+bool FileUtils::remove(QString path) const
+{
+    if (path.isEmpty()) return false;
+    return QFile::remove(path);
+}
+
+bool FileUtils::copy(QString sourceFile, QString destinationFile) const
+{
+    if (sourceFile.isEmpty() || destinationFile.isEmpty()) return false;
+
+    return copyFile(sourceFile, destinationFile);
+}
+
+bool FileUtils::snapshot(QString sourceFile, QString destinationFile) const
+{
+    if (sourceFile.isEmpty() || destinationFile.isEmpty()) return false;
 
-    return QFile::rename(sourceFile, destinationFile);
+    return snapshotFile(sourceFile, destinationFile);
+}
+
+bool FileUtils::rename(QString sourceFile, QString destinationFile) const
+{
+    return renameFile(sourceFile, destinationFile);
 }
 
 QString FileUtils::parentDirectory(QString path) const
@@ -127,3 +436,165 @@ bool FileUtils::exists(QString path) const
 {
     return QFileInfo::exists(path);
 }
+
+/*!
+ * \brief FileUtils::pristineFile
+ * \param path a photo
+ * \return the copy of the photo from before it was first edited, or an
+ * empty string if it was never edited
+ */
+QString FileUtils::pristineFile(QString path) const
+{
+    if (path.isEmpty()) return QString();
+
+    return PhotoCaches(QFileInfo(path)).originalFile().filePath();
+}
+
+/*!
+ * \brief FileUtils::keepPristine
+ * Keeps a copy of a photo as it is now, to revert it to after editing it.
+ * \param path
+ * \return
+ */
+bool FileUtils::keepPristine(QString path) const
+{
+    if (path.isEmpty()) return false;
+
+    return PhotoCaches(QFileInfo(path)).cacheOriginal();
+}
+
+void FileUtils::discardPristine(QString path) const
+{
+    if (path.isEmpty()) return;
+
+    PhotoCaches(QFileInfo(path)).discardAll();
+}
+
+/*!
+ * \brief FileUtils::createTemporaryDirectoryAsync
+ * \param pathTemplate
+ * \param callback called with the path of the directory, or an empty string
+ * \return the number of the operation
+ */
+int FileUtils::createTemporaryDirectoryAsync(QString pathTemplate, QJSValue callback)
+{
+    return start([pathTemplate]() {
+        return QVariant(makeTemporaryDirectory(pathTemplate));
+    }, callback);
+}
+
+int FileUtils::removeDirectoryAsync(QString path, bool recursive, QJSValue callback)
+{
+    return start([path, recursive]() {
+        return QVariant(removeDirectoryAt(path, recursive));
+    }, callback);
+}
+
+int FileUtils::removeAsync(QString path, QJSValue callback)
+{
+    return start([path]() {
+        return QVariant(!path.isEmpty() && QFile::remove(path));
+    }, callback);
+}
+
+int FileUtils::copyAsync(QString sourceFile, QString destinationFile, QJSValue callback)
+{
+    return start([sourceFile, destinationFile]() {
+        return QVariant(!sourceFile.isEmpty() && !destinationFile.isEmpty() &&
+                        copyFile(sourceFile, destinationFile));
+    }, callback);
+}
+
+int FileUtils::snapshotAsync(QString sourceFile, QString destinationFile, QJSValue callback)
+{
+    return start([sourceFile, destinationFile]() {
+        return QVariant(!sourceFile.isEmpty() && !destinationFile.isEmpty() &&
+                        snapshotFile(sourceFile, destinationFile));
+    }, callback);
+}
+
+int FileUtils::renameAsync(QString sourceFile, QString destinationFile, QJSValue callback)
+{
+    return start([sourceFile, destinationFile]() {
+        return QVariant(renameFile(sourceFile, destinationFile));
+    }, callback);
+}
+
+int FileUtils::keepPristineAsync(QString path, QJSValue callback)
+{
+    return start([path]() {
+        return QVariant(!path.isEmpty() && PhotoCaches(QFileInfo(path)).cacheOriginal());
+    }, callback);
+}
+
+/*!
+ * \brief FileUtils::discardPristineAsync
+ * \param path
+ * \param callback called with true once done
+ * \return the number of the operation
+ */
+int FileUtils::discardPristineAsync(QString path, QJSValue callback)
+{
+    return start([path]() -> QVariant {
+        if (!path.isEmpty())
+            PhotoCaches(QFileInfo(path)).discardAll();
+        return QVariant(true);
+    }, callback);
+}
+
+/*!
+ * \brief FileUtils::busy
+ * \return whether some of the operations started from this object aren't
+ * done yet
+ */
+bool FileUtils::busy() const
+{
+    return !m_operations.isEmpty();
+}
+
+/*!
+ * \brief FileUtils::start
+ * Runs an operation on the I/O thread, and gets back to its callback once it
+ * is done.
+ * \param operation
+ * \param callback a function, or anything else for none
+ * \return the number of the operation
+ */
+int FileUtils::start(const std::function<QVariant()>& operation, const QJSValue& callback)
+{
+    Operation pending;
+    pending.number = ++m_lastOperation;
+    pending.callback = callback;
+
+    bool wasBusy = busy();
+    QFutureWatcher<QVariant>* watcher = new QFutureWatcher<QVariant>(this);
+    m_operations.insert(watcher, pending);
+    connect(watcher, SIGNAL(finished()), this, SLOT(finishOperation()));
+    watcher->setFuture(run(operation));
+
+    if (!wasBusy)
+        Q_EMIT busyChanged();
+    return pending.number;
+}
+
+void FileUtils::finishOperation()
+{
+    QFutureWatcher<QVariant>* watcher = static_cast<QFutureWatcher<QVariant>*>(sender());
+    if (!m_operations.contains(watcher))
+        return;
+
+    Operation operation = m_operations.take(watcher);
+    QVariant result = watcher->result();
+    watcher->deleteLater();
+
+    if (operation.callback.isCallable()) {
+        QJSValue returned = operation.callback.call(QJSValueList() << toScriptValue(result));
+        if (returned.isError())
+            qWarning() << "Error in the callback of file operation" << operation.number
+                       << returned.toString();
+    }
+
+    Q_EMIT operationFinished(operation.number, result);
+    if (!busy())
+        Q_EMIT busyChanged();
+}
@@ -17,26 +17,95 @@
 #ifndef PHOTOUTILS_H
 #define PHOTOUTILS_H
 
+#include <QFuture>
+#include <QHash>
+#include <QJSValue>
 #include <QObject>
+#include <QVariant>
 
+#include <functional>
+
+template <typename T> class QFutureWatcher;
+
+/*!
+ * \brief The FileUtils class
+ *
+ * File operations for QML. Each of the ones that take a while on slow
+ * storage has an asynchronous variant, which runs it on the I/O thread and
+ * returns right away with an operation number; once it is done, its
+ * optional callback gets called with the result, on the thread of the
+ * FileUtils, and operationFinished() gets emitted. The I/O thread runs the
+ * operations one at a time, in the order they were started, so that an
+ * operation can be started right after the ones it depends on.
+ */
 class FileUtils : public QObject
 {
     Q_OBJECT
+
+    Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+
 public:
     explicit FileUtils(QObject *parent = 0);
 
+    static QFuture<QVariant> run(const std::function<QVariant()>& operation);
+    static void waitForOperations();
+
+    static bool copyFile(const QString& sourceFile, const QString& destinationFile);
+    static bool copyContents(int sourceHandle, int destinationHandle);
+    static bool snapshotFile(const QString& sourceFile, const QString& destinationFile);
+
     Q_INVOKABLE bool createDirectory(QString path) const;
     Q_INVOKABLE bool removeDirectory(QString path, bool recursive = false) const;
     Q_INVOKABLE QString createTemporaryDirectory(QString pathTemplate) const;
 
     Q_INVOKABLE bool remove(QString path) const;
     Q_INVOKABLE bool copy(QString sourceFile, QString destinationFile) const;
+    Q_INVOKABLE bool snapshot(QString sourceFile, QString destinationFile) const;
     Q_INVOKABLE bool rename(QString sourceFile, QString destinationFile) const;
 
     Q_INVOKABLE QString parentDirectory(QString path) const;
     Q_INVOKABLE QString nameFromPath(QString path) const;
 
     Q_INVOKABLE bool exists(QString path) const;
+
+    Q_INVOKABLE QString pristineFile(QString path) const;
+    Q_INVOKABLE bool keepPristine(QString path) const;
+    Q_INVOKABLE void discardPristine(QString path) const;
+
+    Q_INVOKABLE int createTemporaryDirectoryAsync(QString pathTemplate,
+                                                  QJSValue callback = QJSValue());
+    Q_INVOKABLE int removeDirectoryAsync(QString path, bool recursive,
+                                         QJSValue callback = QJSValue());
+    Q_INVOKABLE int removeAsync(QString path, QJSValue callback = QJSValue());
+    Q_INVOKABLE int copyAsync(QString sourceFile, QString destinationFile,
+                              QJSValue callback = QJSValue());
+    Q_INVOKABLE int snapshotAsync(QString sourceFile, QString destinationFile,
+                                  QJSValue callback = QJSValue());
+    Q_INVOKABLE int renameAsync(QString sourceFile, QString destinationFile,
+                                QJSValue callback = QJSValue());
+    Q_INVOKABLE int keepPristineAsync(QString path, QJSValue callback = QJSValue());
+    Q_INVOKABLE int discardPristineAsync(QString path, QJSValue callback = QJSValue());
+
+    bool busy() const;
+
+Q_SIGNALS:
+    void busyChanged();
+    void operationFinished(int operation, const QVariant& result);
+
+private Q_SLOTS:
+    void finishOperation();
+
+private:
+    struct Operation
+    {
+        int number;
+        QJSValue callback;
+    };
+
+    int start(const std::function<QVariant()>& operation, const QJSValue& callback);
+
+    int m_lastOperation;
+    QHash<QFutureWatcher<QVariant>*, Operation> m_operations;
 };
 
 #endif // PHOTOUTILS_H
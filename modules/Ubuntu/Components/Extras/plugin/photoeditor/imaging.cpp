@@ -18,10 +18,222 @@
  */
 
 
-#include <QApplication>
+#include <QMutex>
+#include <QMutexLocker>
 #include <qmath.h>
 
+#include <climits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "imaging.h"
+#include "band-executor.h"
+
+namespace {
+/*
+ * The scanline kernels reproduce, without building any QColor, the arithmetic
+ * that QColor(pixel).getHsv() followed by QColor::setHsv().rgb() performs, so
+ * that their output matches the per pixel reference path exactly.
+ *
+ * QColor keeps its channels with 16 bits of precision and, depending on the
+ * Qt version, goes back to 8 bits either by truncating or by rounding. Probe
+ * which one is in use rather than assuming it.
+ */
+bool qColorRoundsTo8Bit()
+{
+    static const bool rounds =
+            QColor::fromRgbF(255.0 / USHRT_MAX, 0.0, 0.0).red() != 0;
+    return rounds;
+}
+
+inline int to8Bit(int value, bool rounding)
+{
+    return rounding ? ((value - (value >> 8) + 0x80) >> 8) : (value >> 8);
+}
+
+inline void rgbToHsv(QRgb pixel, bool rounding, int* h, int* s, int* v)
+{
+    const qreal r = (qRed(pixel) * 0x101) / qreal(USHRT_MAX);
+    const qreal g = (qGreen(pixel) * 0x101) / qreal(USHRT_MAX);
+    const qreal b = (qBlue(pixel) * 0x101) / qreal(USHRT_MAX);
+    const qreal max = qMax(r, qMax(g, b));
+    const qreal min = qMin(r, qMin(g, b));
+    const qreal delta = max - min;
+
+    *v = to8Bit(qRound(max * USHRT_MAX), rounding);
+
+    // achromatic case, hue is undefined
+    if (delta == qreal(0.0)) {
+        *h = -1;
+        *s = 0;
+        return;
+    }
+
+    *s = to8Bit(qRound((delta / max) * USHRT_MAX), rounding);
+
+    qreal hue;
+    if (r == max)
+        hue = (g - b) / delta;
+    else if (g == max)
+        hue = qreal(2.0) + (b - r) / delta;
+    else
+        hue = qreal(4.0) + (r - g) / delta;
+
+    hue *= qreal(60.0);
+    if (hue < qreal(0.0))
+        hue += qreal(360.0);
+
+    *h = qRound(hue * 100) / 100;
+}
+
+inline QRgb hsvToRgb(int h, int s, int v, bool rounding)
+{
+    if (s == 0 || h == -1) {
+        const int gray = to8Bit(v * 0x101, rounding);
+        return qRgb(gray, gray, gray);
+    }
+
+    const qreal hue = ((h % 360) * 100) / qreal(6000.);
+    const qreal sat = (s * 0x101) / qreal(USHRT_MAX);
+    const qreal val = (v * 0x101) / qreal(USHRT_MAX);
+    const int i = int(hue);
+    const qreal f = hue - i;
+    const qreal p = val * (qreal(1.0) - sat);
+
+    qreal red, green, blue;
+    if (i & 1) {
+        const qreal q = val * (qreal(1.0) - (sat * f));
+        switch (i) {
+        case 1:
+            red = q; green = val; blue = p;
+            break;
+        case 3:
+            red = p; green = q; blue = val;
+            break;
+        default:
+            red = val; green = p; blue = q;
+            break;
+        }
+    } else {
+        const qreal t = val * (qreal(1.0) - (sat * (qreal(1.0) - f)));
+        switch (i) {
+        case 0:
+            red = val; green = t; blue = p;
+            break;
+        case 2:
+            red = p; green = val; blue = t;
+            break;
+        default:
+            red = t; green = p; blue = val;
+            break;
+        }
+    }
+
+    return qRgb(to8Bit(qRound(red * USHRT_MAX), rounding),
+                to8Bit(qRound(green * USHRT_MAX), rounding),
+                to8Bit(qRound(blue * USHRT_MAX), rounding));
+}
+
+/*
+ * Remaps value, and optionally saturation, of every pixel in the line. Alpha
+ * is carried over untouched. Runs of identical pixels, which are common in
+ * photos, are converted only once.
+ */
+void remapScanLine(const QRgb* source, QRgb* destination, int width,
+                   const int* valueTable, const int* saturationTable)
+{
+    const bool rounding = qColorRoundsTo8Bit();
+
+    QRgb last_source = 0;
+    QRgb last_result = 0;
+    bool have_last = false;
+
+    for (int i = 0; i < width; i++) {
+        const QRgb pixel = source[i];
+        if (!have_last || pixel != last_source) {
+            int h, s, v;
+            rgbToHsv(pixel, rounding, &h, &s, &v);
+            if (saturationTable)
+                s = saturationTable[s];
+            last_result = (pixel & 0xff000000) |
+                    (hsvToRgb(h, s, valueTable[v], rounding) & 0x00ffffff);
+            last_source = pixel;
+            have_last = true;
+        }
+        destination[i] = last_result;
+    }
+}
+
+inline int maxChannel(QRgb pixel)
+{
+    return qMax(qRed(pixel), qMax(qGreen(pixel), qBlue(pixel)));
+}
+
+/*
+ * The intensity of a pixel is max(r, g, b), which is exactly what
+ * QColor::value() returns for it.
+ */
+void countRgb32(const QRgb* line, int width, int stride, int* counts)
+{
+    int i = 0;
+
+    // With 0xAARRGGBB pixels, the byte-wise maximum of the pixel and of the
+    // pixel shifted right by 8 and 16 bits has max(r, g, b) in its low byte.
+#if defined(__SSE2__)
+    if (stride == 1) {
+        const __m128i low_byte = _mm_set1_epi32(0xff);
+        int values[4];
+        for ( ; i + 4 <= width; i += 4) {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + i));
+            __m128i m = _mm_max_epu8(px, _mm_srli_epi32(px, 8));
+            m = _mm_and_si128(_mm_max_epu8(m, _mm_srli_epi32(px, 16)), low_byte);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(values), m);
+            counts[values[0]]++;
+            counts[values[1]]++;
+            counts[values[2]]++;
+            counts[values[3]]++;
+        }
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    if (stride == 1) {
+        const uint32x4_t low_byte = vdupq_n_u32(0xff);
+        uint32_t values[4];
+        for ( ; i + 4 <= width; i += 4) {
+            uint32x4_t px = vld1q_u32(reinterpret_cast<const uint32_t*>(line + i));
+            uint8x16_t m = vmaxq_u8(vreinterpretq_u8_u32(px),
+                                    vreinterpretq_u8_u32(vshrq_n_u32(px, 8)));
+            m = vmaxq_u8(m, vreinterpretq_u8_u32(vshrq_n_u32(px, 16)));
+            vst1q_u32(values, vandq_u32(vreinterpretq_u32_u8(m), low_byte));
+            counts[values[0]]++;
+            counts[values[1]]++;
+            counts[values[2]]++;
+            counts[values[3]]++;
+        }
+    }
+#endif
+
+    for ( ; i < width; i += stride)
+        counts[maxChannel(line[i])]++;
+}
+
+void countPremultiplied(const QRgb* line, int width, int stride, int* counts)
+{
+    for (int i = 0; i < width; i += stride)
+        counts[maxChannel(qUnpremultiply(line[i]))]++;
+}
+
+void countRgb888(const uchar* line, int width, int stride, int* counts)
+{
+    for (int i = 0; i < width; i += stride) {
+        const uchar* px = line + 3 * i;
+        counts[qMax(px[0], qMax(px[1], px[2]))]++;
+    }
+}
+} // namespace
 
 /*!
  * \brief HSVTransformation::transformPixel
@@ -42,29 +254,118 @@ QColor HSVTransformation::transformPixel(const QColor &pixel_color) const
     return result;
 }
 
+/*!
+ * \brief HSVTransformation::transformScanLine
+ * Same result as transformPixel() applied to each pixel of the line, without
+ * going through QColor. The source and destination may be the same line.
+ * \param source
+ * \param destination
+ * \param width
+ */
+void HSVTransformation::transformScanLine(const QRgb* source,
+                                          QRgb* destination, int width) const
+{
+    remapScanLine(source, destination, width, remap_table_, 0);
+}
+
 /*!
  * \brief IntensityHistogram::IntensityHistogram
+ * Counts the intensity, that is the HSV value, of every stride-th pixel of
+ * every stride-th row. A stride larger than one trades accuracy for speed.
  * \param basis_image
+ * \param stride
  */
-IntensityHistogram::IntensityHistogram(const QImage& basis_image)
+IntensityHistogram::IntensityHistogram(const QImage& basis_image, int stride)
 {
     for (int i = 0; i < 256; i++)
         m_counts[i] = 0;
 
-    int width = basis_image.width();
-    int height = basis_image.height();
-
-    for (int j = 0; j < height; j++) {
-        QApplication::processEvents();
+    stride = qMax(1, stride);
+
+    QImage image = basis_image;
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGB888:
+        break;
+    default:
+        image = image.convertToFormat(scanLineFormat(image));
+        break;
+    }
 
-        for (int i = 0; i < width; i++) {
-            QColor c = QColor(basis_image.pixel(i, j));
-            int intensity = c.value();
-            m_counts[intensity]++;
+    const QImage::Format format = image.format();
+    const int width = image.width();
+    const int sampled_rows = (image.height() + stride - 1) / stride;
+    const uchar* bits = image.constBits();
+    const int bytes_per_line = image.bytesPerLine();
+
+    QMutex mutex;
+    int* counts = m_counts;
+    BandExecutor::run(sampled_rows, [&](int first, int last) {
+        int band_counts[256] = { 0 };
+
+        for (int k = first; k < last; k++) {
+            const uchar* line = bits + (k * stride) * bytes_per_line;
+            if (format == QImage::Format_RGB888) {
+                countRgb888(line, width, stride, band_counts);
+            } else if (format == QImage::Format_ARGB32_Premultiplied) {
+                countPremultiplied(reinterpret_cast<const QRgb*>(line), width,
+                                   stride, band_counts);
+            } else {
+                countRgb32(reinterpret_cast<const QRgb*>(line), width,
+                           stride, band_counts);
+            }
         }
-    }
 
-    float pixel_count = (float)(width * height);
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < 256; i++)
+            counts[i] += band_counts[i];
+    });
+
+    computeProbabilities();
+}
+
+/*!
+ * \brief IntensityHistogram::IntensityHistogram
+ * An empty histogram, to be filled by transformed()
+ */
+IntensityHistogram::IntensityHistogram()
+{
+    for (int i = 0; i < 256; i++)
+        m_counts[i] = 0;
+}
+
+/*!
+ * \brief IntensityHistogram::transformed
+ * The histogram of the image obtained by applying the given transformation to
+ * the basis image. As an HSVTransformation only remaps the value, and the
+ * value of the resulting pixel is exactly the remapped one, there is no need
+ * to transform the image itself.
+ * \param transformation
+ * \return
+ */
+IntensityHistogram IntensityHistogram::transformed(
+        const HSVTransformation& transformation) const
+{
+    IntensityHistogram result;
+    for (int i = 0; i < 256; i++)
+        result.m_counts[transformation.remapValue(i)] += m_counts[i];
+
+    result.computeProbabilities();
+    return result;
+}
+
+/*!
+ * \brief IntensityHistogram::computeProbabilities
+ */
+void IntensityHistogram::computeProbabilities()
+{
+    qint64 total = 0;
+    for (int i = 0; i < 256; i++)
+        total += m_counts[i];
+
+    float pixel_count = (float) qMax(total, Q_INT64_C(1));
     float accumulator = 0.0f;
     for (int i = 0; i < 256; i++) {
         m_probabilities[i] = ((float) m_counts[i]) / pixel_count;
@@ -248,11 +549,13 @@ const float AutoEnhanceTransformation::SHADOW_AGGRESSIVENESS_MUL = 0.45f;
 /*!
  * \brief AutoEnhanceTransformation::AutoEnhanceTransformation
  * \param basis
+ * \param stride sampling stride used for the intensity histograms
  */
-AutoEnhanceTransformation::AutoEnhanceTransformation(const QImage& basis)
+AutoEnhanceTransformation::AutoEnhanceTransformation(const QImage& basis,
+                                                     int stride)
     : m_shadowTransform(0), m_toneExpansionTransform(0)
 {
-    IntensityHistogram histogram = IntensityHistogram(basis);
+    IntensityHistogram histogram = IntensityHistogram(basis, stride);
 
     /* compute the percentage of pixels in the image that fall into the
      shadow range -- this measures "of the pixels in the image, how many of
@@ -289,29 +592,14 @@ AutoEnhanceTransformation::AutoEnhanceTransformation(const QImage& basis)
         m_shadowTransform
                 = new ShadowDetailTransformation(shadow_trans_effect_size);
 
-        QImage shadow_corrected_image = QImage(basis);
-        // Can't write into indexed images, due to a limitation in Qt.
-        if (shadow_corrected_image.format() == QImage::Format_Indexed8)
-            shadow_corrected_image = shadow_corrected_image.convertToFormat(
-                        QImage::Format_RGB32);
-
-        for (int j = 0; j < shadow_corrected_image.height(); j++) {
-            QApplication::processEvents();
-
-            for (int i = 0; i < shadow_corrected_image.width(); i++) {
-                QColor px = m_shadowTransform->transformPixel(
-                            QColor(shadow_corrected_image.pixel(i, j)));
-                shadow_corrected_image.setPixel(i, j, px.rgb());
-            }
-        }
-
         m_toneExpansionTransform = new ToneExpansionTransformation(
-                    IntensityHistogram(shadow_corrected_image), 0.005f, 0.995f);
+                    histogram.transformed(*m_shadowTransform), 0.005f, 0.995f);
 
     } else {
-        m_toneExpansionTransform = new ToneExpansionTransformation(
-                    IntensityHistogram(basis));
+        m_toneExpansionTransform = new ToneExpansionTransformation(histogram);
     }
+
+    buildRemapTables();
 }
 
 /*!
@@ -324,6 +612,33 @@ AutoEnhanceTransformation::~AutoEnhanceTransformation()
     delete m_toneExpansionTransform;
 }
 
+/*!
+ * \brief AutoEnhanceTransformation::buildRemapTables
+ * Folds the shadow detail and tone expansion remaps, which both act on the
+ * value only, and the saturation compensation into two lookup tables.
+ */
+void AutoEnhanceTransformation::buildRemapTables()
+{
+    for (int i = 0; i < 256; i++) {
+        int v = i;
+        if (m_shadowTransform)
+            v = m_shadowTransform->remapValue(v);
+        m_valueTable[i] = m_toneExpansionTransform->remapValue(v);
+    }
+
+    if (m_toneExpansionTransform->isIdentity()) {
+        for (int i = 0; i < 256; i++)
+            m_saturationTable[i] = i;
+    } else {
+        float compensation_multiplier =
+                (m_toneExpansionTransform->lowDiscardMass() < 0.01f) ? 1.02f : 1.10f;
+
+        for (int i = 0; i < 256; i++)
+            m_saturationTable[i] = clampi((int) (((float) i) *
+                                                 compensation_multiplier), 0, 255);
+    }
+}
+
 /*!
  * \brief AutoEnhanceTransformation::transformPixel
  * \param pixel_color
@@ -357,7 +672,200 @@ QColor AutoEnhanceTransformation::transformPixel(
     return px;
 }
 
+/*!
+ * \brief AutoEnhanceTransformation::transformScanLine
+ * Same result as transformPixel() applied to each pixel of the line, without
+ * going through QColor. The source and destination may be the same line.
+ * \param source
+ * \param destination
+ * \param width
+ */
+void AutoEnhanceTransformation::transformScanLine(const QRgb* source,
+                                                  QRgb* destination,
+                                                  int width) const
+{
+    remapScanLine(source, destination, width, m_valueTable, m_saturationTable);
+}
+
+/*!
+ * \brief AutoEnhanceTransformation::transformRgb
+ * Same result as transformPixel(), without going through QColor.
+ * \param pixel
+ * \return
+ */
+QRgb AutoEnhanceTransformation::transformRgb(QRgb pixel) const
+{
+    QRgb result;
+    transformScanLine(&pixel, &result, 1);
+    return result;
+}
+
+/*!
+ * \brief AutoEnhanceTransformation::compileLut
+ * Samples the whole enhancement into a 3D lookup table. Further per pixel
+ * adjustments can be folded into it with ColorLut::folded().
+ * \param gridSize
+ * \return
+ */
+ColorLut AutoEnhanceTransformation::compileLut(int gridSize) const
+{
+    const AutoEnhanceTransformation* enhance = this;
+    return ColorLut::compile([enhance](QRgb pixel) {
+        return enhance->transformRgb(pixel);
+    }, gridSize);
+}
+
 bool AutoEnhanceTransformation::isIdentity() const
 {
     return false;
 }
+
+/*!
+ * \brief ExposureTransformation::ExposureTransformation
+ * \param compensation between -1.0 and 1.0 for the offset curve, in stops for
+ * the linear light one
+ * \param curve
+ */
+ExposureTransformation::ExposureTransformation(qreal compensation, Curve curve)
+{
+    if (curve == LINEAR_LIGHT_CURVE) {
+        const float gain = qPow(2.0, compensation);
+        for (int i = 0; i < 256; i++) {
+            // sRGB transfer function, both ways
+            float value = i / 255.0f;
+            float linear = (value <= 0.04045f) ? value / 12.92f
+                                               : qPow((value + 0.055f) / 1.055f, 2.4f);
+            linear = clampf(linear * gain, 0.0f, 1.0f);
+            value = (linear <= 0.0031308f) ? linear * 12.92f
+                                           : 1.055f * qPow(linear, 1.0f / 2.4f) - 0.055f;
+            m_table[i] = clampi(qRound(value * 255.0f), 0, 255);
+        }
+    } else {
+        const int shift = clampi((int) (255 * compensation), -255, 255);
+        for (int i = 0; i < 256; i++)
+            m_table[i] = clampi(i + shift, 0, 255);
+    }
+}
+
+/*!
+ * \brief ExposureTransformation::isIdentity
+ * \return
+ */
+bool ExposureTransformation::isIdentity() const
+{
+    for (int i = 0; i < 256; i++) {
+        if (m_table[i] != i)
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief ExposureTransformation::followedBy
+ * \param next
+ * \return a transformation that does this one and then the next one, with a
+ * single lookup
+ */
+ExposureTransformation ExposureTransformation::followedBy(
+        const ExposureTransformation& next) const
+{
+    ExposureTransformation result;
+    for (int i = 0; i < 256; i++)
+        result.m_table[i] = next.m_table[m_table[i]];
+    return result;
+}
+
+/*!
+ * \brief ExposureTransformation::transformRgb
+ * \param pixel a non premultiplied pixel
+ * \return
+ */
+QRgb ExposureTransformation::transformRgb(QRgb pixel) const
+{
+    return qRgba(m_table[qRed(pixel)], m_table[qGreen(pixel)],
+                 m_table[qBlue(pixel)], qAlpha(pixel));
+}
+
+/*!
+ * \brief ExposureTransformation::transformScanLine
+ * Transforms a scanline of Format_RGB32 or Format_ARGB32 pixels in place.
+ * \param line
+ * \param width
+ */
+void ExposureTransformation::transformScanLine(QRgb* line, int width) const
+{
+    for (int i = 0; i < width; i++)
+        line[i] = transformRgb(line[i]);
+}
+
+/*!
+ * \brief ExposureTransformation::transformScanLine
+ * Transforms a scanline in place, for any format transformsInPlace() accepts.
+ * \param line
+ * \param width
+ * \param format
+ */
+void ExposureTransformation::transformScanLine(uchar* line, int width,
+                                               QImage::Format format) const
+{
+    switch (format) {
+    case QImage::Format_RGB888:
+        for (int i = 0; i < width * 3; i++)
+            line[i] = m_table[line[i]];
+        break;
+
+    case QImage::Format_ARGB32_Premultiplied: {
+        QRgb* pixels = reinterpret_cast<QRgb*>(line);
+        for (int i = 0; i < width; i++) {
+            const int alpha = qAlpha(pixels[i]);
+            if (alpha == 255)
+                pixels[i] = transformRgb(pixels[i]);
+            else if (alpha != 0)
+                pixels[i] = qPremultiply(transformRgb(qUnpremultiply(pixels[i])));
+        }
+        break;
+    }
+
+    default:
+        transformScanLine(reinterpret_cast<QRgb*>(line), width);
+        break;
+    }
+}
+
+/*!
+ * \brief ExposureTransformation::transformsInPlace
+ * \param format
+ * \return true if transformScanLine() works on scanlines of this format
+ */
+bool ExposureTransformation::transformsInPlace(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32 ||
+            format == QImage::Format_ARGB32_Premultiplied ||
+            format == QImage::Format_RGB888;
+}
+
+/*!
+ * \brief ExposureTransformation::apply
+ * Transforms the image in place. Images of other formats than the ones
+ * transformsInPlace() accepts get converted to a 32 bit format first.
+ * \param image
+ */
+void ExposureTransformation::apply(QImage& image) const
+{
+    if (image.isNull() || isIdentity())
+        return;
+
+    if (!transformsInPlace(image.format()))
+        image = image.convertToFormat(scanLineFormat(image));
+
+    // bits() detaches the image from any copy sharing its pixels
+    uchar* bits = image.bits();
+    const int stride = image.bytesPerLine();
+    const int width = image.width();
+    const QImage::Format format = image.format();
+    const ExposureTransformation* exposure = this;
+    BandExecutor::run(image.height(), [=](int first, int last) {
+        for (int j = first; j < last; j++)
+            exposure->transformScanLine(bits + j * stride, width, format);
+    });
+}
@@ -20,8 +20,11 @@
 #ifndef GALLERY_UTIL_IMAGING_H_
 #define GALLERY_UTIL_IMAGING_H_
 
+#include "color-lut.h"
+
 #include <QColor>
 #include <QImage>
+#include <QRgb>
 #include <QVector4D>
 
 /*!
@@ -46,6 +49,16 @@ inline float clampf(float x, float min, float max) {
     return (x < min) ? min : ((x > max) ? max : x);
 }
 
+/*!
+ * \brief scanLineFormat
+ * The 32 bit format the scanline kernels below can work on for the given image
+ * \param image
+ * \return
+ */
+inline QImage::Format scanLineFormat(const QImage& image) {
+    return image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+}
+
 /*!
  * \brief The HSVTransformation class
  */
@@ -56,8 +69,12 @@ public:
     virtual ~HSVTransformation() { }
 
     virtual QColor transformPixel(const QColor& pixel_color) const;
+    virtual void transformScanLine(const QRgb* source, QRgb* destination,
+                                   int width) const;
     virtual bool isIdentity() const = 0;
 
+    int remapValue(int value) const { return remap_table_[value]; }
+
 protected:
     int remap_table_[256];
 };
@@ -68,12 +85,18 @@ protected:
 class IntensityHistogram
 {
 public:
-    IntensityHistogram(const QImage& basis_image);
+    IntensityHistogram(const QImage& basis_image, int stride = 1);
     virtual ~IntensityHistogram() { }
 
+    IntensityHistogram transformed(const HSVTransformation& transformation) const;
+
     float getCumulativeProbability(int level);
 
 private:
+    IntensityHistogram();
+
+    void computeProbabilities();
+
     int m_counts[256];
     float m_probabilities[256];
     float m_cumulativeProbabilities[256];
@@ -153,17 +176,60 @@ class AutoEnhanceTransformation : public virtual HSVTransformation
     static const float SHADOW_AGGRESSIVENESS_MUL;
 
 public:
-    AutoEnhanceTransformation(const QImage& basis_image);
+    AutoEnhanceTransformation(const QImage& basis_image, int stride = 1);
     virtual ~AutoEnhanceTransformation();
 
     QColor transformPixel(const QColor& pixel_color) const;
+    QRgb transformRgb(QRgb pixel) const;
+    void transformScanLine(const QRgb* source, QRgb* destination,
+                           int width) const;
     bool isIdentity() const;
 
+    ColorLut compileLut(int gridSize = ColorLut::DEFAULT_GRID_SIZE) const;
+
 private:
+    void buildRemapTables();
+
     ShadowDetailTransformation* m_shadowTransform;
     ToneExpansionTransformation* m_toneExpansionTransform;
+    int m_valueTable[256];
+    int m_saturationTable[256];
 };
 
+/*!
+ * \brief The ExposureTransformation class
+ *
+ * Exposure compensation as a table of 256 entries, shared by the three
+ * channels. Whatever the curve, applying it costs one lookup per channel, and
+ * alpha is left as it is.
+ */
+class ExposureTransformation
+{
+public:
+    enum Curve {
+        // Adds the compensation, times 255, to every channel
+        OFFSET_CURVE,
+        // Multiplies the light by 2 to the compensation, in linear light
+        LINEAR_LIGHT_CURVE
+    };
+
+    explicit ExposureTransformation(qreal compensation = 0.0,
+                                    Curve curve = OFFSET_CURVE);
+
+    bool isIdentity() const;
+    int remapValue(int value) const { return m_table[value]; }
+    ExposureTransformation followedBy(const ExposureTransformation& next) const;
+
+    QRgb transformRgb(QRgb pixel) const;
+    void transformScanLine(QRgb* line, int width) const;
+    void transformScanLine(uchar* line, int width, QImage::Format format) const;
+    void apply(QImage& image) const;
+
+    static bool transformsInPlace(QImage::Format format);
+
+private:
+    uchar m_table[256];
+};
 
 #endif  // GALLERY_UTIL_IMAGING_H_
 
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jpeg-io.h"
+
+#include <QDebug>
+
+namespace {
+const int BUFFER_SIZE = 64 * 1024;
+
+void errorExit(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    qWarning("Error editing JPEG: %s", message);
+
+    longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    qDebug("JPEG: %s", message);
+}
+
+struct DeviceSource
+{
+    jpeg_source_mgr pub;
+    QIODevice* device;
+    JOCTET buffer[BUFFER_SIZE];
+};
+
+void initSource(j_decompress_ptr)
+{
+}
+
+boolean fillInputBuffer(j_decompress_ptr cinfo)
+{
+    DeviceSource* source = reinterpret_cast<DeviceSource*>(cinfo->src);
+
+    qint64 count = source->device->read(reinterpret_cast<char*>(source->buffer),
+                                        BUFFER_SIZE);
+    if (count <= 0) {
+        // Let a truncated file decode as far as it goes
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        source->buffer[0] = 0xFF;
+        source->buffer[1] = JPEG_EOI;
+        count = 2;
+    }
+
+    source->pub.next_input_byte = source->buffer;
+    source->pub.bytes_in_buffer = count;
+    return TRUE;
+}
+
+void skipInputData(j_decompress_ptr cinfo, long count)
+{
+    if (count <= 0)
+        return;
+
+    jpeg_source_mgr* source = cinfo->src;
+    while (count > (long) source->bytes_in_buffer) {
+        count -= (long) source->bytes_in_buffer;
+        fillInputBuffer(cinfo);
+    }
+    source->next_input_byte += count;
+    source->bytes_in_buffer -= count;
+}
+
+void termSource(j_decompress_ptr)
+{
+}
+
+struct DeviceDestination
+{
+    jpeg_destination_mgr pub;
+    QIODevice* device;
+    JOCTET buffer[BUFFER_SIZE];
+};
+
+void initDestination(j_compress_ptr cinfo)
+{
+    DeviceDestination* destination = reinterpret_cast<DeviceDestination*>(cinfo->dest);
+    destination->pub.next_output_byte = destination->buffer;
+    destination->pub.free_in_buffer = BUFFER_SIZE;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo)
+{
+    DeviceDestination* destination = reinterpret_cast<DeviceDestination*>(cinfo->dest);
+
+    if (destination->device->write(reinterpret_cast<char*>(destination->buffer),
+                                   BUFFER_SIZE) != BUFFER_SIZE)
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+
+    destination->pub.next_output_byte = destination->buffer;
+    destination->pub.free_in_buffer = BUFFER_SIZE;
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo)
+{
+    DeviceDestination* destination = reinterpret_cast<DeviceDestination*>(cinfo->dest);
+
+    qint64 count = BUFFER_SIZE - destination->pub.free_in_buffer;
+    if (count > 0 &&
+            destination->device->write(reinterpret_cast<char*>(destination->buffer),
+                                       count) != count)
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+}
+} // namespace
+
+/*!
+ * \brief jpegErrorManager
+ * Sets up the error manager. The caller must call setjmp() on its jump buffer
+ * before passing it to any other libjpeg function.
+ * \param errors
+ * \return the manager to use as the err field of libjpeg objects
+ */
+jpeg_error_mgr* jpegErrorManager(JpegErrorManager* errors)
+{
+    jpeg_std_error(&errors->pub);
+    errors->pub.error_exit = errorExit;
+    errors->pub.output_message = outputMessage;
+    return &errors->pub;
+}
+
+/*!
+ * \brief jpegDeviceSource
+ * Makes libjpeg read the compressed data from the device, which lets it
+ * decode Qt resources. Call it after jpeg_create_decompress().
+ * \param cinfo
+ * \param device
+ */
+void jpegDeviceSource(j_decompress_ptr cinfo, QIODevice* device)
+{
+    // Allocated from the pool of the object, like jpeg_stdio_src() does
+    DeviceSource* source = reinterpret_cast<DeviceSource*>(
+                (*cinfo->mem->alloc_small)(reinterpret_cast<j_common_ptr>(cinfo),
+                                           JPOOL_PERMANENT, sizeof(DeviceSource)));
+    source->device = device;
+    source->pub.init_source = initSource;
+    source->pub.fill_input_buffer = fillInputBuffer;
+    source->pub.skip_input_data = skipInputData;
+    source->pub.resync_to_restart = jpeg_resync_to_restart;
+    source->pub.term_source = termSource;
+    source->pub.bytes_in_buffer = 0;
+    source->pub.next_input_byte = NULL;
+    cinfo->src = &source->pub;
+}
+
+/*!
+ * \brief jpegDeviceDestination
+ * Makes libjpeg write the compressed data to the device, a QSaveFile for
+ * instance. Call it after jpeg_create_compress().
+ * \param cinfo
+ * \param device
+ */
+void jpegDeviceDestination(j_compress_ptr cinfo, QIODevice* device)
+{
+    DeviceDestination* destination = reinterpret_cast<DeviceDestination*>(
+                (*cinfo->mem->alloc_small)(reinterpret_cast<j_common_ptr>(cinfo),
+                                           JPOOL_PERMANENT, sizeof(DeviceDestination)));
+    destination->device = device;
+    destination->pub.init_destination = initDestination;
+    destination->pub.empty_output_buffer = emptyOutputBuffer;
+    destination->pub.term_destination = termDestination;
+    cinfo->dest = &destination->pub;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_JPEG_IO_H_
+#define GALLERY_JPEG_IO_H_
+
+#include <QIODevice>
+
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+/*!
+ * \brief The JpegErrorManager struct
+ *
+ * Reports libjpeg errors through qWarning() and jumps back to the setjmp()
+ * of the caller, instead of exiting the process.
+ */
+struct JpegErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+jpeg_error_mgr* jpegErrorManager(JpegErrorManager* errors);
+
+void jpegDeviceSource(j_decompress_ptr cinfo, QIODevice* device);
+void jpegDeviceDestination(j_compress_ptr cinfo, QIODevice* device);
+
+#endif // GALLERY_JPEG_IO_H_
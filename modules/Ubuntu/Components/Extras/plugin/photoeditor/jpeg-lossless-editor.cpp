@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jpeg-lossless-editor.h"
+#include "jpeg-io.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QVector>
+
+#include <cstring>
+
+namespace {
+/*
+ * Size in pixels of the MCUs of a JPEG whose header has been read, or an
+ * empty size if the blocks can't simply be copied around.
+ */
+QSize mcuSize(const jpeg_decompress_struct& info)
+{
+    if (info.num_components == 1) {
+        // Single component scans aren't interleaved, whatever the sampling
+        // factors say; keep to the common case.
+        if (info.comp_info[0].h_samp_factor != 1 ||
+                info.comp_info[0].v_samp_factor != 1)
+            return QSize();
+        return QSize(DCTSIZE, DCTSIZE);
+    }
+
+    return QSize(info.max_h_samp_factor * DCTSIZE,
+                 info.max_v_samp_factor * DCTSIZE);
+}
+
+bool isMarker(const jpeg_saved_marker_ptr marker, int code, const char* name)
+{
+    const unsigned int length = strlen(name) + 1;
+    return marker->marker == code && marker->data_length >= length &&
+            memcmp(marker->data, name, length) == 0;
+}
+/*
+ * A transform of the pixel grid that maps blocks onto blocks: the image is
+ * transposed first, if at all, and then mirrored.
+ */
+struct BlockTransform
+{
+    bool transpose;
+    bool flipH;
+    bool flipV;
+};
+
+/*
+ * Splits a rotation or mirroring, as QTransform maps a point (x, y) to
+ * (m11 x + m21 y, m12 x + m22 y).
+ */
+BlockTransform blockTransform(const QTransform& transform)
+{
+    BlockTransform result;
+    result.transpose = qRound(transform.m11()) == 0;
+    if (result.transpose) {
+        result.flipH = qRound(transform.m21()) < 0;
+        result.flipV = qRound(transform.m12()) < 0;
+    } else {
+        result.flipH = qRound(transform.m11()) < 0;
+        result.flipV = qRound(transform.m22()) < 0;
+    }
+    return result;
+}
+
+/*
+ * Copies a block of coefficients through the transform. Transposing the
+ * pixels transposes the frequencies, and mirroring them negates the odd ones.
+ */
+void transformBlock(const JCOEF* source, JCOEF* target, const BlockTransform& transform)
+{
+    for (int v = 0; v < DCTSIZE; v++) {
+        for (int u = 0; u < DCTSIZE; u++) {
+            JCOEF value = transform.transpose ? source[u * DCTSIZE + v]
+                                              : source[v * DCTSIZE + u];
+            bool negate = (transform.flipH && (u & 1)) != (transform.flipV && (v & 1));
+            target[v * DCTSIZE + u] = negate ? -value : value;
+        }
+    }
+}
+} // namespace
+
+/*!
+ * \brief JpegLosslessEditor::blockSize
+ * \param sourcePath
+ * \return the size of the MCUs of the JPEG file, or an empty size if it can't
+ * be cropped losslessly
+ */
+QSize JpegLosslessEditor::blockSize(const QString& sourcePath)
+{
+    QFile file(sourcePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QSize();
+
+    jpeg_decompress_struct input;
+    memset(&input, 0, sizeof(input));
+    JpegErrorManager errors;
+    input.err = jpegErrorManager(&errors);
+
+    if (setjmp(errors.jump)) {
+        jpeg_destroy_decompress(&input);
+        return QSize();
+    }
+
+    jpeg_create_decompress(&input);
+    jpegDeviceSource(&input, &file);
+    jpeg_read_header(&input, TRUE);
+
+    QSize size = mcuSize(input);
+    jpeg_destroy_decompress(&input);
+    return size;
+}
+
+/*!
+ * \brief JpegLosslessEditor::apply
+ * Crops, rotates and mirrors the JPEG file as the pipeline says and writes the
+ * result to the destination, which then needs no orientation of its own. All
+ * markers, and so the metadata, are carried over as they are.
+ *
+ * If the pipeline snaps crops to blocks, the top left corner of the crop moves
+ * up and left to the nearest MCU boundary, and any edge that ends up mirrored
+ * is trimmed to one.
+ * \param sourcePath
+ * \param destination
+ * \param pipeline
+ * \return false if the file couldn't be edited losslessly; nothing has been
+ * written then, unless libjpeg failed or the pipeline got cancelled halfway
+ * through
+ */
+bool JpegLosslessEditor::apply(const QString& sourcePath, QIODevice* destination,
+                               const PhotoEditPipeline& pipeline)
+{
+    if (pipeline.hasToneEdits())
+        return false;
+
+    QFile file(sourcePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Error opening" << sourcePath << "for editing";
+        return false;
+    }
+
+    // Everything lives here, ahead of setjmp(), as libjpeg errors jump
+    // straight back to it.
+    jpeg_decompress_struct input;
+    jpeg_compress_struct output;
+    memset(&input, 0, sizeof(input));
+    memset(&output, 0, sizeof(output));
+
+    JpegErrorManager errors;
+    input.err = output.err = jpegErrorManager(&errors);
+
+    const BlockTransform transform = blockTransform(pipeline.transform());
+    QVector<jvirt_barray_ptr> edited;
+    QRect region;
+    QSize mcu;
+    QSize editedMcu;
+
+    if (setjmp(errors.jump)) {
+        jpeg_destroy_compress(&output);
+        jpeg_destroy_decompress(&input);
+        return false;
+    }
+
+    jpeg_create_decompress(&input);
+    jpegDeviceSource(&input, &file);
+    jpeg_save_markers(&input, JPEG_COM, 0xFFFF);
+    for (int i = 0; i < 16; i++)
+        jpeg_save_markers(&input, JPEG_APP0 + i, 0xFFFF);
+    jpeg_read_header(&input, TRUE);
+
+    const QSize size(input.image_width, input.image_height);
+    region = pipeline.sourceRect(size) & QRect(QPoint(0, 0), size);
+    mcu = mcuSize(input);
+    if (region.isEmpty() || mcu.isEmpty()) {
+        jpeg_destroy_decompress(&input);
+        return false;
+    }
+
+    // Blocks can only be moved whole: the crop has to start on an MCU, and
+    // the edges that get mirrored have to end on one
+    const bool snap = pipeline.snapsCropToBlocks();
+    const bool flipColumns = transform.transpose ? transform.flipV : transform.flipH;
+    const bool flipRows = transform.transpose ? transform.flipH : transform.flipV;
+    if (region.x() % mcu.width() != 0 || region.y() % mcu.height() != 0) {
+        if (!snap) {
+            jpeg_destroy_decompress(&input);
+            return false;
+        }
+        region.setLeft(region.x() - region.x() % mcu.width());
+        region.setTop(region.y() - region.y() % mcu.height());
+    }
+    if ((flipColumns && region.width() % mcu.width() != 0) ||
+            (flipRows && region.height() % mcu.height() != 0)) {
+        if (!snap) {
+            jpeg_destroy_decompress(&input);
+            return false;
+        }
+        if (flipColumns)
+            region.setWidth(region.width() - region.width() % mcu.width());
+        if (flipRows)
+            region.setHeight(region.height() - region.height() % mcu.height());
+        if (region.isEmpty()) {
+            jpeg_destroy_decompress(&input);
+            return false;
+        }
+    }
+
+    const QSize editedSize = transform.transpose ? region.size().transposed() : region.size();
+    editedMcu = transform.transpose ? mcu.transposed() : mcu;
+
+    // Coefficient arrays for the result, requested before reading the source
+    // so that libjpeg allocates all of them in one go
+    const int columns = (editedSize.width() + editedMcu.width() - 1) / editedMcu.width();
+    const int rows = (editedSize.height() + editedMcu.height() - 1) / editedMcu.height();
+    edited.resize(input.num_components);
+    for (int c = 0; c < input.num_components; c++) {
+        const jpeg_component_info& component = input.comp_info[c];
+        int h_samp = (input.num_components == 1) ? 1 : component.h_samp_factor;
+        int v_samp = (input.num_components == 1) ? 1 : component.v_samp_factor;
+        if (transform.transpose)
+            qSwap(h_samp, v_samp);
+        edited[c] = (*input.mem->request_virt_barray)(
+                    reinterpret_cast<j_common_ptr>(&input), JPOOL_IMAGE, FALSE,
+                    columns * h_samp, rows * v_samp, v_samp);
+    }
+
+    pipeline.beginStage(PhotoEditProgress::STAGE_DECODE, 1);
+    jvirt_barray_ptr* coefficients = jpeg_read_coefficients(&input);
+    pipeline.advance();
+
+    jpeg_create_compress(&output);
+    jpegDeviceDestination(&output, destination);
+    jpeg_copy_critical_parameters(&input, &output);
+    output.image_width = editedSize.width();
+    output.image_height = editedSize.height();
+    if (transform.transpose) {
+        for (int c = 0; c < output.num_components; c++)
+            qSwap(output.comp_info[c].h_samp_factor, output.comp_info[c].v_samp_factor);
+    }
+    jpeg_write_coefficients(&output, edited.data());
+
+    for (jpeg_saved_marker_ptr marker = input.marker_list; marker; marker = marker->next) {
+        // libjpeg writes its own JFIF and Adobe markers
+        if (output.write_JFIF_header && isMarker(marker, JPEG_APP0, "JFIF"))
+            continue;
+        if (output.write_Adobe_marker && isMarker(marker, JPEG_APP0 + 14, "Adobe"))
+            continue;
+        jpeg_write_marker(&output, marker->marker, marker->data, marker->data_length);
+    }
+
+    int blockRows = 0;
+    for (int c = 0; c < output.num_components; c++)
+        blockRows += output.comp_info[c].height_in_blocks;
+    pipeline.beginStage(PhotoEditProgress::STAGE_PROCESS, blockRows);
+
+    const bool copy = !transform.transpose && !transform.flipH && !transform.flipV;
+    for (int c = 0; c < output.num_components; c++) {
+        const jpeg_component_info& component = output.comp_info[c];
+        const jpeg_component_info& original = input.comp_info[c];
+        const int x_blocks = region.x() / mcu.width() * original.h_samp_factor;
+        const int y_blocks = region.y() / mcu.height() * original.v_samp_factor;
+        const int width = component.width_in_blocks;
+        const int height = component.height_in_blocks;
+
+        for (int y = 0; y < height; y += component.v_samp_factor) {
+            if (pipeline.isCancelled()) {
+                jpeg_destroy_compress(&output);
+                jpeg_destroy_decompress(&input);
+                return false;
+            }
+
+            JBLOCKARRAY target = (*input.mem->access_virt_barray)(
+                        reinterpret_cast<j_common_ptr>(&input), edited[c], y,
+                        component.v_samp_factor, TRUE);
+
+            if (copy) {
+                JBLOCKARRAY source = (*input.mem->access_virt_barray)(
+                            reinterpret_cast<j_common_ptr>(&input), coefficients[c],
+                            y + y_blocks, component.v_samp_factor, FALSE);
+                for (int row = 0; row < component.v_samp_factor; row++)
+                    memcpy(target[row], source[row] + x_blocks, width * sizeof(JBLOCK));
+                pipeline.advance(component.v_samp_factor);
+                continue;
+            }
+
+            for (int row = 0; row < component.v_samp_factor; row++) {
+                for (int x = 0; x < width; x++) {
+                    // Position of the block in the transposed source
+                    const int a = transform.flipH ? width - 1 - x : x;
+                    const int b = transform.flipV ? height - 1 - (y + row) : y + row;
+                    const int sourceX = (transform.transpose ? b : a) + x_blocks;
+                    const int sourceY = (transform.transpose ? a : b) + y_blocks;
+
+                    JBLOCKARRAY source = (*input.mem->access_virt_barray)(
+                                reinterpret_cast<j_common_ptr>(&input), coefficients[c],
+                                sourceY, 1, FALSE);
+                    transformBlock(source[0][sourceX], target[row][x], transform);
+                }
+            }
+            pipeline.advance(component.v_samp_factor);
+        }
+    }
+
+    // The coefficients only get entropy coded and written out now
+    pipeline.beginStage(PhotoEditProgress::STAGE_ENCODE, 1);
+    jpeg_finish_compress(&output);
+    pipeline.advance();
+    jpeg_destroy_compress(&output);
+    jpeg_finish_decompress(&input);
+    jpeg_destroy_decompress(&input);
+    return true;
+}
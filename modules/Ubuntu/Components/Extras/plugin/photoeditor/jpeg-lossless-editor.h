@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_JPEG_LOSSLESS_EDITOR_H_
+#define GALLERY_JPEG_LOSSLESS_EDITOR_H_
+
+#include "photo-edit-pipeline.h"
+
+#include <QIODevice>
+#include <QSize>
+#include <QString>
+
+/*!
+ * \brief The JpegLosslessEditor class
+ *
+ * Crops, rotates and mirrors JPEG files by moving their DCT coefficients
+ * around, the way jpegtran does, so that the pixels that are kept come out as
+ * they were, and much faster than decoding and encoding them again.
+ *
+ * This only works if the blocks of pixels the image is compressed in, its
+ * MCUs, move as a whole: the crop has to start on the grid of MCUs, and the
+ * edges that get mirrored have to end on it.
+ */
+class JpegLosslessEditor
+{
+public:
+    static bool apply(const QString& sourcePath, QIODevice* destination,
+                      const PhotoEditPipeline& pipeline);
+
+    static QSize blockSize(const QString& sourcePath);
+};
+
+#endif // GALLERY_JPEG_LOSSLESS_EDITOR_H_
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jpeg-strip-editor.h"
+#include "jpeg-io.h"
+
+// util
+#include "band-executor.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QImageReader>
+#include <QVector>
+
+#include <cstring>
+
+const int JpegStripEditor::STRIP_HEIGHT = 64;
+// Same as QImage::save() with the default quality
+const int JpegStripEditor::DEFAULT_QUALITY = 75;
+
+/*!
+ * \brief JpegStripEditor::apply
+ * Applies the crop and tonal edits of the pipeline to a JPEG file and writes
+ * the resulting JPEG, without any metadata, to the destination. Enhancement is
+ * analysed on a downscaled decode of the source.
+ * \param sourcePath
+ * \param destination
+ * \param pipeline
+ * \param quality
+ * \return false if the file couldn't be edited this way, in which case the
+ * destination may hold part of an image
+ */
+bool JpegStripEditor::apply(const QString& sourcePath, QIODevice* destination,
+                            const PhotoEditPipeline& pipeline, int quality)
+{
+    QFile file(sourcePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Error opening" << sourcePath << "for editing";
+        return false;
+    }
+
+    // Everything the decoding and encoding loop needs lives here, ahead of
+    // setjmp(), as libjpeg errors jump straight back to it.
+    jpeg_decompress_struct input;
+    jpeg_compress_struct output;
+    memset(&input, 0, sizeof(input));
+    memset(&output, 0, sizeof(output));
+
+    JpegErrorManager errors;
+    input.err = output.err = jpegErrorManager(&errors);
+
+    QVector<JSAMPLE> rgb;
+    QVector<QRgb> pixels;
+    QVector<JSAMPROW> rows(STRIP_HEIGHT);
+    PhotoEditPipeline::ScanLineKernel kernel;
+    QRect region;
+
+    if (setjmp(errors.jump)) {
+        jpeg_destroy_decompress(&input);
+        jpeg_destroy_compress(&output);
+        return false;
+    }
+
+    jpeg_create_decompress(&input);
+    jpegDeviceSource(&input, &file);
+
+    jpeg_read_header(&input, TRUE);
+
+    const QSize size(input.image_width, input.image_height);
+    region = pipeline.sourceRect(size) & QRect(QPoint(0, 0), size);
+    if (input.jpeg_color_space == JCS_CMYK || input.jpeg_color_space == JCS_YCCK ||
+            region.isEmpty()) {
+        jpeg_destroy_decompress(&input);
+        return false;
+    }
+
+    if (pipeline.hasToneEdits()) {
+        kernel = pipeline.toneKernel(size, [&sourcePath](const QRect& region, int stride) {
+            QImageReader reader(sourcePath);
+            reader.setClipRect(region);
+            reader.setScaledSize(QSize((region.width() + stride - 1) / stride,
+                                       (region.height() + stride - 1) / stride));
+            return reader.read();
+        });
+    }
+
+    input.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&input);
+
+    jpeg_create_compress(&output);
+    jpegDeviceDestination(&output, destination);
+
+    output.image_width = region.width();
+    output.image_height = region.height();
+    output.input_components = 3;
+    output.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&output);
+    jpeg_set_quality(&output, quality, TRUE);
+    output.density_unit = input.density_unit;
+    output.X_density = input.X_density;
+    output.Y_density = input.Y_density;
+    jpeg_start_compress(&output, TRUE);
+
+    const int row_size = input.output_width * 3;
+    rgb.resize(STRIP_HEIGHT * row_size);
+    pixels.resize(STRIP_HEIGHT * region.width());
+    for (int j = 0; j < STRIP_HEIGHT; j++)
+        rows[j] = rgb.data() + j * row_size;
+
+    // Decoding, editing and encoding all happen a strip at a time
+    const int bottom = region.y() + region.height();
+    pipeline.beginStage(PhotoEditProgress::STAGE_PROCESS, bottom);
+    while ((int) input.output_scanline < bottom) {
+        if (pipeline.isCancelled()) {
+            jpeg_destroy_compress(&output);
+            jpeg_destroy_decompress(&input);
+            return false;
+        }
+
+        // Rows above the crop are read into the strip and dropped
+        const int top = input.output_scanline;
+        const int wanted = qMin(STRIP_HEIGHT, bottom - top);
+        int count = 0;
+        while (count < wanted)
+            count += jpeg_read_scanlines(&input, rows.data() + count, wanted - count);
+
+        const int skipped = qMax(0, region.y() - top);
+        if (skipped >= count) {
+            pipeline.advance(count);
+            continue;
+        }
+
+        JSAMPROW* strip = rows.data() + skipped;
+        const int strip_height = count - skipped;
+        const int width = region.width();
+        const int left = region.x() * 3;
+        QRgb* pixel_rows = pixels.data();
+        BandExecutor::run(strip_height, [=, &kernel](int first, int last) {
+            for (int j = first; j < last; j++) {
+                JSAMPLE* row = strip[j];
+                if (kernel) {
+                    QRgb* line = pixel_rows + j * width;
+                    const JSAMPLE* in = row + left;
+                    for (int i = 0; i < width; i++, in += 3)
+                        line[i] = qRgb(in[0], in[1], in[2]);
+
+                    kernel(line, width);
+
+                    JSAMPLE* out = row;
+                    for (int i = 0; i < width; i++, out += 3) {
+                        out[0] = qRed(line[i]);
+                        out[1] = qGreen(line[i]);
+                        out[2] = qBlue(line[i]);
+                    }
+                } else if (left > 0) {
+                    memmove(row, row + left, width * 3);
+                }
+            }
+        });
+
+        jpeg_write_scanlines(&output, strip, strip_height);
+        pipeline.advance(count);
+    }
+
+    jpeg_finish_compress(&output);
+
+    // Rows below the crop are never decoded
+    if (input.output_scanline < input.output_height)
+        jpeg_abort_decompress(&input);
+    else
+        jpeg_finish_decompress(&input);
+
+    jpeg_destroy_compress(&output);
+    jpeg_destroy_decompress(&input);
+    return true;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_JPEG_STRIP_EDITOR_H_
+#define GALLERY_JPEG_STRIP_EDITOR_H_
+
+#include "photo-edit-pipeline.h"
+
+#include <QIODevice>
+#include <QString>
+
+/*!
+ * \brief The JpegStripEditor class
+ *
+ * Runs a PhotoEditPipeline over a JPEG file a few rows at a time, decoding,
+ * editing and encoding each strip before moving on to the next one, so that
+ * memory use grows with the width of the image but not with its height.
+ *
+ * Rows and columns outside the crop are simply skipped. Rotations can't be
+ * applied a strip at a time, so the pixels are written unrotated and the
+ * caller is expected to store fromTransform() of the pipeline transform as
+ * the orientation of the result.
+ */
+class JpegStripEditor
+{
+public:
+    static const int STRIP_HEIGHT;
+    static const int DEFAULT_QUALITY;
+
+    static bool apply(const QString& sourcePath, QIODevice* destination,
+                      const PhotoEditPipeline& pipeline,
+                      int quality = DEFAULT_QUALITY);
+};
+
+#endif // GALLERY_JPEG_STRIP_EDITOR_H_
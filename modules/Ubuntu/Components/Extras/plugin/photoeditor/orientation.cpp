@@ -105,6 +105,28 @@ Orientation OrientationCorrection::rotateOrientation(Orientation orientation, bo
     return sequence[next];
 }
 
+/*!
+ * \brief OrientationCorrection::fromTransform
+ * Finds the orientation whose correction is the given rotation or flip,
+ * ignoring any translation.
+ * \param transform
+ * \return the orientation, or TOP_LEFT_ORIGIN if there is none
+ */
+Orientation OrientationCorrection::fromTransform(const QTransform& transform)
+{
+    for (int o = MIN_ORIENTATION; o <= MAX_ORIENTATION; o++) {
+        Orientation orientation = static_cast<Orientation>(o);
+        QTransform candidate = fromOrientation(orientation).toTransform();
+        if (qRound(candidate.m11()) == qRound(transform.m11()) &&
+                qRound(candidate.m12()) == qRound(transform.m12()) &&
+                qRound(candidate.m21()) == qRound(transform.m21()) &&
+                qRound(candidate.m22()) == qRound(transform.m22()))
+            return orientation;
+    }
+
+    return TOP_LEFT_ORIGIN;
+}
+
 /*!
  * \brief OrientationCorrection::toTransform
  * Returns the correction as a QTransform.
@@ -45,6 +45,7 @@ public:
     static OrientationCorrection fromOrientation(Orientation o);
     static OrientationCorrection identity();
     static Orientation rotateOrientation(Orientation orientation, bool left);
+    static Orientation fromTransform(const QTransform& transform);
 
     QTransform toTransform() const;
 
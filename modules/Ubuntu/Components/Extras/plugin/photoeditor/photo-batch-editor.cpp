@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-batch-editor.h"
+#include "photo-caches.h"
+#include "photo-data.h"
+#include "photo-edit-job.h"
+#include "photo-probe-cache.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QPair>
+#include <QRunnable>
+#include <QThread>
+
+// Enough for a couple of 12 megapixel photos and their edited copies
+const qint64 PhotoBatchEditor::DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+namespace {
+// As often as it is worth redrawing a progress bar for
+const int PROGRESS_INTERVAL_MS = 100;
+
+// Decoded pixels take four bytes each, about ten times what a JPEG takes for
+// them; guessed high, as the guess only limits how many photos get edited at
+// once. The edited copy takes as many again.
+const int DECODED_BYTES_PER_FILE_BYTE = 12;
+const int COPIES_PER_EDIT = 2;
+} // namespace
+
+/*
+ * Edits one photo of the batch on the pool of the batch editor. Finding out
+ * the format and orientation of the photo is left to the task too, so that
+ * it doesn't hold up the thread the editor lives on.
+ */
+class BatchTask : public QRunnable
+{
+public:
+    BatchTask(PhotoBatchEditor* editor, int index, const QString& path,
+              const PhotoEditCommand& command, int rightTurns)
+        : m_editor(editor),
+          m_index(index),
+          m_path(path),
+          m_command(command),
+          m_rightTurns(rightTurns)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        bool success = false;
+        QFileInfo file(m_path);
+        if (!m_editor->isCancelled() && file.isFile())
+            success = edit(file);
+
+        QMetaObject::invokeMethod(m_editor, "finishFile", Qt::QueuedConnection,
+                                  Q_ARG(int, m_index), Q_ARG(bool, success));
+    }
+
+private:
+    bool edit(const QFileInfo& file)
+    {
+        PhotoProbe probe = PhotoProbeCache::probe(file);
+        QString format = probe.format;
+        Orientation orientation = TOP_LEFT_ORIGIN;
+        if (PhotoData::formatHasOrientation(format))
+            orientation = probe.orientation;
+
+        // Rotations turn from the orientation each photo has
+        PhotoEditCommand command = m_command;
+        if (command.type == EDIT_ROTATE) {
+            command.orientation = orientation;
+            for (int i = 0; i < m_rightTurns; i++)
+                command.orientation = OrientationCorrection::rotateOrientation(
+                            command.orientation, false);
+        }
+
+        // As when editing a single photo, the batch can be reverted, so a
+        // photo whose original can't be kept is left alone. One kept next to
+        // the photo by older versions is the one to keep.
+        PhotoCaches::migrate(file.absolutePath());
+        if (!PhotoCaches(file).cacheOriginal()) {
+            qWarning() << "Error keeping the original of" << file.filePath();
+            return false;
+        }
+
+        PhotoEditJob job(file, format, orientation,
+                         QList<PhotoEditCommand>() << command);
+        m_editor->setJob(m_index, &job);
+        bool success = !job.isCancelled() && job.edit();
+        m_editor->setJob(m_index, 0);
+        return success;
+    }
+
+    PhotoBatchEditor* m_editor;
+    int m_index;
+    QString m_path;
+    PhotoEditCommand m_command;
+    int m_rightTurns;
+};
+
+/*!
+ * \brief PhotoBatchEditor::PhotoBatchEditor
+ * \param parent
+ */
+PhotoBatchEditor::PhotoBatchEditor(QObject* parent)
+    : QObject(parent),
+      m_memoryBudget(DEFAULT_MEMORY_BUDGET),
+      m_rightTurns(0),
+      m_running(false),
+      m_next(0),
+      m_completedCount(0),
+      m_failedCount(0),
+      m_progress(0.0),
+      m_cancelled(0)
+{
+    m_pool.setMaxThreadCount(QThread::idealThreadCount());
+    m_progressTimer.setInterval(PROGRESS_INTERVAL_MS);
+    connect(&m_progressTimer, SIGNAL(timeout()), this, SLOT(updateProgress()));
+}
+
+/*!
+ * \brief PhotoBatchEditor::~PhotoBatchEditor
+ * Cancels the batch, and waits for the photos being edited to be left as
+ * they were.
+ */
+PhotoBatchEditor::~PhotoBatchEditor()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+/*!
+ * \brief PhotoBatchEditor::paths
+ * \return
+ */
+QStringList PhotoBatchEditor::paths() const
+{
+    return m_paths;
+}
+
+/*!
+ * \brief PhotoBatchEditor::setPaths
+ * Sets the photos the next batch edits. The batch in progress, if any, keeps
+ * editing the photos it started with.
+ * \param paths
+ */
+void PhotoBatchEditor::setPaths(const QStringList& paths)
+{
+    if (paths == m_paths)
+        return;
+
+    m_paths = paths;
+    Q_EMIT pathsChanged();
+}
+
+/*!
+ * \brief PhotoBatchEditor::memoryBudget
+ * \return the memory the photos being edited at once may take, in bytes
+ */
+qint64 PhotoBatchEditor::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+/*!
+ * \brief PhotoBatchEditor::setMemoryBudget
+ * A photo that needs more than the whole budget still gets edited, alone.
+ * \param bytes
+ */
+void PhotoBatchEditor::setMemoryBudget(qint64 bytes)
+{
+    if (bytes == m_memoryBudget)
+        return;
+
+    m_memoryBudget = bytes;
+    Q_EMIT memoryBudgetChanged();
+}
+
+/*!
+ * \brief PhotoBatchEditor::maxThreadCount
+ * \return the most photos edited at once, which is the number of cores
+ * unless set otherwise
+ */
+int PhotoBatchEditor::maxThreadCount() const
+{
+    return m_pool.maxThreadCount();
+}
+
+/*!
+ * \brief PhotoBatchEditor::setMaxThreadCount
+ * \param count
+ */
+void PhotoBatchEditor::setMaxThreadCount(int count)
+{
+    m_pool.setMaxThreadCount(qMax(1, count));
+}
+
+/*!
+ * \brief PhotoBatchEditor::running
+ * \return
+ */
+bool PhotoBatchEditor::running() const
+{
+    return m_running;
+}
+
+/*!
+ * \brief PhotoBatchEditor::progress
+ * \return how much of the batch is done, from 0.0 to 1.0, counting the
+ * progress of the photos being edited
+ */
+qreal PhotoBatchEditor::progress() const
+{
+    return m_progress;
+}
+
+/*!
+ * \brief PhotoBatchEditor::completedCount
+ * \return the number of photos of the batch edited so far
+ */
+int PhotoBatchEditor::completedCount() const
+{
+    return m_completedCount;
+}
+
+/*!
+ * \brief PhotoBatchEditor::failedCount
+ * \return the number of photos of the batch that couldn't be edited, or
+ * whose edit got cancelled halfway
+ */
+int PhotoBatchEditor::failedCount() const
+{
+    return m_failedCount;
+}
+
+/*!
+ * \brief PhotoBatchEditor::start
+ * Starts editing all the photos with the same command.
+ * \param command
+ * \param rightTurns for rotations, the number of turns to the right from the
+ * orientation of each photo
+ * \return false if a batch is running already
+ */
+bool PhotoBatchEditor::start(const PhotoEditCommand& command, int rightTurns)
+{
+    if (m_running)
+        return false;
+
+    m_batch = m_paths;
+    m_command = command;
+    m_rightTurns = rightTurns;
+    m_next = 0;
+    m_completedCount = 0;
+    m_failedCount = 0;
+    m_progress = 0.0;
+    m_cancelled.store(0);
+
+    m_running = true;
+    Q_EMIT runningChanged();
+    Q_EMIT progressChanged();
+
+    m_progressTimer.start();
+    schedule();
+    return true;
+}
+
+/*!
+ * \brief PhotoBatchEditor::rotateRight
+ * \return
+ */
+bool PhotoBatchEditor::rotateRight()
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ROTATE;
+    return start(command, 1);
+}
+
+/*!
+ * \brief PhotoBatchEditor::autoEnhance
+ * \return
+ */
+bool PhotoBatchEditor::autoEnhance()
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ENHANCE;
+    return start(command);
+}
+
+/*!
+ * \brief PhotoBatchEditor::exposureCompensation
+ * \param value as for PhotoData::exposureCompensation()
+ * \return
+ */
+bool PhotoBatchEditor::exposureCompensation(qreal value)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_COMPENSATE_EXPOSURE;
+    command.exposureCompensation = value;
+    return start(command);
+}
+
+/*!
+ * \brief PhotoBatchEditor::cancel
+ * Leaves the photos that haven't been edited yet as they are. Those being
+ * edited stop as soon as possible, and finished() gets emitted once they
+ * have.
+ */
+void PhotoBatchEditor::cancel()
+{
+    m_cancelled.store(1);
+
+    QMutexLocker locker(&m_jobsMutex);
+    Q_FOREACH(PhotoEditJob* job, m_jobs)
+        job->cancel();
+}
+
+/*!
+ * \brief PhotoBatchEditor::finishFile
+ * \param index
+ * \param success
+ */
+void PhotoBatchEditor::finishFile(int index, bool success)
+{
+    m_costs.remove(index);
+    if (success)
+        m_completedCount++;
+    else
+        m_failedCount++;
+
+    Q_EMIT fileFinished(m_batch.value(index), success);
+    updateProgress();
+    schedule();
+}
+
+/*!
+ * \brief PhotoBatchEditor::updateProgress samples the progress of the photos
+ * being edited
+ */
+void PhotoBatchEditor::updateProgress()
+{
+    QList<QPair<int, qreal> > files;
+    QMutexLocker locker(&m_jobsMutex);
+    for (QHash<int, PhotoEditJob*>::const_iterator i = m_jobs.constBegin();
+         i != m_jobs.constEnd(); ++i)
+        files.append(qMakePair(i.key(), i.value()->progress().progress()));
+    locker.unlock();
+
+    qreal done = m_completedCount + m_failedCount;
+    for (int i = 0; i < files.count(); i++) {
+        done += files.at(i).second;
+        Q_EMIT fileProgress(m_batch.value(files.at(i).first), files.at(i).second);
+    }
+
+    qreal progress = m_batch.isEmpty() ? 1.0 : done / m_batch.count();
+    if (progress != m_progress) {
+        m_progress = progress;
+        Q_EMIT progressChanged();
+    }
+}
+
+/*!
+ * \brief PhotoBatchEditor::schedule
+ * Starts editing as many more photos as there are threads and memory for,
+ * or finishes the batch once there are none left.
+ */
+void PhotoBatchEditor::schedule()
+{
+    if (!m_running)
+        return;
+
+    if (isCancelled())
+        m_next = m_batch.count();
+
+    while (m_next < m_batch.count() && m_costs.count() < m_pool.maxThreadCount()) {
+        qint64 cost = estimateCost(m_batch.at(m_next));
+        qint64 used = 0;
+        Q_FOREACH(qint64 running, m_costs)
+            used += running;
+        if (!m_costs.isEmpty() && used + cost > m_memoryBudget)
+            break;
+
+        m_costs.insert(m_next, cost);
+        Q_EMIT fileStarted(m_batch.at(m_next));
+        m_pool.start(new BatchTask(this, m_next, m_batch.at(m_next),
+                                   m_command, m_rightTurns));
+        m_next++;
+    }
+
+    if (!m_costs.isEmpty())
+        return;
+
+    // Whatever was left out after a cancellation counts as failed
+    m_failedCount = m_batch.count() - m_completedCount;
+    m_progressTimer.stop();
+    m_progress = 1.0;
+    m_running = false;
+    Q_EMIT progressChanged();
+    Q_EMIT runningChanged();
+    Q_EMIT finished();
+}
+
+/*!
+ * \brief PhotoBatchEditor::estimateCost
+ * Guesses from the size of the file, as the photo itself only gets read on
+ * the pool, not to hold up the thread the editor lives on.
+ * \param path
+ * \return the memory editing the photo takes at most
+ */
+qint64 PhotoBatchEditor::estimateCost(const QString& path) const
+{
+    return QFileInfo(path).size() * DECODED_BYTES_PER_FILE_BYTE * COPIES_PER_EDIT;
+}
+
+/*!
+ * \brief PhotoBatchEditor::setJob
+ * Lets the progress of a photo be followed, and its edit be cancelled, while
+ * it is being edited.
+ * \param index
+ * \param job or 0 once done
+ */
+void PhotoBatchEditor::setJob(int index, PhotoEditJob* job)
+{
+    QMutexLocker locker(&m_jobsMutex);
+    if (job) {
+        m_jobs.insert(index, job);
+        if (isCancelled())
+            job->cancel();
+    } else {
+        m_jobs.remove(index);
+    }
+}
+
+/*!
+ * \brief PhotoBatchEditor::isCancelled
+ * \return
+ */
+bool PhotoBatchEditor::isCancelled() const
+{
+    return m_cancelled.load() != 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_BATCH_EDITOR_H_
+#define GALLERY_PHOTO_BATCH_EDITOR_H_
+
+#include "photo-edit-command.h"
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+class PhotoEditJob;
+
+/*!
+ * \brief The PhotoBatchEditor class
+ *
+ * Applies the same edit to many photos, several of them at once. As many
+ * photos get edited at a time as there are cores, as long as their decoded
+ * pixels, as estimated from their size, fit in the memory budget.
+ */
+class PhotoBatchEditor : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QStringList paths READ paths WRITE setPaths NOTIFY pathsChanged)
+    Q_PROPERTY(qint64 memoryBudget READ memoryBudget WRITE setMemoryBudget NOTIFY memoryBudgetChanged)
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(int completedCount READ completedCount NOTIFY progressChanged)
+    Q_PROPERTY(int failedCount READ failedCount NOTIFY progressChanged)
+
+public:
+    static const qint64 DEFAULT_MEMORY_BUDGET;
+
+    explicit PhotoBatchEditor(QObject* parent = 0);
+    virtual ~PhotoBatchEditor();
+
+    QStringList paths() const;
+    void setPaths(const QStringList& paths);
+    qint64 memoryBudget() const;
+    void setMemoryBudget(qint64 bytes);
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+
+    bool running() const;
+    qreal progress() const;
+    int completedCount() const;
+    int failedCount() const;
+
+    bool start(const PhotoEditCommand& command, int rightTurns = 0);
+
+    Q_INVOKABLE bool rotateRight();
+    Q_INVOKABLE bool autoEnhance();
+    Q_INVOKABLE bool exposureCompensation(qreal value);
+    Q_INVOKABLE void cancel();
+
+Q_SIGNALS:
+    void pathsChanged();
+    void memoryBudgetChanged();
+    void runningChanged();
+    void progressChanged();
+
+    void fileStarted(const QString& path);
+    void fileProgress(const QString& path, qreal progress);
+    void fileFinished(const QString& path, bool success);
+    void finished();
+
+private Q_SLOTS:
+    void finishFile(int index, bool success);
+    void updateProgress();
+
+private:
+    friend class BatchTask;
+
+    void schedule();
+    qint64 estimateCost(const QString& path) const;
+
+    // Called by the tasks, from the pool threads
+    void setJob(int index, PhotoEditJob* job);
+    bool isCancelled() const;
+
+    QStringList m_paths;
+    qint64 m_memoryBudget;
+    QThreadPool m_pool;
+    QTimer m_progressTimer;
+
+    // The photos of the batch in progress
+    QStringList m_batch;
+    PhotoEditCommand m_command;
+    int m_rightTurns;
+    bool m_running;
+    int m_next;
+    int m_completedCount;
+    int m_failedCount;
+    qreal m_progress;
+    // Estimated memory use of the photos being edited, by index
+    QHash<int, qint64> m_costs;
+
+    mutable QMutex m_jobsMutex;
+    QHash<int, PhotoEditJob*> m_jobs;
+    QAtomicInt m_cancelled;
+};
+
+#endif // GALLERY_PHOTO_BATCH_EDITOR_H_
@@ -0,0 +1,676 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-cache-store.h"
+#include "file-existence-cache.h"
+#include "file-utils.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+
+#include <algorithm>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// Room for a few hundred edited photos
+const qint64 PhotoCacheStore::DEFAULT_BUDGET = 512 * 1024 * 1024;
+const QString PhotoCacheStore::ORIGINAL_PARAMETERS = "original";
+
+namespace {
+const QString INDEX_FILE = "index.json";
+
+// The content keys remembered, beyond which they are all forgotten
+const int MAX_HASHES = 1024;
+
+// How long a photo has to be gone before its original can be evicted. Photos
+// on a card that was taken out, or in the middle of being moved, come back.
+const qint64 ORPHAN_AGE = 7 * 24 * 60 * 60 * 1000LL;
+
+struct Entry
+{
+    Entry() : size(0), used(0) { }
+
+    QString fileName;
+    qint64 size;
+    // When the entry was last stored or found, in ms since the epoch
+    qint64 used;
+};
+
+// A content key, valid for as long as the file stays the same
+struct Hashed
+{
+    Hashed() : inode(0), mtime(0), mtimeNs(0), size(-1) { }
+
+    quint64 inode;
+    qint64 mtime;
+    qint64 mtimeNs;
+    qint64 size;
+    QString contentKey;
+};
+
+struct Store
+{
+    Store() : budget(PhotoCacheStore::DEFAULT_BUDGET), loaded(false), total(0) { }
+
+    QMutex mutex;
+    QString root;
+    qint64 budget;
+    bool loaded;
+    QHash<QString, Entry> entries;
+    // The sum of the sizes of the entries
+    qint64 total;
+    // The key of the original of each photo, by the path of the photo
+    QHash<QString, QString> originals;
+    // When each photo with an original was first found gone, in ms since the
+    // epoch
+    QHash<QString, qint64> missing;
+    QHash<QString, Hashed> hashes;
+};
+
+Store* store()
+{
+    static Store instance;
+    return &instance;
+}
+
+QString rootLocked(Store* s)
+{
+    if (s->root.isEmpty())
+        s->root = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+                "/photo-caches";
+    return s->root;
+}
+
+QString filePath(Store* s, const Entry& entry)
+{
+    return rootLocked(s) + "/" + entry.fileName;
+}
+
+void load(Store* s)
+{
+    if (s->loaded)
+        return;
+    s->loaded = true;
+    s->total = 0;
+
+    QFile index(rootLocked(s) + "/" + INDEX_FILE);
+    if (!index.open(QIODevice::ReadOnly))
+        return;
+
+    QJsonObject object = QJsonDocument::fromJson(index.readAll()).object();
+    QJsonObject entries = object.value("entries").toObject();
+    for (QJsonObject::const_iterator i = entries.constBegin(); i != entries.constEnd(); ++i) {
+        QJsonObject value = i.value().toObject();
+        Entry entry;
+        entry.fileName = value.value("file").toString();
+        entry.size = (qint64)value.value("size").toDouble();
+        entry.used = (qint64)value.value("used").toDouble();
+        if (!entry.fileName.isEmpty() && QFileInfo::exists(filePath(s, entry))) {
+            s->entries.insert(i.key(), entry);
+            s->total += entry.size;
+        }
+    }
+
+    QJsonObject originals = object.value("originals").toObject();
+    for (QJsonObject::const_iterator i = originals.constBegin(); i != originals.constEnd(); ++i) {
+        if (s->entries.contains(i.value().toString()))
+            s->originals.insert(i.key(), i.value().toString());
+    }
+
+    QJsonObject missing = object.value("missing").toObject();
+    for (QJsonObject::const_iterator i = missing.constBegin(); i != missing.constEnd(); ++i) {
+        if (s->originals.contains(i.key()))
+            s->missing.insert(i.key(), (qint64)i.value().toDouble());
+    }
+}
+
+void save(Store* s)
+{
+    QJsonObject entries;
+    for (QHash<QString, Entry>::const_iterator i = s->entries.constBegin();
+         i != s->entries.constEnd(); ++i) {
+        QJsonObject value;
+        value.insert("file", i.value().fileName);
+        value.insert("size", (double)i.value().size);
+        value.insert("used", (double)i.value().used);
+        entries.insert(i.key(), value);
+    }
+
+    QJsonObject originals;
+    for (QHash<QString, QString>::const_iterator i = s->originals.constBegin();
+         i != s->originals.constEnd(); ++i)
+        originals.insert(i.key(), i.value());
+
+    QJsonObject missing;
+    for (QHash<QString, qint64>::const_iterator i = s->missing.constBegin();
+         i != s->missing.constEnd(); ++i)
+        missing.insert(i.key(), (double)i.value());
+
+    QJsonObject object;
+    object.insert("entries", entries);
+    object.insert("originals", originals);
+    object.insert("missing", missing);
+
+    QDir().mkpath(rootLocked(s));
+    QSaveFile index(rootLocked(s) + "/" + INDEX_FILE);
+    if (!index.open(QIODevice::WriteOnly) ||
+            index.write(QJsonDocument(object).toJson(QJsonDocument::Compact)) < 0 ||
+            !index.commit())
+        qWarning() << "Error writing the index of the photo caches in" << rootLocked(s);
+}
+
+QString fileSuffix(const QString& file)
+{
+    return QFileInfo(file).suffix().toLower();
+}
+
+/*
+ * Copies a file into the store under a temporary name, which takes as long
+ * as the file is big and so happens without holding the mutex.
+ */
+QString snapshotInto(const QString& root, const QString& file, qint64* size)
+{
+    QDir().mkpath(root);
+
+    QString suffix = fileSuffix(file);
+    QTemporaryFile temporary(root + "/.XXXXXX" + (suffix.isEmpty() ? "" : "." + suffix));
+    temporary.setAutoRemove(false);
+    if (!temporary.open()) {
+        qWarning() << "Error caching" << file << "in" << root;
+        return QString();
+    }
+    temporary.close();
+
+    QString path = temporary.fileName();
+    if (!FileUtils::snapshotFile(file, path)) {
+        qWarning() << "Error caching" << file << "in" << root;
+        QFile::remove(path);
+        return QString();
+    }
+
+    *size = QFileInfo(path).size();
+    return path;
+}
+
+/*
+ * Puts a snapshot in place under a key, replacing what was kept under it
+ * before.
+ */
+QString commitLocked(Store* s, const QString& key, const QString& file,
+                     const QString& root, const QString& snapshot, qint64 size)
+{
+    // The store moved while the file was being copied
+    if (root != rootLocked(s)) {
+        QFile::remove(snapshot);
+        return QString();
+    }
+
+    QString suffix = fileSuffix(file);
+
+    Entry entry;
+    entry.fileName = suffix.isEmpty() ? key : key + "." + suffix;
+    entry.size = size;
+    entry.used = QDateTime::currentMSecsSinceEpoch();
+    QString path = filePath(s, entry);
+
+    if (::rename(QFile::encodeName(snapshot).constData(),
+                 QFile::encodeName(path).constData()) != 0) {
+        qWarning() << "Error caching" << path;
+        QFile::remove(snapshot);
+        return QString();
+    }
+    FileExistenceCache::invalidate(path);
+
+    if (s->entries.contains(key))
+        s->total -= s->entries.value(key).size;
+    s->entries.insert(key, entry);
+    s->total += entry.size;
+    return path;
+}
+
+void removeLocked(Store* s, const QString& key)
+{
+    if (!s->entries.contains(key))
+        return;
+
+    Entry entry = s->entries.take(key);
+    s->total -= entry.size;
+    QString path = filePath(s, entry);
+    QFile::remove(path);
+    FileExistenceCache::invalidate(path);
+
+    QList<QString> photos = s->originals.keys(key);
+    Q_FOREACH(const QString& photo, photos) {
+        s->originals.remove(photo);
+        s->missing.remove(photo);
+    }
+}
+
+bool lessRecentlyUsed(const QPair<qint64, QString>& a, const QPair<qint64, QString>& b)
+{
+    return a.first < b.first;
+}
+
+/*
+ * Whether the original of a photo is still needed for reverting it. A photo
+ * that is gone only stops needing it once it was seen gone for ORPHAN_AGE,
+ * and is confirmed gone still.
+ */
+bool needsOriginalLocked(Store* s, const QString& photo, qint64 now)
+{
+    if (FileExistenceCache::exists(photo)) {
+        s->missing.remove(photo);
+        return true;
+    }
+
+    if (!s->missing.contains(photo)) {
+        s->missing.insert(photo, now);
+        return true;
+    }
+
+    if (now - s->missing.value(photo) < ORPHAN_AGE)
+        return true;
+
+    if (FileExistenceCache::confirm(photo)) {
+        s->missing.remove(photo);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Removes the least recently used entries until the store fits its budget.
+ * The originals of photos that are gone for good are not needed for
+ * reverting anymore, and are removed like any other entry.
+ */
+void evictLocked(Store* s)
+{
+    if (s->total <= s->budget)
+        return;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QSet<QString> pinned;
+    QList<QString> photos = s->originals.keys();
+    Q_FOREACH(const QString& photo, photos) {
+        if (needsOriginalLocked(s, photo, now)) {
+            pinned.insert(s->originals.value(photo));
+        } else {
+            s->originals.remove(photo);
+            s->missing.remove(photo);
+        }
+    }
+
+    QList<QPair<qint64, QString> > candidates;
+    for (QHash<QString, Entry>::const_iterator i = s->entries.constBegin();
+         i != s->entries.constEnd(); ++i) {
+        if (!pinned.contains(i.key()))
+            candidates.append(qMakePair(i.value().used, i.key()));
+    }
+    std::sort(candidates.begin(), candidates.end(), lessRecentlyUsed);
+
+    // If the originals alone are over budget, they are kept all the same
+    for (int i = 0; i < candidates.size() && s->total > s->budget; ++i)
+        removeLocked(s, candidates.at(i).second);
+}
+
+/*
+ * Makes an original the one of a photo, for as long as the photo needs it.
+ */
+void pinLocked(Store* s, const QString& photo, const QString& originalKey)
+{
+    s->originals.insert(photo, originalKey);
+    s->missing.remove(photo);
+    evictLocked(s);
+    save(s);
+}
+} // namespace
+
+/*!
+ * \brief PhotoCacheStore::root
+ * \return the directory of the store
+ */
+QString PhotoCacheStore::root()
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    return rootLocked(s);
+}
+
+/*!
+ * \brief PhotoCacheStore::setRoot
+ * Moves the store to another directory, forgetting about the files in the
+ * previous one.
+ * \param path
+ */
+void PhotoCacheStore::setRoot(const QString& path)
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    s->root = path;
+    s->loaded = false;
+    s->entries.clear();
+    s->total = 0;
+    s->originals.clear();
+    s->missing.clear();
+}
+
+/*!
+ * \brief PhotoCacheStore::budget
+ * \return the number of bytes the store keeps to
+ */
+qint64 PhotoCacheStore::budget()
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    return s->budget;
+}
+
+/*!
+ * \brief PhotoCacheStore::setBudget
+ * \param bytes
+ */
+void PhotoCacheStore::setBudget(qint64 bytes)
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    s->budget = bytes;
+}
+
+/*!
+ * \brief PhotoCacheStore::size
+ * \return the number of bytes in the store
+ */
+qint64 PhotoCacheStore::size()
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+    return s->total;
+}
+
+/*!
+ * \brief PhotoCacheStore::count
+ * \return the number of files in the store
+ */
+int PhotoCacheStore::count()
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+    return s->entries.count();
+}
+
+/*!
+ * \brief PhotoCacheStore::contentKey
+ * Hashes the contents of a file, reading it only the first time for as long
+ * as it stays the same.
+ * \param file
+ * \return the hash, or an empty string if the file can't be read
+ */
+QString PhotoCacheStore::contentKey(const QString& file)
+{
+    QString path = QFileInfo(file).absoluteFilePath();
+
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) != 0)
+        return QString();
+
+    Hashed hashed;
+    hashed.inode = info.st_ino;
+    hashed.mtime = info.st_mtim.tv_sec;
+    hashed.mtimeNs = info.st_mtim.tv_nsec;
+    hashed.size = info.st_size;
+
+    Store* s = store();
+    {
+        QMutexLocker locker(&s->mutex);
+        Hashed known = s->hashes.value(path);
+        if (known.inode == hashed.inode && known.mtime == hashed.mtime &&
+                known.mtimeNs == hashed.mtimeNs && known.size == hashed.size)
+            return known.contentKey;
+    }
+
+    QFile device(path);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!device.open(QIODevice::ReadOnly) || !hash.addData(&device))
+        return QString();
+    hashed.contentKey = QString::fromLatin1(hash.result().toHex());
+
+    QMutexLocker locker(&s->mutex);
+    if (s->hashes.count() >= MAX_HASHES)
+        s->hashes.clear();
+    s->hashes.insert(path, hashed);
+    return hashed.contentKey;
+}
+
+/*!
+ * \brief PhotoCacheStore::key
+ * \param contentKey the key of the contents a file was made from
+ * \param parameters how the file was made from them
+ * \return the key of the file
+ */
+QString PhotoCacheStore::key(const QString& contentKey, const QString& parameters)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(contentKey.toUtf8());
+    hash.addData("\n", 1);
+    hash.addData(parameters.toUtf8());
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+/*!
+ * \brief PhotoCacheStore::insert
+ * Keeps a snapshot of a file under a key, replacing what was kept under it
+ * before, and makes room for it if need be. The file is copied before the
+ * store is locked, which only gets held to index the copy.
+ * \param key
+ * \param file
+ * \return the path of the kept file, or an empty string if it could not be
+ * kept
+ */
+QString PhotoCacheStore::insert(const QString& key, const QString& file)
+{
+    QString storeRoot = root();
+    qint64 size = 0;
+    QString snapshot = snapshotInto(storeRoot, file, &size);
+    if (snapshot.isEmpty())
+        return snapshot;
+
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    QString path = commitLocked(s, key, file, storeRoot, snapshot, size);
+    if (path.isEmpty())
+        return path;
+
+    evictLocked(s);
+    save(s);
+    return s->entries.contains(key) ? path : QString();
+}
+
+/*!
+ * \brief PhotoCacheStore::find
+ * The time an entry was last used is only written to the index along with
+ * the next change to the store.
+ * \param key
+ * \return the path of the file kept under the key, or an empty string
+ */
+QString PhotoCacheStore::find(const QString& key)
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    if (!s->entries.contains(key))
+        return QString();
+
+    Entry& entry = s->entries[key];
+    QString path = filePath(s, entry);
+    if (!FileExistenceCache::exists(path)) {
+        removeLocked(s, key);
+        save(s);
+        return QString();
+    }
+
+    entry.used = QDateTime::currentMSecsSinceEpoch();
+    return path;
+}
+
+/*!
+ * \brief PhotoCacheStore::remove
+ * \param key
+ */
+void PhotoCacheStore::remove(const QString& key)
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    if (!s->entries.contains(key))
+        return;
+    removeLocked(s, key);
+    save(s);
+}
+
+/*!
+ * \brief PhotoCacheStore::keepOriginal
+ * Keeps the original of a photo, which then can't be evicted for as long as
+ * the photo exists, or has not been gone for long. A photo that already has
+ * an original keeps it.
+ * \param photo
+ * \param file the original, if not the photo as it is now
+ * \return the path of the original, or an empty string if it could not be
+ * kept
+ */
+QString PhotoCacheStore::keepOriginal(const QString& photo, const QString& file)
+{
+    QString path = QFileInfo(photo).absoluteFilePath();
+    QString source = file.isEmpty() ? path : file;
+
+    // The photo is about to be written over on the strength of it
+    QString existing = original(path);
+    if (!existing.isEmpty() && FileExistenceCache::confirm(existing))
+        return existing;
+
+    QString content = contentKey(source);
+    if (content.isEmpty())
+        return QString();
+    QString originalKey = key(content, ORIGINAL_PARAMETERS);
+
+    Store* s = store();
+    {
+        QMutexLocker locker(&s->mutex);
+        load(s);
+
+        if (s->entries.contains(originalKey) &&
+                FileExistenceCache::confirm(filePath(s, s->entries.value(originalKey)))) {
+            // Another photo with the same contents
+            Entry& entry = s->entries[originalKey];
+            entry.used = QDateTime::currentMSecsSinceEpoch();
+            QString kept = filePath(s, entry);
+            pinLocked(s, path, originalKey);
+            return kept;
+        }
+    }
+
+    QString storeRoot = root();
+    qint64 size = 0;
+    QString snapshot = snapshotInto(storeRoot, source, &size);
+    if (snapshot.isEmpty())
+        return snapshot;
+
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    QString kept = commitLocked(s, originalKey, source, storeRoot, snapshot, size);
+    if (!kept.isEmpty())
+        pinLocked(s, path, originalKey);
+    return kept;
+}
+
+/*!
+ * \brief PhotoCacheStore::original
+ * \param photo
+ * \return the path of the original of the photo, or an empty string if it
+ * has none
+ */
+QString PhotoCacheStore::original(const QString& photo)
+{
+    QString path = QFileInfo(photo).absoluteFilePath();
+
+    QString originalKey;
+    {
+        Store* s = store();
+        QMutexLocker locker(&s->mutex);
+        load(s);
+        originalKey = s->originals.value(path);
+    }
+
+    return originalKey.isEmpty() ? QString() : find(originalKey);
+}
+
+/*!
+ * \brief PhotoCacheStore::discardOriginal
+ * Removes the original of a photo, unless another photo has the same one.
+ * \param photo
+ */
+void PhotoCacheStore::discardOriginal(const QString& photo)
+{
+    QString path = QFileInfo(photo).absoluteFilePath();
+
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    if (!s->originals.contains(path))
+        return;
+
+    QString originalKey = s->originals.take(path);
+    s->missing.remove(path);
+    if (s->originals.key(originalKey).isEmpty())
+        removeLocked(s, originalKey);
+    save(s);
+}
+
+/*!
+ * \brief PhotoCacheStore::evict
+ * Makes the store fit its budget, after it was lowered.
+ */
+void PhotoCacheStore::evict()
+{
+    Store* s = store();
+    QMutexLocker locker(&s->mutex);
+    load(s);
+
+    evictLocked(s);
+    save(s);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_CACHE_STORE_H_
+#define GALLERY_PHOTO_CACHE_STORE_H_
+
+#include <QString>
+
+/*!
+ * \brief The PhotoCacheStore class
+ *
+ * The one place where the files kept besides the photos live, under the
+ * cache directory of the application. Files are keyed by the hash of the
+ * contents they were made from plus the parameters they were made with, so
+ * that the same photo under two names is only kept once.
+ *
+ * The store keeps to a budget of bytes by removing the least recently used
+ * files, except for the originals of photos that still exist: those are
+ * needed to revert the photos, and stay until they are discarded, or until
+ * the photos are gone for days.
+ */
+class PhotoCacheStore
+{
+public:
+    static const qint64 DEFAULT_BUDGET;
+    static const QString ORIGINAL_PARAMETERS;
+
+    static QString root();
+    static void setRoot(const QString& path);
+    static qint64 budget();
+    static void setBudget(qint64 bytes);
+    static qint64 size();
+    static int count();
+
+    static QString contentKey(const QString& file);
+    static QString key(const QString& contentKey, const QString& parameters);
+
+    static QString insert(const QString& key, const QString& file);
+    static QString find(const QString& key);
+    static void remove(const QString& key);
+
+    static QString keepOriginal(const QString& photo, const QString& file = QString());
+    static QString original(const QString& photo);
+    static void discardOriginal(const QString& photo);
+
+    static void evict();
+};
+
+#endif // GALLERY_PHOTO_CACHE_STORE_H_
@@ -18,27 +18,43 @@
  */
 
 #include "photo-caches.h"
+#include "file-existence-cache.h"
+#include "file-utils.h"
+#include "photo-cache-store.h"
 
+#include <QDebug>
 #include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
 #include <utime.h>
 
 const QString PhotoCaches::ORIGINAL_DIR = ".original";
 const QString PhotoCaches::ENHANCED_DIR = ".enhanced";
+const QString PhotoCaches::ENHANCED_PARAMETERS = "enhance";
+
+namespace {
+// The directories whose migration was started, by their path
+struct Migrations
+{
+    QMutex mutex;
+    QSet<QString> started;
+};
+
+Migrations* migrations()
+{
+    static Migrations instance;
+    return &instance;
+}
+} // namespace
 
 /*!
  * \brief PhotoCaches::PhotoCaches
  * \param file
  */
-PhotoCaches::PhotoCaches(const QFileInfo& file) : m_file(file),
-    m_originalFile(file.dir(),
-                   QString("%1/%2").arg(ORIGINAL_DIR).arg(file.fileName())),
-    m_enhancedFile(file.dir(),
-                   QString("%1/%2").arg(ENHANCED_DIR).arg(file.fileName()))
+PhotoCaches::PhotoCaches(const QFileInfo& file) : m_file(file)
 {
-    // We always want our file checks to hit the disk.
-    m_file.setCaching(false);
-    m_originalFile.setCaching(false);
-    m_enhancedFile.setCaching(false);
 }
 
 /*!
@@ -47,7 +63,7 @@ PhotoCaches::PhotoCaches(const QFileInfo& file) : m_file(file),
  */
 bool PhotoCaches::hasCachedOriginal() const
 {
-    return m_originalFile.exists();
+    return !originalFile().filePath().isEmpty();
 }
 
 /*!
@@ -56,25 +72,31 @@ bool PhotoCaches::hasCachedOriginal() const
  */
 bool PhotoCaches::hasCachedEnhanced() const
 {
-    return m_enhancedFile.exists();
+    return !enhancedFile().filePath().isEmpty();
 }
 
 /*!
  * \brief PhotoCaches::originalFile
- * \return
+ * \return the original in the store, or an empty QFileInfo if there is none
  */
-const QFileInfo& PhotoCaches::originalFile() const
+QFileInfo PhotoCaches::originalFile() const
 {
-    return m_originalFile;
+    QString path = PhotoCacheStore::original(m_file.absoluteFilePath());
+    return path.isEmpty() ? QFileInfo() : QFileInfo(path);
 }
 
 /*!
  * \brief PhotoCaches::enhancedFile
- * \return
+ * \return the enhanced in the store, or an empty QFileInfo if there is none
  */
-const QFileInfo& PhotoCaches::enhancedFile() const
+QFileInfo PhotoCaches::enhancedFile() const
 {
-    return m_enhancedFile;
+    QString key = enhancedKey(pristineFile());
+    if (key.isEmpty())
+        return QFileInfo();
+
+    QString path = PhotoCacheStore::find(key);
+    return path.isEmpty() ? QFileInfo() : QFileInfo(path);
 }
 
 /*!
@@ -83,59 +105,68 @@ const QFileInfo& PhotoCaches::enhancedFile() const
  * to the constructor.
  * \return
  */
-const QFileInfo& PhotoCaches::pristineFile() const
+QFileInfo PhotoCaches::pristineFile() const
 {
-    return (hasCachedOriginal() ? m_originalFile : m_file);
+    QFileInfo original = originalFile();
+    return original.filePath().isEmpty() ? m_file : original;
 }
 
 /*!
  * \brief PhotoCaches::cacheOriginal
- * Moves the pristine file into .original so we don't mess it up.  Note that
- * this potentially removes the main file, so it must be followed by a copy
- * from original (or elsewhere) back to the file.
+ * Keeps a snapshot of the pristine file in the store so we don't mess it up.
+ * The file itself stays where it is.
  * \return
  */
 bool PhotoCaches::cacheOriginal()
 {
-    if (hasCachedOriginal()) {
+    QFileInfo original = originalFile();
+    if (!original.filePath().isEmpty() &&
+            FileExistenceCache::confirm(original.absoluteFilePath())) {
         return true;
     }
 
-    m_file.dir().mkdir(ORIGINAL_DIR);
-
-    return rename(m_file, m_originalFile);
+    return !PhotoCacheStore::keepOriginal(m_file.absoluteFilePath()).isEmpty();
 }
 
 /*!
  * \brief PhotoCaches::restoreOriginal
- * Moves the file out of .original, overwriting the main file.  Note that
- * this removes the .original file.
+ * Puts the original back in place of the main file.  Note that this
+ * discards the original from the store.
  * \return
  */
 bool PhotoCaches::restoreOriginal()
 {
-    if (!hasCachedOriginal()) {
+    QFileInfo original = originalFile();
+    if (original.filePath().isEmpty()) {
         return true;
     }
+    if (!FileExistenceCache::confirm(original.absoluteFilePath())) {
+        qWarning() << "The original of" << m_file.filePath() << "is gone";
+        return false;
+    }
 
-    remove(m_file);
+    if (!FileUtils::snapshotFile(original.absoluteFilePath(), m_file.absoluteFilePath()))
+        return false;
     // touch the file so that the thumbnails will correctly regenerate
-    utime(m_originalFile.absoluteFilePath().toUtf8(), NULL);
-    return rename(m_originalFile, m_file);
+    utime(QFile::encodeName(m_file.absoluteFilePath()).constData(), NULL);
+
+    discardAll();
+    return true;
 }
 
 /*!
  * \brief PhotoCaches::cacheEnhancedFromOriginal
- * Copies the file in .original to .enhanced so it can then be enhanced.
+ * Copies the original to the enhanced so it can then be enhanced.
  * \return
  */
 bool PhotoCaches::cacheEnhancedFromOriginal()
 {
-    m_file.dir().mkdir(ENHANCED_DIR);
+    QString key = enhancedKey(pristineFile());
+    if (key.isEmpty())
+        return false;
 
     // If called subsequently, the previously cached version is replaced.
-    remove(m_enhancedFile);
-    return copy(pristineFile(), m_enhancedFile);
+    return !PhotoCacheStore::insert(key, pristineFile().absoluteFilePath()).isEmpty();
 }
 
 /*!
@@ -146,15 +177,19 @@ bool PhotoCaches::cacheEnhancedFromOriginal()
  */
 bool PhotoCaches::overwriteFromCache(bool preferEnhanced)
 {
-    if (preferEnhanced && hasCachedEnhanced()) {
-        remove(m_file);
-        return copy(m_enhancedFile, m_file);
-    } else if (hasCachedOriginal()) {
-        remove(m_file);
-        return copy(m_originalFile, m_file);
-    } else {
-        return true;
-    }
+    // The versions are looked for on the disk, not to be told about one
+    // that is gone
+    QFileInfo enhanced = preferEnhanced ? enhancedFile() : QFileInfo();
+    if (!enhanced.filePath().isEmpty() &&
+            FileExistenceCache::confirm(enhanced.absoluteFilePath()))
+        return FileUtils::copyFile(enhanced.absoluteFilePath(), m_file.absoluteFilePath());
+
+    QFileInfo original = originalFile();
+    if (!original.filePath().isEmpty() &&
+            FileExistenceCache::confirm(original.absoluteFilePath()))
+        return FileUtils::copyFile(original.absoluteFilePath(), m_file.absoluteFilePath());
+
+    return true;
 }
 
 /*!
@@ -162,7 +197,8 @@ bool PhotoCaches::overwriteFromCache(bool preferEnhanced)
  */
 void PhotoCaches::discardCachedOriginal()
 {
-    remove(m_originalFile);
+    PhotoCacheStore::discardOriginal(m_file.absoluteFilePath());
+    removeLegacyFile(legacyFile(ORIGINAL_DIR));
 }
 
 /*!
@@ -170,7 +206,10 @@ void PhotoCaches::discardCachedOriginal()
  */
 void PhotoCaches::discardCachedEnhanced()
 {
-    remove(m_enhancedFile);
+    QString key = enhancedKey(pristineFile());
+    if (!key.isEmpty())
+        PhotoCacheStore::remove(key);
+    removeLegacyFile(legacyFile(ENHANCED_DIR));
 }
 
 /*!
@@ -178,6 +217,113 @@ void PhotoCaches::discardCachedEnhanced()
  */
 void PhotoCaches::discardAll()
 {
-    discardCachedOriginal();
+    // The enhanced is found through the original
     discardCachedEnhanced();
+    discardCachedOriginal();
+}
+
+/*!
+ * \brief PhotoCaches::migrate
+ * Moves the files kept in the hidden directories of a directory of photos
+ * to the store, and removes the directories once they are empty. This copies
+ * files, so it doesn't belong on the GUI thread.
+ * \param directory
+ */
+void PhotoCaches::migrate(const QString& directory)
+{
+    QDir dir(directory);
+    QString originalDir = dir.filePath(ORIGINAL_DIR);
+    QString enhancedDir = dir.filePath(ENHANCED_DIR);
+    if (!QFileInfo::exists(originalDir) && !QFileInfo::exists(enhancedDir))
+        return;
+
+    // Originals first, as the enhanced are keyed by them. A photo edited
+    // since keeps the original it has in the store.
+    QStringList originals = QDir(originalDir).entryList(QDir::Files | QDir::Hidden);
+    Q_FOREACH(const QString& name, originals) {
+        PhotoCaches caches(QFileInfo(dir, name));
+        QString legacy = caches.legacyFile(ORIGINAL_DIR);
+        if (!PhotoCacheStore::keepOriginal(caches.m_file.absoluteFilePath(), legacy).isEmpty())
+            removeLegacyFile(legacy);
+    }
+
+    QStringList enhanced = QDir(enhancedDir).entryList(QDir::Files | QDir::Hidden);
+    Q_FOREACH(const QString& name, enhanced) {
+        PhotoCaches caches(QFileInfo(dir, name));
+        QString legacy = caches.legacyFile(ENHANCED_DIR);
+        QString key = enhancedKey(caches.pristineFile());
+        if (key.isEmpty()) {
+            // Nothing is left to key the enhanced of a photo that is gone
+            // without its original
+            if (!FileExistenceCache::exists(caches.m_file.absoluteFilePath()))
+                removeLegacyFile(legacy);
+        } else if (!PhotoCacheStore::find(key).isEmpty() ||
+                   !PhotoCacheStore::insert(key, legacy).isEmpty()) {
+            removeLegacyFile(legacy);
+        }
+    }
+}
+
+/*!
+ * \brief PhotoCaches::migrateLater
+ * Migrates a directory of photos on the I/O thread, the first time it is
+ * asked to. The file operations started after it see the migrated files.
+ * \param directory
+ */
+void PhotoCaches::migrateLater(const QString& directory)
+{
+    QString path = QDir(directory).absolutePath();
+    {
+        Migrations* m = migrations();
+        QMutexLocker locker(&m->mutex);
+        if (m->started.contains(path))
+            return;
+        m->started.insert(path);
+    }
+
+    FileUtils::run([path]() -> QVariant {
+        migrate(path);
+        return QVariant(true);
+    });
+}
+
+/*!
+ * \brief PhotoCaches::enhancedKey
+ * \param file
+ * \return the key in the store of the file with auto-enhance applied to it
+ * as it is now, or an empty string if it can't be read
+ */
+QString PhotoCaches::enhancedKey(const QFileInfo& file)
+{
+    QString contentKey = PhotoCacheStore::contentKey(file.absoluteFilePath());
+    if (contentKey.isEmpty())
+        return QString();
+    return PhotoCacheStore::key(contentKey, ENHANCED_PARAMETERS);
+}
+
+/*!
+ * \brief PhotoCaches::enhancedVersion
+ * \param file
+ * \return the file with auto-enhance applied to it as it is now, if that
+ * was done ahead of time, or an empty string
+ */
+QString PhotoCaches::enhancedVersion(const QFileInfo& file)
+{
+    QString key = enhancedKey(file);
+    return key.isEmpty() ? QString() : PhotoCacheStore::find(key);
+}
+
+QString PhotoCaches::legacyFile(const QString& directory) const
+{
+    return QString("%1/%2/%3").arg(m_file.absolutePath()).arg(directory).arg(m_file.fileName());
+}
+
+void PhotoCaches::removeLegacyFile(const QString& legacy)
+{
+    if (!FileExistenceCache::exists(legacy) || !QFile::remove(legacy))
+        return;
+
+    // Only goes if it is empty
+    QDir().rmdir(QFileInfo(legacy).absolutePath());
+    FileExistenceCache::invalidate(legacy);
 }
@@ -20,7 +20,6 @@
 #ifndef GALLERY_PHOTO_CACHES_H_
 #define GALLERY_PHOTO_CACHES_H_
 
-#include <QFile>
 #include <QFileInfo>
 #include <QString>
 
@@ -31,22 +30,28 @@
  * file itself: the original, the pristine version of the file without any
  * applied edits; and the enhanced, a version of the original with auto-enhance
  * applied to it (necessary because of how slow auto-enhance is).
+ *
+ * The files are kept in the PhotoCacheStore. Those that were kept in hidden
+ * directories next to the photo have to be migrated to the store, a whole
+ * directory at a time: looking for the files never moves them.
+ * Whether files exist is told by the FileExistenceCache, so that asking
+ * again and again costs no trip to the disk.
  */
 class PhotoCaches
 {
 public:
     static const QString ORIGINAL_DIR;
     static const QString ENHANCED_DIR;
+    static const QString ENHANCED_PARAMETERS;
 
-    PhotoCaches(); // FIXME: remove this class and only deal with a stack of temporary rollback files
     PhotoCaches(const QFileInfo& file);
 
     bool hasCachedOriginal() const;
     bool hasCachedEnhanced() const;
 
-    const QFileInfo& originalFile() const;
-    const QFileInfo& enhancedFile() const;
-    const QFileInfo& pristineFile() const;
+    QFileInfo originalFile() const;
+    QFileInfo enhancedFile() const;
+    QFileInfo pristineFile() const;
 
     bool cacheOriginal();
     bool restoreOriginal();
@@ -57,20 +62,17 @@ public:
     void discardCachedEnhanced();
     void discardAll();
 
+    static void migrate(const QString& directory);
+    static void migrateLater(const QString& directory);
+
+    static QString enhancedKey(const QFileInfo& file);
+    static QString enhancedVersion(const QFileInfo& file);
+
 private:
-    static bool remove(const QFileInfo& file) {
-        return QFile::remove(file.filePath());
-    }
-    static bool rename(const QFileInfo& oldName, const QFileInfo& newName) {
-        return QFile::rename(oldName.filePath(), newName.filePath());
-    }
-    static bool copy(const QFileInfo& oldName, const QFileInfo& newName) {
-        return QFile::copy(oldName.filePath(), newName.filePath());
-    }
+    QString legacyFile(const QString& directory) const;
+    static void removeLegacyFile(const QString& legacy);
 
     QFileInfo m_file;
-    QFileInfo m_originalFile;
-    QFileInfo m_enhancedFile;
 };
 
 #endif
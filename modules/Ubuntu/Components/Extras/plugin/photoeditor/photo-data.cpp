@@ -23,36 +23,108 @@
  */
 
 #include "photo-data.h"
+#include "photo-caches.h"
 #include "photo-edit-command.h"
-#include "photo-edit-thread.h"
-
-// medialoader
-#include "photo-metadata.h"
+#include "photo-edit-history.h"
+#include "photo-edit-job.h"
+#include "photo-probe-cache.h"
+#include "working-image-cache.h"
 
 // util
 #include "imaging.h"
 
 #include <QApplication>
+#include <QBuffer>
 #include <QDebug>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QImage>
 #include <QImageReader>
 #include <QImageWriter>
+#include <QSet>
 #include <QStack>
 #include <QStandardPaths>
 
+#include <climits>
+
+namespace {
+// How often the progress of an edit gets looked at, which is as often as
+// it is worth redrawing a progress bar for
+const int PROGRESS_INTERVAL_MS = 100;
+
+const char* const STAGE_NAMES[PhotoEditProgress::STAGE_COUNT] = {
+    "", "decode", "analyse", "process", "encode", "metadata"
+};
+
+// Enough for QImageReader to tell apart the formats it knows of
+const qint64 HEADER_SIZE = 4096;
+
+struct Signature
+{
+    const char* format;
+    const char* bytes;
+    int length;
+};
+
+// The formats most photos come in, told apart without asking the plugins
+const Signature SIGNATURES[] = {
+    { "jpeg", "\xff\xd8\xff", 3 },
+    { "png", "\x89PNG\r\n\x1a\n", 8 },
+    { "tiff", "II*\0", 4 },
+    { "tiff", "MM\0*", 4 },
+    { "bmp", "BM", 2 },
+    { "gif", "GIF8", 4 }
+};
+
+/*
+ * The format of a file from its first bytes, in lower case, or an empty
+ * string if no image plugin knows it.
+ */
+QString sniffFormat(const QByteArray& header)
+{
+    for (unsigned int i = 0; i < sizeof(SIGNATURES) / sizeof(SIGNATURES[0]); i++) {
+        const Signature& signature = SIGNATURES[i];
+        if (header.startsWith(QByteArray::fromRawData(signature.bytes, signature.length)))
+            return signature.format;
+    }
+
+    QBuffer buffer;
+    buffer.setData(header);
+    buffer.open(QIODevice::ReadOnly);
+    QString format = QString(QImageReader::imageFormat(&buffer)).toLower();
+    if (format == "jpg")
+        format = "jpeg";
+    return format;
+}
+
+const QSet<QByteArray>& writableFormats()
+{
+    static const QSet<QByteArray> formats = QImageWriter::supportedImageFormats().toSet();
+    return formats;
+}
+} // namespace
+
 /*!
  * \brief Photo::isValid
+ * Tells the format from the first few kilobytes of the file, which rules out
+ * most files that aren't photos right away. The others still have to be
+ * readable by their image plugin, up to the size of the image, so that a file
+ * that only starts like a photo doesn't fail later when edited. Whether the
+ * metadata can be read is left for when the photo gets opened; photos
+ * without it are shown and edited all the same.
  * \param file
  * \return
  */
 bool PhotoData::isValid(const QFileInfo& file)
 {
-    QImageReader reader(file.filePath());
-    QByteArray format = reader.format();
+    QFile device(file.filePath());
+    if (!device.open(QIODevice::ReadOnly))
+        return false;
+
+    QString format = sniffFormat(device.read(HEADER_SIZE));
 
-    if (QString(format).toLower() == "tiff") {
+    if (format == "tiff") {
         // QImageReader.canRead() will detect some raw files as readable TIFFs,
         // though QImage will fail to load them.
         QString extension = file.suffix().toLower();
@@ -60,13 +132,22 @@ bool PhotoData::isValid(const QFileInfo& file)
             return false;
     }
 
-    PhotoMetadata* tmp = PhotoMetadata::fromFile(file);
-    if (tmp == NULL)
+    if (format.isEmpty() || !writableFormats().contains(format.toLatin1()))
         return false;
 
-    delete tmp;
-    return reader.canRead() &&
-            QImageWriter::supportedImageFormats().contains(reader.format());
+    device.seek(0);
+    QImageReader reader(&device, format.toLatin1());
+    return reader.canRead() && reader.size().isValid();
+}
+
+/*!
+ * \brief Photo::readFileFormat
+ * \param file
+ * \return the format of the file, in lower case, as QImageReader tells it
+ */
+QString PhotoData::readFileFormat(const QFileInfo& file)
+{
+    return PhotoProbeCache::probe(file).format;
 }
 
 /*!
@@ -75,10 +156,16 @@ bool PhotoData::isValid(const QFileInfo& file)
  */
 PhotoData::PhotoData()
     : QObject(),
-    m_editThread(0),
+    m_editJob(0),
     m_busy(false),
+    m_saving(false),
+    m_editingCount(0),
+    m_progress(0.0),
+    m_estimatedRemainingMs(-1),
     m_orientation(TOP_LEFT_ORIGIN)
 {
+    m_progressTimer.setInterval(PROGRESS_INTERVAL_MS);
+    connect(&m_progressTimer, SIGNAL(timeout()), this, SLOT(updateProgress()));
 }
 
 void PhotoData::setPath(QString path)
@@ -86,18 +173,19 @@ void PhotoData::setPath(QString path)
     if (QFileInfo(path).absoluteFilePath() != m_file.absoluteFilePath()) {
         QFileInfo newFile(path);
         if (newFile.exists() && newFile.isFile()) {
-            QByteArray format = QImageReader(newFile.absoluteFilePath()).format();
-            m_fileFormat = QString(format).toLower();
-            if (m_fileFormat == "jpg") // Why does Qt expose two different names here?
-                m_fileFormat = "jpeg";
+            // The pixels kept for the previous photo go with its session
+            if (!m_file.filePath().isEmpty())
+                WorkingImageCache::remove(m_file.absoluteFilePath());
+
+            PhotoProbe probe = PhotoProbeCache::probe(newFile);
+            m_fileFormat = probe.format;
 
             m_file = newFile;
+            PhotoCaches::migrateLater(m_file.absolutePath());
             Q_EMIT pathChanged();
 
             if (fileFormatHasMetadata()) {
-                PhotoMetadata* metadata = PhotoMetadata::fromFile(newFile.absoluteFilePath());
-                m_orientation = metadata->orientation();
-                delete metadata;
+                m_orientation = probe.orientation;
                 Q_EMIT orientationChanged();
             }
         }
@@ -116,13 +204,14 @@ QFileInfo PhotoData::file() const
 
 /*!
  * \brief Photo::~Photo
+ * Cancels the edit in progress, if any, rather than waiting for it.
  */
 PhotoData::~PhotoData()
 {
-    if (m_editThread) {
-        m_editThread->wait();
-        finishEditing();
-    }
+    if (m_editJob)
+        m_editJob->cancel();
+    if (!m_file.filePath().isEmpty())
+        WorkingImageCache::remove(m_file.absoluteFilePath());
 }
 
 /*!
@@ -131,20 +220,28 @@ PhotoData::~PhotoData()
  */
 Orientation PhotoData::orientation() const
 {  
+    if (editsHistory())
+        return m_history->orientation();
     return m_orientation;
 }
 
 void PhotoData::refreshFromDisk()
+{
+    readOrientation();
+    Q_EMIT dataChanged();
+}
+
+/*!
+ * \brief Photo::readOrientation
+ */
+void PhotoData::readOrientation()
 {
     if (fileFormatHasMetadata()) {
-        PhotoMetadata* metadata = PhotoMetadata::fromFile(m_file.absoluteFilePath());
-        qDebug() << "Refreshing orient." << m_orientation << "to" << metadata->orientation();
-        m_orientation = metadata->orientation();
-        delete metadata;
+        Orientation orientation = PhotoProbeCache::probe(m_file).orientation;
+        qDebug() << "Refreshing orient." << m_orientation << "to" << orientation;
+        m_orientation = orientation;
         Q_EMIT orientationChanged();
     }
-
-    Q_EMIT dataChanged();
 }
 
 /*!
@@ -152,16 +249,9 @@ void PhotoData::refreshFromDisk()
  */
 void PhotoData::rotateRight()
 {
-    Orientation current = fileFormatHasOrientation() ? orientation() :
-                                                       TOP_LEFT_ORIGIN;
-    Orientation rotated = OrientationCorrection::rotateOrientation(current,
-                                                                   false);
-    qDebug() << " Rotate from orientation " << current << "to" << rotated;
-
     PhotoEditCommand command;
     command.type = EDIT_ROTATE;
-    command.orientation = rotated;
-    asyncEdit(command);
+    asyncEdit(command, 1);
 }
 
 /*!
@@ -192,51 +282,237 @@ void PhotoData::exposureCompensation(qreal value)
  * Specify all coords in [0.0, 1.0], where 1.0 is the full size of the image.
  * They will be clamped to this range if you don't.
  * \param vrect the rectangle specifying the region to be cropped
+ * \param snapToBlocks lets the rectangle move a little so that JPEG files can
+ * be cropped without recompressing them
  */
-void PhotoData::crop(QVariant vrect)
+void PhotoData::crop(QVariant vrect, bool snapToBlocks)
 {
     PhotoEditCommand command;
     command.type = EDIT_CROP;
     command.crop_rectangle = vrect.toRectF();
+    command.snapCropToBlocks = snapToBlocks;
     asyncEdit(command);
 }
 
 /*!
  * \brief Photo::asyncEdit does edit the photo according to the given command
  * in a background thread.
+ * Edits requested while another one is running wait for it in a queue, where
+ * successive rotations add up to one, and so do successive exposure
+ * compensations.
  * \param The command defining the edit operation to perform.
+ * \param rightTurns for rotations, the number of turns to the right
  */
-void PhotoData::asyncEdit(const PhotoEditCommand& command)
+void PhotoData::asyncEdit(const PhotoEditCommand& command, int rightTurns)
 {
-    if (m_busy) {
-        qWarning() << "Can't start edit operation while another one is running.";
-        return;
+    QueuedEdit* last = m_queue.isEmpty() ? 0 : &m_queue.last();
+    if (last && last->command.type == EDIT_ROTATE && command.type == EDIT_ROTATE) {
+        last->rightTurns = (last->rightTurns + rightTurns) % 4;
+        if (last->rightTurns == 0)
+            m_queue.removeLast();
+    } else if (last && last->command.type == EDIT_COMPENSATE_EXPOSURE &&
+               command.type == EDIT_COMPENSATE_EXPOSURE &&
+               last->command.linearLightExposure == command.linearLightExposure) {
+        // Each one brightens the photo as the one before it left it
+        last->command.exposureCompensation += command.exposureCompensation;
+    } else {
+        QueuedEdit edit;
+        edit.command = command;
+        edit.rightTurns = rightTurns;
+        m_queue.append(edit);
     }
+    Q_EMIT pendingCountChanged();
+
+    if (m_busy)
+        return;
+
     m_busy = true;
     Q_EMIT busyChanged();
-    m_editThread = new PhotoEditThread(this, command);
-    connect(m_editThread, SIGNAL(finished()), this, SLOT(finishEditing()));
-    m_editThread->start();
+    startEditing();
+}
+
+/*!
+ * \brief Photo::startEditing starts a job that applies all the queued edits
+ * at once
+ */
+void PhotoData::startEditing()
+{
+    // Rotations turn from the orientation the previous edits leave the photo
+    // with; those that bake their result into the pixels leave it upright.
+    // The working image is always upright to begin with. In a session, the
+    // history knows where the earlier steps left the photo, whatever its
+    // format, since they only get applied together when it is saved.
+    Orientation current = TOP_LEFT_ORIGIN;
+    if (editsHistory() || fileFormatHasOrientation())
+        current = orientation();
+    Orientation upright = TOP_LEFT_ORIGIN;
+    QList<PhotoEditCommand> commands;
+    QList<PhotoEditCommand> workingCommands;
+    Q_FOREACH(const QueuedEdit& edit, m_queue) {
+        PhotoEditCommand command = edit.command;
+        PhotoEditCommand workingCommand = edit.command;
+        if (command.type == EDIT_ROTATE) {
+            Orientation rotated = current;
+            for (int i = 0; i < edit.rightTurns; i++) {
+                rotated = OrientationCorrection::rotateOrientation(rotated, false);
+                upright = OrientationCorrection::rotateOrientation(upright, false);
+            }
+            qDebug() << " Rotate from orientation " << current << "to" << rotated;
+            command.orientation = current = rotated;
+            workingCommand.orientation = upright;
+        } else {
+            current = upright = TOP_LEFT_ORIGIN;
+        }
+        commands.append(command);
+        workingCommands.append(workingCommand);
+    }
+    m_queue.clear();
+    m_editingCount = commands.count();
+    m_editCommands = commands;
+    m_editWorkingCommands = workingCommands;
+
+    m_editJob = new PhotoEditJob(this, commands);
+    if (editsHistory()) {
+        // The edit only gets saved with the others once the session is over
+        m_editJob->setWorkingImage(m_history->image(), workingCommands);
+        m_editJob->setSaving(false);
+
+        // Edits of the photo as the session found it may have been done
+        // ahead of time
+        if (m_history->level() == 0)
+            m_editJob->setWorkingFile(QFileInfo(m_history->base()));
+    } else {
+        m_editJob->setWorkingImage(WorkingImageCache::find(path()), workingCommands);
+    }
+    connect(m_editJob, SIGNAL(resultReady(QImage)), this, SLOT(showResult(QImage)));
+    connect(m_editJob, SIGNAL(finished()), this, SLOT(finishEditing()));
+    m_editJob->start();
+
+    resetProgress();
+    m_progressTimer.start();
+}
+
+/*!
+ * \brief Photo::showResult shows the edited photo while it gets saved
+ * \param image
+ */
+void PhotoData::showResult(const QImage& image)
+{
+    if (!m_editJob || sender() != m_editJob)
+        return;
+
+    // Without room to keep it, the result only shows once saved
+    if (!WorkingImageCache::insertUnsaved(path(), image))
+        return;
+
+    m_saving = true;
+    Q_EMIT savingChanged();
+    Q_EMIT resultReady();
+    Q_EMIT dataChanged();
 }
 
 /*!
- * \brief Photo::finishEditing do all the updates once the editing is done
+ * \brief Photo::finishEditing do all the updates once the editing is done,
+ * and starts on the edits that were queued meanwhile, if any
  */
 void PhotoData::finishEditing()
 {
-    if (!m_editThread || m_editThread->isRunning())
+    if (!m_editJob || sender() != m_editJob)
         return;
 
-    m_editThread->deleteLater();
-    m_editThread = 0;
-    m_busy = false;
+    QImage workingImage = m_editJob->workingImage();
+
+    // The job deletes itself
+    m_editJob = 0;
+    m_editingCount = 0;
+    m_progressTimer.stop();
+    resetProgress();
+
+    if (editsHistory()) {
+        // Which shows the result
+        if (!workingImage.isNull())
+            m_history->append(m_editCommands, m_editWorkingCommands, workingImage);
+    } else {
+        // Kept before anybody gets told the photo changed, so that it gets
+        // shown from memory
+        WorkingImageCache::insert(m_file, workingImage);
+
+        // What is on screen already is what got saved, unless saving failed
+        if (m_saving && !WorkingImageCache::find(path()).isNull())
+            readOrientation();
+        else
+            refreshFromDisk();
+    }
+    m_editCommands.clear();
+    m_editWorkingCommands.clear();
+
+    if (m_saving) {
+        m_saving = false;
+        Q_EMIT savingChanged();
+    }
 
-    refreshFromDisk();
+    if (!m_queue.isEmpty()) {
+        startEditing();
+        Q_EMIT pendingCountChanged();
+        return;
+    }
 
+    m_busy = false;
+    Q_EMIT pendingCountChanged();
     Q_EMIT busyChanged();
     Q_EMIT editFinished();
 }
 
+/*!
+ * \brief Photo::history
+ * \return
+ */
+PhotoEditHistory* PhotoData::history() const
+{
+    return m_history;
+}
+
+/*!
+ * \brief Photo::setHistory
+ * While the history has a session for the photo, edits only go to the
+ * history, and the photo shows as the history leaves it.
+ * \param history
+ */
+void PhotoData::setHistory(PhotoEditHistory* history)
+{
+    if (history == m_history)
+        return;
+
+    if (m_history)
+        disconnect(m_history, 0, this, 0);
+    m_history = history;
+    if (m_history)
+        connect(m_history, SIGNAL(levelChanged()), this, SLOT(showHistoryLevel()));
+    Q_EMIT historyChanged();
+}
+
+/*!
+ * \brief Photo::showHistoryLevel
+ */
+void PhotoData::showHistoryLevel()
+{
+    if (!editsHistory())
+        return;
+
+    Q_EMIT orientationChanged();
+    Q_EMIT dataChanged();
+}
+
+/*!
+ * \brief Photo::editsHistory
+ * \return true if the edits go to the history rather than to the file
+ */
+bool PhotoData::editsHistory() const
+{
+    return m_history && !m_history->path().isEmpty() &&
+            m_history->path() == path();
+}
+
 /*!
  * \brief Photo::fileFormat returns the file format as QString
  * \return
@@ -252,8 +528,17 @@ const QString &PhotoData::fileFormat() const
  */
 bool PhotoData::fileFormatHasMetadata() const
 {
-    return (m_fileFormat == "jpeg" || m_fileFormat == "tiff" ||
-            m_fileFormat == "png");
+    return formatHasMetadata(m_fileFormat);
+}
+
+/*!
+ * \brief Photo::formatHasMetadata
+ * \param format
+ * \return
+ */
+bool PhotoData::formatHasMetadata(const QString& format)
+{
+    return (format == "jpeg" || format == "tiff" || format == "png");
 }
 
 /*!
@@ -262,7 +547,17 @@ bool PhotoData::fileFormatHasMetadata() const
  */
 bool PhotoData::fileFormatHasOrientation() const
 {
-    return (m_fileFormat == "jpeg");
+    return formatHasOrientation(m_fileFormat);
+}
+
+/*!
+ * \brief Photo::formatHasOrientation
+ * \param format
+ * \return
+ */
+bool PhotoData::formatHasOrientation(const QString& format)
+{
+    return (format == "jpeg");
 }
 
 /*!
@@ -273,3 +568,86 @@ bool PhotoData::busy() const
 {
     return m_busy;
 }
+
+/*!
+ * \brief Photo::pendingCount
+ * \return the number of edits that haven't been saved yet, including those in
+ * progress, once queued edits have been merged
+ */
+int PhotoData::pendingCount() const
+{
+    return m_editingCount + m_queue.count();
+}
+
+/*!
+ * \brief Photo::progress
+ * \return how much of the edit in progress is done, from 0.0 to 1.0; edits
+ * still queued behind it aren't accounted for
+ */
+qreal PhotoData::progress() const
+{
+    return m_progress;
+}
+
+/*!
+ * \brief Photo::stage
+ * \return what the edit in progress is doing: "decode", "analyse",
+ * "process", "encode" or "metadata", or an empty string if nothing
+ */
+QString PhotoData::stage() const
+{
+    return m_stage;
+}
+
+/*!
+ * \brief Photo::estimatedRemainingMs
+ * \return the time the edit in progress is expected to take still, from the
+ * rate it has been going at, or -1 if it isn't known
+ */
+int PhotoData::estimatedRemainingMs() const
+{
+    return m_estimatedRemainingMs;
+}
+
+/*!
+ * \brief Photo::updateProgress samples the progress of the edit job, which
+ * the kernels update far more often than it would be worth notifying
+ */
+void PhotoData::updateProgress()
+{
+    if (!m_editJob)
+        return;
+
+    const PhotoEditProgress& progress = m_editJob->progress();
+    qreal value = progress.progress();
+    QString stage = STAGE_NAMES[progress.stage()];
+    int remaining = (int) qMin(progress.estimatedRemainingMs(), (qint64) INT_MAX);
+
+    if (value == m_progress && stage == m_stage && remaining == m_estimatedRemainingMs)
+        return;
+
+    m_progress = value;
+    m_stage = stage;
+    m_estimatedRemainingMs = remaining;
+    Q_EMIT progressChanged();
+}
+
+/*!
+ * \brief Photo::resetProgress
+ */
+void PhotoData::resetProgress()
+{
+    m_progress = 0.0;
+    m_stage = QString();
+    m_estimatedRemainingMs = -1;
+    Q_EMIT progressChanged();
+}
+
+/*!
+ * \brief Photo::saving
+ * \return true while the result of an edit is shown but not saved yet
+ */
+bool PhotoData::saving() const
+{
+    return m_saving;
+}
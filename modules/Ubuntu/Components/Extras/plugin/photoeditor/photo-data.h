@@ -23,15 +23,21 @@
 #ifndef PHOTO_DATA_H_
 #define PHOTO_DATA_H_
 
+#include "photo-edit-command.h"
+
 // util
 #include "orientation.h"
 
 // QT
 #include <QFileInfo>
+#include <QImage>
+#include <QList>
+#include <QPointer>
+#include <QTimer>
 #include <QVariant>
 
-class PhotoEditCommand;
-class PhotoEditThread;
+class PhotoEditHistory;
+class PhotoEditJob;
 
 /*!
  * \brief The Photo class
@@ -43,17 +49,33 @@ class PhotoData : public QObject
     Q_PROPERTY(QString path READ path WRITE setPath NOTIFY pathChanged)
     Q_PROPERTY(int orientation READ orientation NOTIFY orientationChanged)
     Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(bool saving READ saving NOTIFY savingChanged)
+    Q_PROPERTY(int pendingCount READ pendingCount NOTIFY pendingCountChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(QString stage READ stage NOTIFY progressChanged)
+    Q_PROPERTY(int estimatedRemainingMs READ estimatedRemainingMs NOTIFY progressChanged)
+    Q_PROPERTY(PhotoEditHistory* history READ history WRITE setHistory NOTIFY historyChanged)
 
 public:
     explicit PhotoData();
     virtual ~PhotoData();
 
     static bool isValid(const QFileInfo& file);
+    static QString readFileFormat(const QFileInfo& file);
+    static bool formatHasMetadata(const QString& format);
+    static bool formatHasOrientation(const QString& format);
 
     QString path() const;
     void setPath(QString path);
     QFileInfo file() const;
     bool busy() const;
+    bool saving() const;
+    int pendingCount() const;
+    qreal progress() const;
+    QString stage() const;
+    int estimatedRemainingMs() const;
+    PhotoEditHistory* history() const;
+    void setHistory(PhotoEditHistory* history);
 
     virtual Orientation orientation() const;
 
@@ -61,7 +83,7 @@ public:
     Q_INVOKABLE void rotateRight();
     Q_INVOKABLE void autoEnhance();
     Q_INVOKABLE void exposureCompensation(qreal value);
-    Q_INVOKABLE void crop(QVariant vrect);
+    Q_INVOKABLE void crop(QVariant vrect, bool snapToBlocks = false);
 
     const QString &fileFormat() const;
     bool fileFormatHasMetadata() const;
@@ -71,20 +93,53 @@ Q_SIGNALS:
     void pathChanged();
     void orientationChanged();
     void busyChanged();
+    void savingChanged();
+    void pendingCountChanged();
+    void progressChanged();
+    void historyChanged();
 
+    void resultReady();
     void editFinished();
     void dataChanged();
 
 private Q_SLOTS:
+    void showResult(const QImage& image);
     void finishEditing();
+    void updateProgress();
+    void showHistoryLevel();
 
 private:
-    void asyncEdit(const PhotoEditCommand& state);
+    /*
+     * An edit waiting for the one in progress to finish. Rotations are kept
+     * as a number of right turns until they start, as the orientation they
+     * turn from isn't known before then.
+     */
+    struct QueuedEdit
+    {
+        PhotoEditCommand command;
+        int rightTurns;
+    };
+
+    void asyncEdit(const PhotoEditCommand& command, int rightTurns = 0);
+    void startEditing();
+    void resetProgress();
+    void readOrientation();
+    bool editsHistory() const;
 
     QString m_fileFormat;
-    PhotoEditThread *m_editThread;
+    PhotoEditJob *m_editJob;
     QFileInfo m_file;
     bool m_busy;
+    bool m_saving;
+    QList<QueuedEdit> m_queue;
+    QPointer<PhotoEditHistory> m_history;
+    QList<PhotoEditCommand> m_editCommands;
+    QList<PhotoEditCommand> m_editWorkingCommands;
+    int m_editingCount;
+    QTimer m_progressTimer;
+    qreal m_progress;
+    QString m_stage;
+    int m_estimatedRemainingMs;
 
     Orientation m_orientation;
 };
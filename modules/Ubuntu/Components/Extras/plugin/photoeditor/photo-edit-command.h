@@ -42,7 +42,13 @@ public:
     EditType type;
     Orientation orientation;
     QRectF crop_rectangle;
+    /// Lets the crop move by a few pixels, so that it lines up with the
+    /// compressed blocks and JPEG files can be edited losslessly
+    bool snapCropToBlocks;
     qreal exposureCompensation;
+    /// Scales the light in stops of exposureCompensation, rather than adding
+    /// it to the channel values
+    bool linearLightExposure;
     /// The color balance parameters are stored here in the order:
     /// brightness (x), contrast(y), saturation(z), hue(w)
     QVector4D colorBalance_;
@@ -51,7 +57,9 @@ public:
         type(EDIT_NONE),
         orientation(ORIGINAL_ORIENTATION),
         crop_rectangle(),
-        exposureCompensation(0.0) {
+        snapCropToBlocks(false),
+        exposureCompensation(0.0),
+        linearLightExposure(false) {
     }
 };
 
@@ -0,0 +1,703 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-edit-history.h"
+#include "file-utils.h"
+#include "photo-data.h"
+#include "photo-edit-job.h"
+#include "photo-edit-pipeline.h"
+#include "photo-probe-cache.h"
+
+#include <QDebug>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QImageReader>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QTemporaryFile>
+#include <QThreadPool>
+
+// The long side of the proxies; enough for a full screen view
+const int PhotoEditHistory::PROXY_SIZE = 2048;
+// A few levels either side of the current one, at about 16MB each at most
+const int PhotoEditHistory::MAX_PROXIES = 4;
+
+namespace {
+struct Previews
+{
+    QMutex mutex;
+    // The current proxy of each photo being edited, by path
+    QHash<QString, QImage> images;
+    // How many saves of each photo are still to write it; its proxy stays
+    // until they all have
+    QHash<QString, int> saving;
+};
+
+Previews* previews()
+{
+    static Previews instance;
+    return &instance;
+}
+
+QImage decodeProxy(const QFileInfo& file)
+{
+    QImageReader reader(file.absoluteFilePath());
+    reader.setAutoTransform(true);
+    QSize size = reader.size();
+    if (size.isValid() && (size.width() > PhotoEditHistory::PROXY_SIZE ||
+                           size.height() > PhotoEditHistory::PROXY_SIZE)) {
+        size.scale(PhotoEditHistory::PROXY_SIZE, PhotoEditHistory::PROXY_SIZE,
+                   Qt::KeepAspectRatio);
+        reader.setScaledSize(size);
+    }
+    return reader.read();
+}
+
+/*
+ * Decodes the base of a session, once the saves of the photo still going on
+ * have written it, so that it doesn't get read half written.
+ */
+class LoadTask : public QRunnable
+{
+public:
+    LoadTask(const QString& file, const QList<QFuture<QVariant> >& saves)
+        : m_file(file),
+          m_saves(saves)
+    {
+        m_result.reportStarted();
+    }
+
+    QFuture<PhotoEditHistory::Base> future()
+    {
+        return m_result.future();
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        Q_FOREACH(QFuture<QVariant> save, m_saves)
+            save.waitForFinished();
+
+        PhotoEditHistory::Base base;
+        base.file = QFileInfo(m_file);
+        base.proxy = decodeProxy(base.file);
+        if (!base.proxy.isNull()) {
+            base.format = PhotoData::readFileFormat(base.file);
+            if (PhotoData::formatHasOrientation(base.format))
+                base.orientation = PhotoProbeCache::probe(base.file).orientation;
+        }
+
+        m_result.reportResult(base);
+        m_result.reportFinished();
+    }
+
+private:
+    QString m_file;
+    QList<QFuture<QVariant> > m_saves;
+    QFutureInterface<PhotoEditHistory::Base> m_result;
+};
+
+bool saveEdits(const QString& path, const QString& base, const QString& format,
+               Orientation orientation, const QList<PhotoEditCommand>& edits)
+{
+    QFileInfo file(path);
+    if (base == file.absoluteFilePath()) {
+        // The job replaces the photo only once the edits are all written
+        if (edits.isEmpty())
+            return true;
+        PhotoEditJob job(file, format, orientation, edits);
+        return job.edit();
+    }
+
+    // Starting over from another file, the edits are made on a copy of it
+    // next to the photo, which then takes the place of the photo in one go
+    QTemporaryFile replacement(PhotoEditJob::replacementTemplate(file));
+    if (!replacement.open()) {
+        qWarning() << "Error restoring" << path << "from" << base;
+        return false;
+    }
+    replacement.close();
+    if (!FileUtils::snapshotFile(base, replacement.fileName())) {
+        qWarning() << "Error restoring" << path << "from" << base;
+        return false;
+    }
+
+    if (!edits.isEmpty()) {
+        PhotoEditJob job(QFileInfo(replacement.fileName()), format, orientation, edits);
+        if (!job.edit())
+            return false;
+    }
+    return PhotoEditJob::commitReplacement(replacement, file);
+}
+} // namespace
+
+/*!
+ * \brief PhotoEditHistory::PhotoEditHistory
+ * \param parent
+ */
+PhotoEditHistory::PhotoEditHistory(QObject* parent)
+    : QObject(parent),
+      m_baseOrientation(TOP_LEFT_ORIGIN),
+      m_level(0),
+      m_loader(0),
+      m_starting(false)
+{
+}
+
+/*!
+ * \brief PhotoEditHistory::~PhotoEditHistory
+ * Ends the session without saving it, and waits for the saves still going on
+ * in the background.
+ */
+PhotoEditHistory::~PhotoEditHistory()
+{
+    end();
+
+    QHash<QFutureWatcher<QVariant>*, QString>::const_iterator i;
+    for (i = m_saves.constBegin(); i != m_saves.constEnd(); ++i) {
+        i.key()->waitForFinished();
+        releasePreview(i.value());
+    }
+}
+
+/*!
+ * \brief PhotoEditHistory::find
+ * \param path
+ * \return the photo as the edits of its session leave it, or a null image if
+ * it is not being edited
+ */
+QImage PhotoEditHistory::find(const QString& path)
+{
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+
+    QMutexLocker locker(&previews()->mutex);
+    return previews()->images.value(absolutePath);
+}
+
+/*!
+ * \brief PhotoEditHistory::path
+ * \return the photo being edited, or an empty string out of a session
+ */
+QString PhotoEditHistory::path() const
+{
+    return m_path;
+}
+
+/*!
+ * \brief PhotoEditHistory::base
+ * \return the file the edits apply to, which is the photo unless the
+ * history was rebased
+ */
+QString PhotoEditHistory::base() const
+{
+    return m_base.absoluteFilePath();
+}
+
+/*!
+ * \brief PhotoEditHistory::level
+ * \return how many of the edits apply, from 0 for none of them
+ */
+int PhotoEditHistory::level() const
+{
+    return m_level;
+}
+
+/*!
+ * \brief PhotoEditHistory::count
+ * \return the number of levels, including the one without edits
+ */
+int PhotoEditHistory::count() const
+{
+    return m_steps.count() + 1;
+}
+
+/*!
+ * \brief PhotoEditHistory::canUndo
+ * \return
+ */
+bool PhotoEditHistory::canUndo() const
+{
+    return m_level > 0;
+}
+
+/*!
+ * \brief PhotoEditHistory::canRedo
+ * \return
+ */
+bool PhotoEditHistory::canRedo() const
+{
+    return m_level < m_steps.count();
+}
+
+/*!
+ * \brief PhotoEditHistory::saving
+ * \return whether some of the sessions saved with saveAsync() aren't written
+ * yet
+ */
+bool PhotoEditHistory::saving() const
+{
+    return !m_saves.isEmpty();
+}
+
+/*!
+ * \brief PhotoEditHistory::loading
+ * \return whether the file the session edits is still being decoded, in
+ * which case the session can't be edited yet
+ */
+bool PhotoEditHistory::loading() const
+{
+    return m_loader != 0;
+}
+
+/*!
+ * \brief PhotoEditHistory::orientation
+ * \return the orientation the photo would be saved with at the current level
+ */
+Orientation PhotoEditHistory::orientation() const
+{
+    return m_level > 0 ? m_steps.at(m_level - 1).orientation : m_baseOrientation;
+}
+
+/*!
+ * \brief PhotoEditHistory::image
+ * \return the proxy of the current level, upright
+ */
+QImage PhotoEditHistory::image() const
+{
+    return m_image;
+}
+
+/*!
+ * \brief PhotoEditHistory::commands
+ * \return all the edits of the current level, to be applied to the file the
+ * session started from
+ */
+QList<PhotoEditCommand> PhotoEditHistory::commands() const
+{
+    QList<PhotoEditCommand> commands;
+    for (int i = 0; i < m_level; i++)
+        commands.append(m_steps.at(i).commands);
+    return commands;
+}
+
+/*!
+ * \brief PhotoEditHistory::append
+ * Adds an edit after the current level, dropping the ones that were undone.
+ * \param commands the edit, as applied to the file at the current level
+ * \param workingCommands the same edit, as applied to its proxy
+ * \param image the proxy with the edit applied
+ */
+void PhotoEditHistory::append(const QList<PhotoEditCommand>& commands,
+                              const QList<PhotoEditCommand>& workingCommands,
+                              const QImage& image)
+{
+    if (m_path.isEmpty() || loading() || commands.isEmpty())
+        return;
+
+    while (m_steps.count() > m_level) {
+        m_proxies.remove(m_steps.count());
+        m_recentLevels.removeAll(m_steps.count());
+        m_steps.removeLast();
+    }
+
+    // Rotations leave the orientation they turn to; all the rest bake it
+    // into the pixels
+    Step step;
+    step.commands = commands;
+    step.workingCommands = workingCommands;
+    step.orientation = orientation();
+    Q_FOREACH(const PhotoEditCommand& command, commands)
+        step.orientation = command.type == EDIT_ROTATE ? command.orientation :
+                                                         TOP_LEFT_ORIGIN;
+    m_steps.append(step);
+
+    m_level = m_steps.count();
+    m_image = image.isNull() ? render(m_level) : image;
+    keepProxy(m_level, m_image);
+    publish();
+
+    Q_EMIT countChanged();
+    Q_EMIT levelChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::start
+ * Starts a session without edits, once the photo is decoded in the
+ * background; ready() tells whether it could be.
+ * \param path the photo, which is left alone until the session is saved
+ * \return false without a photo
+ */
+bool PhotoEditHistory::start(const QString& path)
+{
+    end();
+    if (path.isEmpty())
+        return false;
+
+    m_path = QFileInfo(path).absoluteFilePath();
+    m_starting = true;
+    load(m_path);
+
+    Q_EMIT pathChanged();
+    return true;
+}
+
+/*!
+ * \brief PhotoEditHistory::rebase
+ * Starts the session over from another version of the photo, like a
+ * pristine copy of it, dropping all the edits. Nothing changes until the
+ * file is decoded in the background, or at all if it can't be; ready()
+ * tells which.
+ * \param file the version the photo will be saved from
+ * \return false out of a session
+ */
+bool PhotoEditHistory::rebase(const QString& file)
+{
+    if (m_path.isEmpty())
+        return false;
+
+    load(file);
+    return true;
+}
+
+/*!
+ * \brief PhotoEditHistory::end
+ * Drops the session, without saving it.
+ */
+void PhotoEditHistory::end()
+{
+    cancelLoading();
+    if (m_path.isEmpty())
+        return;
+
+    {
+        QMutexLocker locker(&previews()->mutex);
+        if (!previews()->saving.contains(m_path))
+            previews()->images.remove(m_path);
+    }
+
+    m_path.clear();
+    m_base = QFileInfo();
+    m_steps.clear();
+    m_proxies.clear();
+    m_recentLevels.clear();
+    m_level = 0;
+    m_image = QImage();
+
+    Q_EMIT pathChanged();
+    Q_EMIT countChanged();
+    Q_EMIT levelChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::undo
+ */
+void PhotoEditHistory::undo()
+{
+    setLevel(m_level - 1);
+}
+
+/*!
+ * \brief PhotoEditHistory::redo
+ */
+void PhotoEditHistory::redo()
+{
+    setLevel(m_level + 1);
+}
+
+/*!
+ * \brief PhotoEditHistory::setLevel
+ * \param level
+ */
+void PhotoEditHistory::setLevel(int level)
+{
+    if (m_path.isEmpty() || loading() || level < 0 || level > m_steps.count() ||
+            level == m_level)
+        return;
+
+    m_level = level;
+    m_image = render(level);
+    publish();
+    Q_EMIT levelChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::clear
+ * Drops all the edits, the photo staying as the session started from it.
+ */
+void PhotoEditHistory::clear()
+{
+    if (m_path.isEmpty() || loading())
+        return;
+
+    m_steps.clear();
+    m_recentLevels.clear();
+    QImage proxy = m_proxies.value(0);
+    m_proxies.clear();
+    m_proxies.insert(0, proxy);
+    m_level = 0;
+    m_image = proxy;
+    publish();
+
+    Q_EMIT countChanged();
+    Q_EMIT levelChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::save
+ * Applies all the edits of the current level to the photo, at once, from
+ * the version the session started from. A session still loading waits for
+ * it first.
+ * \return false if the photo couldn't be saved
+ */
+bool PhotoEditHistory::save()
+{
+    if (m_path.isEmpty() || !completeLoading())
+        return false;
+
+    return saveEdits(m_path, m_base.absoluteFilePath(), m_baseFormat, m_baseOrientation,
+                     commands());
+}
+
+/*!
+ * \brief PhotoEditHistory::saveAsync
+ * Saves the session as save() does, but on the I/O thread of FileUtils,
+ * after the file operations started before. The session can be ended right
+ * away; saved() gets emitted once the photo is written.
+ * \return false out of a session
+ */
+bool PhotoEditHistory::saveAsync()
+{
+    if (m_path.isEmpty() || !completeLoading())
+        return false;
+
+    QString path = m_path;
+    QString base = m_base.absoluteFilePath();
+    QString format = m_baseFormat;
+    Orientation orientation = m_baseOrientation;
+    QList<PhotoEditCommand> edits = commands();
+
+    {
+        QMutexLocker locker(&previews()->mutex);
+        previews()->saving[path]++;
+    }
+
+    bool wasSaving = saving();
+    QFutureWatcher<QVariant>* watcher = new QFutureWatcher<QVariant>(this);
+    m_saves.insert(watcher, path);
+    connect(watcher, SIGNAL(finished()), this, SLOT(finishSave()));
+    watcher->setFuture(FileUtils::run([path, base, format, orientation, edits]() {
+        return QVariant(saveEdits(path, base, format, orientation, edits));
+    }));
+
+    if (!wasSaving)
+        Q_EMIT savingChanged();
+    return true;
+}
+
+void PhotoEditHistory::finishLoading()
+{
+    if (sender() == m_loader)
+        completeLoading();
+}
+
+void PhotoEditHistory::finishSave()
+{
+    QFutureWatcher<QVariant>* watcher = static_cast<QFutureWatcher<QVariant>*>(sender());
+    if (!m_saves.contains(watcher))
+        return;
+
+    QString path = m_saves.take(watcher);
+    bool success = watcher->result().toBool();
+    watcher->deleteLater();
+    releasePreview(path);
+
+    Q_EMIT saved(path, success);
+    if (!saving())
+        Q_EMIT savingChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::render
+ * \param level
+ * \return the proxy of the level, rendered from the nearest one kept before
+ * it if it isn't kept itself
+ */
+QImage PhotoEditHistory::render(int level)
+{
+    QMap<int, QImage>::const_iterator nearest = m_proxies.upperBound(level);
+    if (nearest == m_proxies.constBegin())
+        return QImage();
+    --nearest;
+
+    // Each step turns from the proxy the step before it leaves, so they
+    // don't make a single pipeline
+    QImage image = nearest.value();
+    for (int i = nearest.key(); i < level && !image.isNull(); i++) {
+        PhotoEditPipeline pipeline;
+        pipeline.append(m_steps.at(i).workingCommands);
+        pipeline.setPreview(true);
+        image = pipeline.apply(image);
+    }
+
+    keepProxy(level, image);
+    return image;
+}
+
+/*!
+ * \brief PhotoEditHistory::keepProxy
+ * Keeps the proxy of a level, dropping the least recently used one if that
+ * makes too many.
+ * \param level
+ * \param image
+ */
+void PhotoEditHistory::keepProxy(int level, const QImage& image)
+{
+    if (image.isNull())
+        return;
+
+    m_proxies.insert(level, image);
+    if (level == 0)
+        return;
+
+    m_recentLevels.removeAll(level);
+    m_recentLevels.prepend(level);
+    while (m_recentLevels.count() > MAX_PROXIES)
+        m_proxies.remove(m_recentLevels.takeLast());
+}
+
+/*!
+ * \brief PhotoEditHistory::publish
+ * Shows the current proxy for the photo, to PhotoImageProvider
+ */
+void PhotoEditHistory::publish()
+{
+    QMutexLocker locker(&previews()->mutex);
+    previews()->images.insert(m_path, m_image);
+}
+
+/*!
+ * \brief PhotoEditHistory::load
+ * Decodes a file to base the session on, on the global thread pool, after
+ * the saves of the photo this history started.
+ * \param file
+ */
+void PhotoEditHistory::load(const QString& file)
+{
+    bool wasLoading = loading();
+    if (m_loader) {
+        m_loader->disconnect(this);
+        m_loader->deleteLater();
+    }
+
+    QList<QFuture<QVariant> > saves;
+    QHash<QFutureWatcher<QVariant>*, QString>::const_iterator i;
+    for (i = m_saves.constBegin(); i != m_saves.constEnd(); ++i) {
+        if (i.value() == m_path)
+            saves.append(i.key()->future());
+    }
+
+    LoadTask* task = new LoadTask(file, saves);
+    m_loader = new QFutureWatcher<Base>(this);
+    connect(m_loader, SIGNAL(finished()), this, SLOT(finishLoading()));
+    m_loader->setFuture(task->future());
+    QThreadPool::globalInstance()->start(task);
+
+    if (!wasLoading)
+        Q_EMIT loadingChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::completeLoading
+ * Bases the session on the file being decoded, waiting for it if need be.
+ * A session that can't start ends.
+ * \return false if the file couldn't be decoded
+ */
+bool PhotoEditHistory::completeLoading()
+{
+    if (!m_loader)
+        return true;
+
+    m_loader->waitForFinished();
+    Base base = m_loader->result();
+    m_loader->disconnect(this);
+    m_loader->deleteLater();
+    m_loader = 0;
+    bool starting = m_starting;
+    m_starting = false;
+    Q_EMIT loadingChanged();
+
+    if (base.proxy.isNull()) {
+        qWarning() << "Error loading" << base.file.filePath() << "for editing";
+        if (starting) {
+            m_path.clear();
+            Q_EMIT pathChanged();
+        }
+        Q_EMIT ready(false);
+        return false;
+    }
+
+    m_base = base.file;
+    m_baseFormat = base.format;
+    m_baseOrientation = base.orientation;
+    m_steps.clear();
+    m_proxies.clear();
+    m_recentLevels.clear();
+    m_level = 0;
+    m_image = base.proxy;
+    keepProxy(0, base.proxy);
+    publish();
+
+    Q_EMIT countChanged();
+    Q_EMIT levelChanged();
+    Q_EMIT ready(true);
+    return true;
+}
+
+/*!
+ * \brief PhotoEditHistory::cancelLoading
+ * Drops the file being decoded, if any.
+ */
+void PhotoEditHistory::cancelLoading()
+{
+    if (!m_loader)
+        return;
+
+    m_loader->disconnect(this);
+    m_loader->deleteLater();
+    m_loader = 0;
+    m_starting = false;
+    Q_EMIT loadingChanged();
+}
+
+/*!
+ * \brief PhotoEditHistory::releasePreview
+ * Stops showing the proxy of a save once the photo is written, unless the
+ * photo is being edited again.
+ * \param path
+ */
+void PhotoEditHistory::releasePreview(const QString& path)
+{
+    QMutexLocker locker(&previews()->mutex);
+    int& count = previews()->saving[path];
+    if (--count > 0)
+        return;
+
+    previews()->saving.remove(path);
+    if (path != m_path)
+        previews()->images.remove(path);
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_EDIT_HISTORY_H_
+#define GALLERY_PHOTO_EDIT_HISTORY_H_
+
+#include "photo-edit-command.h"
+
+// util
+#include "orientation.h"
+
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QVariant>
+
+template <typename T> class QFuture;
+template <typename T> class QFutureWatcher;
+
+/*!
+ * \brief The PhotoEditHistory class
+ *
+ * The edits of an editing session, which only get applied to the photo when
+ * it is saved, in a single pass. Meanwhile they are shown on proxies of the
+ * photo, about the size of a screen, which are kept for the most recently
+ * visited levels of the history; undo and redo render the others from the
+ * nearest proxy kept before them.
+ *
+ * The photo is decoded in the background when a session starts, or starts
+ * over from another file; ready() tells when the session can be edited.
+ *
+ * A session can also be saved in the background, on the I/O thread of
+ * FileUtils, in which case its proxy is still shown for the photo until the
+ * photo is written, even once the session has ended.
+ */
+class PhotoEditHistory : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString path READ path NOTIFY pathChanged)
+    Q_PROPERTY(int level READ level NOTIFY levelChanged)
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(bool canUndo READ canUndo NOTIFY levelChanged)
+    Q_PROPERTY(bool canRedo READ canRedo NOTIFY levelChanged)
+    Q_PROPERTY(bool saving READ saving NOTIFY savingChanged)
+    Q_PROPERTY(bool loading READ loading NOTIFY loadingChanged)
+
+public:
+    static const int PROXY_SIZE;
+    static const int MAX_PROXIES;
+
+    // The file a session applies its edits to, as decoded in the background
+    struct Base
+    {
+        Base() : orientation(TOP_LEFT_ORIGIN) { }
+
+        QFileInfo file;
+        QString format;
+        Orientation orientation;
+        QImage proxy;
+    };
+
+    explicit PhotoEditHistory(QObject* parent = 0);
+    virtual ~PhotoEditHistory();
+
+    static QImage find(const QString& path);
+
+    QString path() const;
+    QString base() const;
+    int level() const;
+    int count() const;
+    bool canUndo() const;
+    bool canRedo() const;
+    bool saving() const;
+    bool loading() const;
+
+    Orientation orientation() const;
+    QImage image() const;
+    QList<PhotoEditCommand> commands() const;
+
+    void append(const QList<PhotoEditCommand>& commands,
+                const QList<PhotoEditCommand>& workingCommands, const QImage& image);
+
+    Q_INVOKABLE bool start(const QString& path);
+    Q_INVOKABLE bool rebase(const QString& file);
+    Q_INVOKABLE void end();
+
+    Q_INVOKABLE void undo();
+    Q_INVOKABLE void redo();
+    Q_INVOKABLE void setLevel(int level);
+    Q_INVOKABLE void clear();
+
+    Q_INVOKABLE bool save();
+    Q_INVOKABLE bool saveAsync();
+
+Q_SIGNALS:
+    void pathChanged();
+    void levelChanged();
+    void countChanged();
+    void savingChanged();
+    void loadingChanged();
+
+    void ready(bool success);
+    void saved(const QString& path, bool success);
+
+private Q_SLOTS:
+    void finishSave();
+    void finishLoading();
+
+private:
+    struct Step
+    {
+        QList<PhotoEditCommand> commands;
+        QList<PhotoEditCommand> workingCommands;
+        // The orientation of the file once the step is applied
+        Orientation orientation;
+    };
+
+    QImage render(int level);
+    void keepProxy(int level, const QImage& image);
+    void publish();
+    void load(const QString& file);
+    bool completeLoading();
+    void cancelLoading();
+    void releasePreview(const QString& path);
+
+    QString m_path;
+    QFileInfo m_base;
+    QString m_baseFormat;
+    Orientation m_baseOrientation;
+    QList<Step> m_steps;
+    int m_level;
+    QImage m_image;
+    // By level; the one of level 0 is always kept
+    QMap<int, QImage> m_proxies;
+    // The levels of the other proxies, most recently used first
+    QList<int> m_recentLevels;
+    // The photos being saved in the background, by the watcher of each save
+    QHash<QFutureWatcher<QVariant>*, QString> m_saves;
+    // The base being decoded, if any, and whether the session waits for it
+    // to start
+    QFutureWatcher<Base>* m_loader;
+    bool m_starting;
+};
+
+#endif // GALLERY_PHOTO_EDIT_HISTORY_H_
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2013-2014 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-edit-job.h"
+#include "file-utils.h"
+#include "photo-data.h"
+#include "photo-edit-pipeline.h"
+#include "jpeg-lossless-editor.h"
+#include "jpeg-strip-editor.h"
+
+// medialoader
+#include "photo-metadata.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QImageReader>
+#include <QTemporaryFile>
+#include <QThreadPool>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Larger JPEGs are edited a strip at a time rather than decoded at once, to
+// keep memory use bounded on devices with little of it.
+const qint64 STRIP_EDITING_MIN_PIXELS = 16 * 1000 * 1000;
+
+// Edits are mostly waiting on the disk, and each of them already spreads its
+// pixel work over BandExecutor, so a couple of them at once is plenty.
+const int MAX_EDIT_THREADS = 2;
+
+class EditPool : public QThreadPool
+{
+public:
+    EditPool() { setMaxThreadCount(MAX_EDIT_THREADS); }
+};
+
+QThreadPool* editPool()
+{
+    static EditPool pool;
+    return &pool;
+}
+
+bool syncToDisk(const QString& path)
+{
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+} // namespace
+
+/*!
+ * \brief PhotoEditJob::PhotoEditJob
+ * Applies all the commands, in order, with a single load and save of the
+ * image. Everything the job needs to know about the photo is taken now, so
+ * that the photo can go away while the job runs.
+ */
+PhotoEditJob::PhotoEditJob(const PhotoData *photo, const QList<PhotoEditCommand> &commands)
+    : PhotoEditJob(photo->file(), photo->fileFormat(), photo->orientation(), commands)
+{
+}
+
+/*!
+ * \brief PhotoEditJob::PhotoEditJob
+ * Applies all the commands to a photo nobody holds a PhotoData for.
+ * \param file
+ * \param fileFormat as PhotoData::readFileFormat() tells it
+ * \param orientation the orientation the photo is currently displayed with
+ * \param commands
+ */
+PhotoEditJob::PhotoEditJob(const QFileInfo& file, const QString& fileFormat,
+                           Orientation orientation,
+                           const QList<PhotoEditCommand>& commands)
+    : QObject(),
+      QRunnable(),
+      m_file(file),
+      m_fileFormat(fileFormat),
+      m_fileFormatHasOrientation(PhotoData::formatHasOrientation(fileFormat)),
+      m_orientation(orientation),
+      m_commands(commands),
+      m_saving(true)
+{
+    // Deleted with deleteLater() once run() is done, on the thread it was
+    // created on, so that queued signals never reach a deleted object
+    setAutoDelete(false);
+}
+
+/*!
+ * \brief PhotoEditJob::commands returns the editing commands used for this processing
+ * \return
+ */
+const QList<PhotoEditCommand> &PhotoEditJob::commands() const
+{
+    return m_commands;
+}
+
+/*!
+ * \brief PhotoEditJob::setWorkingImage
+ * Gives the job the decoded pixels of the photo, with its orientation
+ * applied, to edit instead of decoding the file again. The file still gets
+ * edited the usual way when that doesn't involve decoding it.
+ * \param image
+ * \param commands the same edits as commands(), with rotations relative to
+ * the image rather than to the pixels in the file
+ */
+void PhotoEditJob::setWorkingImage(const QImage& image,
+                                   const QList<PhotoEditCommand>& commands)
+{
+    m_workingImage = image;
+    m_workingCommands = commands;
+}
+
+/*!
+ * \brief PhotoEditJob::workingImage
+ * \return once the job is finished, the pixels of the edited photo, with its
+ * orientation applied, or a null image if the job didn't need them
+ */
+QImage PhotoEditJob::workingImage() const
+{
+    return m_workingImage;
+}
+
+/*!
+ * \brief PhotoEditJob::setSaving
+ * Lets the job only edit the working image, leaving the file alone, for
+ * edits that get saved later on with others.
+ * \param saving
+ */
+void PhotoEditJob::setSaving(bool saving)
+{
+    m_saving = saving;
+}
+
+/*!
+ * \brief PhotoEditJob::setWorkingFile
+ * Tells a job that only edits its working image which file the image shows
+ * untouched, if any, so that edits done ahead of time on that file can be
+ * used. A job that saves looks for those of the photo.
+ * \param file
+ */
+void PhotoEditJob::setWorkingFile(const QFileInfo& file)
+{
+    m_workingFile = file;
+}
+
+/*!
+ * \brief PhotoEditJob::start
+ * Queues the job on the worker pool shared by all photos. It deletes itself
+ * once done, after emitting finished().
+ */
+void PhotoEditJob::start()
+{
+    editPool()->start(this);
+}
+
+/*!
+ * \brief PhotoEditJob::cancel
+ * Asks the job to stop as soon as possible. It can be called from any
+ * thread. The photo is left as it was, unless the edit was already being
+ * saved.
+ */
+void PhotoEditJob::cancel()
+{
+    m_cancelled.store(1);
+}
+
+/*!
+ * \brief PhotoEditJob::isCancelled
+ * \return
+ */
+bool PhotoEditJob::isCancelled() const
+{
+    return m_cancelled.load() != 0;
+}
+
+/*!
+ * \brief PhotoEditJob::progress
+ * \return how far the job has got; it can be read from any thread
+ */
+const PhotoEditProgress& PhotoEditJob::progress() const
+{
+    return m_progress;
+}
+
+/*!
+ * \brief PhotoEditJob::waitForAll
+ * Waits for the jobs of all photos to finish, mostly for tests.
+ * \param msecs
+ * \return false if they didn't in time
+ */
+bool PhotoEditJob::waitForAll(int msecs)
+{
+    return editPool()->waitForDone(msecs);
+}
+
+/*!
+ * \brief PhotoEditJob::isIdle
+ * \return whether no photo is being edited, for work that can wait
+ */
+bool PhotoEditJob::isIdle()
+{
+    return editPool()->activeThreadCount() == 0;
+}
+
+/*!
+ * \brief PhotoEditJob::run \reimp
+ */
+void PhotoEditJob::run()
+{
+    if (!isCancelled())
+        edit();
+
+    Q_EMIT finished();
+    deleteLater();
+}
+
+/*!
+ * \brief PhotoEditJob::edit
+ * Does the work of the job on the calling thread, for those that schedule
+ * edits themselves rather than start() them.
+ * \return true if the photo has been edited and saved, or only its working
+ * image edited if it isn't being saved
+ */
+bool PhotoEditJob::edit()
+{
+    Orientation orientation = TOP_LEFT_ORIGIN;
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+    // If the photo was previously rotated through metadata and we are editing
+    // the actual pixels, the pixels get rotated to match the orientation so
+    // that the correct pixels are edited.
+    //
+    // Using QImage::setAutoTransform() would be better if it existed:
+    // https://bugreports.qt.io/browse/QTBUG-48271
+    if (m_fileFormatHasOrientation)
+        orientation = m_orientation;
+#endif
+
+    PhotoEditPipeline pipeline(orientation);
+    pipeline.append(m_commands);
+    pipeline.setCancelFlag(&m_cancelled);
+    pipeline.setProgress(&m_progress);
+    if (pipeline.isEmpty()) {
+        qWarning() << "Edit thread running with unknown or no operation.";
+        return false;
+    }
+
+    // Auto enhance may have been done ahead of time by the PhotoPreEnhancer,
+    // in which case there is a file to swap in
+    if (m_commands.count() == 1 && m_commands.first().type == EDIT_ENHANCE) {
+        QFileInfo source = m_saving ? m_file : m_workingFile;
+        QString enhanced = source.filePath().isEmpty() ? QString() :
+                                                         PhotoCaches::enhancedVersion(source);
+        if (!enhanced.isEmpty() && useEnhancedFile(enhanced))
+            return true;
+    }
+
+    if (!m_saving) {
+        planProgress(0, 1, 0);
+        m_progress.begin(PhotoEditProgress::STAGE_PROCESS, 1);
+        editWorkingImage();
+        m_progress.advance();
+        return !isCancelled() && !m_workingImage.isNull();
+    }
+
+    // The only operation in which we don't have to work on the actual image
+    // pixels is image rotation in the case where we can simply change the
+    // metadata rotation field.
+    if (!pipeline.changesPixels() && m_fileFormatHasOrientation) {
+        planProgress(0, 0, 0);
+        if (!handleSimpleMetadataRotation(pipeline.orientation()))
+            return false;
+        editWorkingImage();
+        return true;
+    }
+
+    if (m_fileFormat == "jpeg") {
+        // Geometry alone can often be edited without touching the pixels
+        planProgress(2, 1, 2);
+        if (!pipeline.hasToneEdits() && editJpegFile(pipeline, true)) {
+            editWorkingImage();
+            return true;
+        }
+
+        // Strips get decoded and encoded as they are processed, which is only
+        // worth it if the pixels aren't at hand already
+        if (m_workingImage.isNull()) {
+            planProgress(0, 8, 0);
+            QSize size = QImageReader(m_file.filePath()).size();
+            if ((qint64) size.width() * size.height() >= STRIP_EDITING_MIN_PIXELS &&
+                    editJpegFile(pipeline, false))
+                return true;
+        }
+
+        if (isCancelled())
+            return false;
+    }
+
+    // In all other cases we load the image, unless we have it already, do the
+    // work, and save it back.
+    QImage image;
+    if (!m_workingImage.isNull()) {
+        planProgress(0, 2, 3);
+        PhotoEditPipeline working;
+        working.append(m_workingCommands);
+        working.setCancelFlag(&m_cancelled);
+        working.setProgress(&m_progress);
+        image = working.apply(m_workingImage);
+    } else {
+        planProgress(3, 2, 3);
+        m_progress.begin(PhotoEditProgress::STAGE_DECODE, 1);
+        image = QImage(m_file.filePath(), m_fileFormat.toStdString().c_str());
+        if (image.isNull()) {
+            qWarning() << "Error loading" << m_file.filePath() << "for editing";
+            return false;
+        }
+        m_progress.advance();
+
+        image = pipeline.apply(image);
+    }
+    m_workingImage = QImage();
+    if (isCancelled() || image.isNull())
+        return false;
+
+    // The result can be shown while it gets saved
+    Q_EMIT resultReady(image);
+
+    m_progress.begin(PhotoEditProgress::STAGE_ENCODE, 1);
+    QTemporaryFile replacement(replacementTemplate(m_file));
+    bool saved = replacement.open() &&
+            image.save(&replacement, m_fileFormat.toStdString().c_str(), -1) &&
+            replaceFile(replacement, image, TOP_LEFT_ORIGIN);
+    if (saved)
+        m_workingImage = image;
+    else
+        qWarning() << "Error saving edited" << m_file.filePath();
+    return saved;
+}
+
+/*!
+ * \brief PhotoEditJob::replaceFile
+ * Copies the metadata of the photo to a replacement written next to it,
+ * makes sure the replacement is on the disk and renames it over the photo,
+ * so that the photo is either the old or the new one whatever happens.
+ * \param replacement
+ * \param thumbnail the new EXIF thumbnail, if the pixels changed
+ * \param orientation of the replacement
+ * \return
+ */
+bool PhotoEditJob::replaceFile(QTemporaryFile& replacement, const QImage& thumbnail,
+                               Orientation orientation)
+{
+    replacement.close();
+
+    m_progress.begin(PhotoEditProgress::STAGE_METADATA, 1);
+    PhotoMetadata* original = PhotoMetadata::fromFile(m_file);
+    PhotoMetadata* copy = PhotoMetadata::fromFile(QFileInfo(replacement.fileName()));
+    if (original && copy) {
+        original->copyTo(copy);
+        copy->setOrientation(orientation);
+        if (!thumbnail.isNull())
+            copy->updateThumbnail(thumbnail);
+        copy->save();
+    }
+    delete original;
+    delete copy;
+    m_progress.advance();
+
+    return commitReplacement(replacement, m_file);
+}
+
+/*!
+ * \brief PhotoEditJob::replacementTemplate
+ * A hidden file next to the photo, so that renaming it over the photo stays
+ * within one file system, where it is atomic.
+ * \param file the photo
+ * \return a template for QTemporaryFile
+ */
+QString PhotoEditJob::replacementTemplate(const QFileInfo& file)
+{
+    return file.absolutePath() + "/." + file.completeBaseName() + "-XXXXXX." +
+            file.suffix();
+}
+
+/*!
+ * \brief PhotoEditJob::commitReplacement
+ * Makes sure a closed replacement is on the disk and renames it over the
+ * photo.
+ * \param replacement made from replacementTemplate()
+ * \param file the photo
+ * \return
+ */
+bool PhotoEditJob::commitReplacement(QTemporaryFile& replacement, const QFileInfo& file)
+{
+    // Exiv2 may have replaced the file instead of writing into it, so it
+    // gets synced by name
+    QString path = file.absoluteFilePath();
+    QFile::setPermissions(replacement.fileName(), QFile::permissions(path));
+    if (!syncToDisk(replacement.fileName()) ||
+            ::rename(QFile::encodeName(replacement.fileName()).constData(),
+                     QFile::encodeName(path).constData()) != 0) {
+        qWarning() << "Error replacing" << path;
+        return false;
+    }
+    replacement.setAutoRemove(false);
+
+    // And so does the rename
+    syncToDisk(file.absolutePath());
+    return true;
+}
+
+/*!
+ * \brief PhotoEditJob::editWorkingImage
+ * Brings the working image, if any, up to date with the file once the file
+ * has been edited without it.
+ */
+void PhotoEditJob::editWorkingImage()
+{
+    if (m_workingImage.isNull())
+        return;
+
+    PhotoEditPipeline working;
+    working.append(m_workingCommands);
+    // Unless it gets saved later, the working image is only there to be shown
+    working.setPreview(!m_saving);
+    working.setCancelFlag(&m_cancelled);
+    m_workingImage = working.apply(m_workingImage);
+}
+
+/*!
+ * \brief PhotoEditJob::planProgress
+ * Sets the share of the work each stage takes on the way the edit is about to
+ * be done, relative to the metadata, which takes about the same time on every
+ * way. Analysis only counts if there is some enhancement to analyse for.
+ * \param decode
+ * \param process
+ * \param encode
+ */
+void PhotoEditJob::planProgress(int decode, int process, int encode)
+{
+    bool enhances = false;
+    Q_FOREACH(const PhotoEditCommand& command, m_commands) {
+        if (command.type == EDIT_ENHANCE)
+            enhances = true;
+    }
+
+    m_progress.plan(PhotoEditProgress::STAGE_DECODE, decode);
+    m_progress.plan(PhotoEditProgress::STAGE_ANALYSE, (enhances && process > 0) ? 1 : 0);
+    m_progress.plan(PhotoEditProgress::STAGE_PROCESS, process);
+    m_progress.plan(PhotoEditProgress::STAGE_ENCODE, encode);
+    m_progress.plan(PhotoEditProgress::STAGE_METADATA, 1);
+}
+
+/*!
+ * \brief PhotoEditJob::handleSimpleMetadataRotation
+ * Handler for the case of an image whose only change is to its
+ * orientation; used to skip re-encoding of JPEGs.
+ * \param orientation
+ * \return
+ */
+bool PhotoEditJob::handleSimpleMetadataRotation(Orientation orientation)
+{
+    // Exiv2 rewrites the file in place, so the change goes to a copy
+    QFile source(m_file.absoluteFilePath());
+    QTemporaryFile replacement(replacementTemplate(m_file));
+    bool copied = source.open(QIODevice::ReadOnly) && replacement.open() &&
+            FileUtils::copyContents(source.handle(), replacement.handle());
+
+    if (!copied || !replaceFile(replacement, QImage(), orientation)) {
+        qWarning() << "Error rotating" << m_file.filePath();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief PhotoEditJob::useEnhancedFile
+ * Takes the result of auto enhance from a file where it was done ahead of
+ * time: the working image gets read from it, scaled to the size it was, or
+ * the photo gets replaced by a copy of it, which already has the metadata
+ * and thumbnail an edit would give it.
+ * \param enhanced
+ * \return false if the result has to be worked out after all
+ */
+bool PhotoEditJob::useEnhancedFile(const QString& enhanced)
+{
+    if (!m_saving) {
+        if (m_workingImage.isNull())
+            return false;
+
+        planProgress(1, 0, 0);
+        m_progress.begin(PhotoEditProgress::STAGE_DECODE, 1);
+        QImageReader reader(enhanced);
+        reader.setScaledSize(m_workingImage.size());
+        QImage image = reader.read();
+        m_progress.advance();
+        if (image.isNull())
+            return false;
+
+        m_workingImage = image;
+        return true;
+    }
+
+    planProgress(0, 0, 1);
+    m_progress.begin(PhotoEditProgress::STAGE_ENCODE, 1);
+    QFile source(enhanced);
+    QTemporaryFile replacement(replacementTemplate(m_file));
+    bool copied = source.open(QIODevice::ReadOnly) && replacement.open() &&
+            FileUtils::copyContents(source.handle(), replacement.handle());
+    m_progress.advance();
+    if (!copied || isCancelled())
+        return false;
+
+    replacement.close();
+    m_progress.begin(PhotoEditProgress::STAGE_METADATA, 1);
+    bool replaced = commitReplacement(replacement, m_file);
+    m_progress.advance();
+    if (!replaced)
+        return false;
+
+    // Read again from the photo, rather than enhanced a second time
+    m_workingImage = QImage();
+    return true;
+}
+
+/*!
+ * \brief PhotoEditJob::editJpegFile
+ * Edits a JPEG either losslessly, or a strip at a time without ever holding
+ * all of its pixels in memory. The edited image replaces the original only
+ * once it has been written completely, along with its metadata.
+ * \param pipeline
+ * \param lossless
+ * \return false if the image has been left untouched
+ */
+bool PhotoEditJob::editJpegFile(const PhotoEditPipeline& pipeline, bool lossless)
+{
+    QString path = m_file.filePath();
+
+    QTemporaryFile replacement(replacementTemplate(m_file));
+    bool written = replacement.open() &&
+            (lossless ? JpegLosslessEditor::apply(path, &replacement, pipeline)
+                      : JpegStripEditor::apply(path, &replacement, pipeline));
+    if (!written)
+        return false;
+    replacement.close();
+
+    QImageReader reader(replacement.fileName());
+    reader.setScaledSize(reader.size() / 4);
+    QImage thumbnail = reader.read();
+
+    // The strips were written unrotated, so the rotation goes in the metadata
+    if (!replaceFile(replacement, thumbnail,
+                     lossless ? TOP_LEFT_ORIGIN
+                              : OrientationCorrection::fromTransform(pipeline.transform()))) {
+        qWarning() << "Error saving edited" << path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2013-2014 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_EDIT_JOB_H_
+#define GALLERY_PHOTO_EDIT_JOB_H_
+
+#include "photo-caches.h"
+#include "photo-edit-command.h"
+#include "photo-edit-progress.h"
+
+// util
+#include "orientation.h"
+
+#include <QAtomicInt>
+#include <QFileInfo>
+#include <QImage>
+#include <QList>
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+
+class PhotoData;
+class PhotoEditPipeline;
+class QTemporaryFile;
+
+/*!
+ * \brief The PhotoEditJob class
+ *
+ * Edits a photo on a worker pool shared by all photos, so that the number of
+ * edit threads stays bounded however many photos get edited.
+ */
+class PhotoEditJob: public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    PhotoEditJob(const PhotoData *photo, const QList<PhotoEditCommand>& commands);
+    PhotoEditJob(const QFileInfo& file, const QString& fileFormat, Orientation orientation,
+                 const QList<PhotoEditCommand>& commands);
+
+    const QList<PhotoEditCommand>& commands() const;
+
+    void setWorkingImage(const QImage& image, const QList<PhotoEditCommand>& commands);
+    QImage workingImage() const;
+    void setSaving(bool saving);
+    void setWorkingFile(const QFileInfo& file);
+
+    void start();
+    void cancel();
+    bool isCancelled() const;
+    const PhotoEditProgress& progress() const;
+
+    static bool waitForAll(int msecs = -1);
+    static bool isIdle();
+
+    static QString replacementTemplate(const QFileInfo& file);
+    static bool commitReplacement(QTemporaryFile& replacement, const QFileInfo& file);
+
+    bool edit();
+    void run() Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    void resultReady(const QImage& image);
+    void finished();
+
+private:
+    void planProgress(int decode, int process, int encode);
+    void editWorkingImage();
+    bool editJpegFile(const PhotoEditPipeline& pipeline, bool lossless);
+    bool handleSimpleMetadataRotation(Orientation orientation);
+    bool useEnhancedFile(const QString& enhanced);
+    bool replaceFile(QTemporaryFile& replacement, const QImage& thumbnail,
+                     Orientation orientation);
+
+    QFileInfo m_file;
+    QString m_fileFormat;
+    bool m_fileFormatHasOrientation;
+    Orientation m_orientation;
+    QList<PhotoEditCommand> m_commands;
+    QImage m_workingImage;
+    QList<PhotoEditCommand> m_workingCommands;
+    bool m_saving;
+    QFileInfo m_workingFile;
+    QAtomicInt m_cancelled;
+    PhotoEditProgress m_progress;
+};
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-edit-pipeline.h"
+
+// util
+#include "band-executor.h"
+#include "imaging.h"
+
+#include <QDebug>
+
+#include <QSharedPointer>
+
+#include <functional>
+
+namespace {
+typedef PhotoEditPipeline::ScanLineKernel ToneKernel;
+
+/*
+ * Maps a rectangle given in coordinates relative to the size of an image to
+ * the same coordinates in the image transformed by the given rotation or
+ * flip. Such transforms swap the axes together with the sizes, so mapping the
+ * unit square and moving it back in place is enough.
+ */
+QRectF mapNormalized(const QTransform& transform, const QRectF& rect)
+{
+    QRectF unit = transform.mapRect(QRectF(0.0, 0.0, 1.0, 1.0));
+    return transform.mapRect(rect).translated(-unit.topLeft());
+}
+
+QRect toPixels(const QRectF& rect, const QSize& size)
+{
+    QRect result;
+    result.setX(qBound(0.0, rect.x(), 1.0) * size.width());
+    result.setY(qBound(0.0, rect.y(), 1.0) * size.height());
+    result.setWidth(qBound(0.0, rect.width(), 1.0) * size.width());
+    result.setHeight(qBound(0.0, rect.height(), 1.0) * size.height());
+    return result;
+}
+
+ExposureTransformation exposureTransformation(const PhotoEditCommand& command)
+{
+    return ExposureTransformation(command.exposureCompensation,
+                                  command.linearLightExposure
+                                  ? ExposureTransformation::LINEAR_LIGHT_CURVE
+                                  : ExposureTransformation::OFFSET_CURVE);
+}
+
+ToneKernel exposureKernel(const ExposureTransformation& exposure)
+{
+    return [exposure](QRgb* line, int width) {
+        exposure.transformScanLine(line, width);
+    };
+}
+
+/*
+ * Picks every stride-th pixel of every stride-th row of the region, which are
+ * the pixels IntensityHistogram looks at with that stride.
+ */
+QImage samplePixels(const QImage& image, const QRect& region, int stride)
+{
+    QImage sample((region.width() + stride - 1) / stride,
+                  (region.height() + stride - 1) / stride,
+                  scanLineFormat(image));
+
+    for (int j = 0; j < sample.height(); j++) {
+        QRgb* line = reinterpret_cast<QRgb*>(sample.scanLine(j));
+        for (int i = 0; i < sample.width(); i++)
+            line[i] = image.pixel(region.x() + i * stride, region.y() + j * stride);
+    }
+
+    return sample;
+}
+
+/*
+ * Samples the region an enhancement looks at, in the pixel format the
+ * scanline kernels work on.
+ */
+QImage enhanceSample(const QRectF& region, const QSize& size,
+                     const PhotoEditPipeline::Sampler& sampler, bool swapsAxes)
+{
+    QRect pixels = toPixels(region, size) & QRect(QPoint(0, 0), size);
+    int displayed_width = swapsAxes ? pixels.height() : pixels.width();
+
+    // Sampling about 400 columns, and as many rows in proportion, is
+    // plenty to analyse the intensity distribution.
+    int sample_stride = qMax(1, displayed_width / 400);
+    QImage sample = sampler(pixels, sample_stride);
+    return sample.convertToFormat(scanLineFormat(sample));
+}
+} // namespace
+
+/*!
+ * \brief PhotoEditPipeline::PhotoEditPipeline
+ * \param orientation the orientation the pixels are currently displayed with
+ */
+PhotoEditPipeline::PhotoEditPipeline(Orientation orientation)
+    : m_commandCount(0),
+      m_orientation(orientation),
+      m_crop(0.0, 0.0, 1.0, 1.0),
+      m_snapCrop(false),
+      m_preview(false),
+      m_cancelled(0),
+      m_progress(0)
+{
+}
+
+/*!
+ * \brief PhotoEditPipeline::append
+ * Adds a command after the ones already in the pipeline. Like in
+ * PhotoEditJob, the orientation of a rotation is relative to the pixels as
+ * they were after the last crop or tonal edit, and a crop is relative to the
+ * image as it is displayed at that point.
+ * \param command
+ */
+void PhotoEditPipeline::append(const PhotoEditCommand& command)
+{
+    switch (command.type) {
+    case EDIT_ROTATE:
+        m_orientation = command.orientation;
+        break;
+
+    case EDIT_CROP: {
+        QTransform display = displayTransform();
+        QRectF current = mapNormalized(display, m_crop);
+        QRectF crop(qBound(0.0, command.crop_rectangle.x(), 1.0),
+                    qBound(0.0, command.crop_rectangle.y(), 1.0),
+                    qBound(0.0, command.crop_rectangle.width(), 1.0),
+                    qBound(0.0, command.crop_rectangle.height(), 1.0));
+        QRectF next(current.x() + crop.x() * current.width(),
+                    current.y() + crop.y() * current.height(),
+                    crop.width() * current.width(),
+                    crop.height() * current.height());
+        m_crop = mapNormalized(display.inverted(), next);
+        m_snapCrop = m_snapCrop || command.snapCropToBlocks;
+
+        m_baked = display;
+        m_orientation = TOP_LEFT_ORIGIN;
+        break;
+    }
+
+    case EDIT_ENHANCE:
+    case EDIT_COMPENSATE_EXPOSURE: {
+        ToneStage stage;
+        stage.command = command;
+        stage.region = m_crop;
+        m_tones.append(stage);
+
+        m_baked = displayTransform();
+        m_orientation = TOP_LEFT_ORIGIN;
+        break;
+    }
+
+    default:
+        qWarning() << "Ignoring unknown edit operation" << command.type;
+        return;
+    }
+
+    m_commandCount++;
+}
+
+/*!
+ * \brief PhotoEditPipeline::append
+ * \param commands
+ */
+void PhotoEditPipeline::append(const QList<PhotoEditCommand>& commands)
+{
+    Q_FOREACH(const PhotoEditCommand& command, commands)
+        append(command);
+}
+
+/*!
+ * \brief PhotoEditPipeline::isEmpty
+ * \return
+ */
+bool PhotoEditPipeline::isEmpty() const
+{
+    return m_commandCount == 0;
+}
+
+/*!
+ * \brief PhotoEditPipeline::changesPixels
+ * \return false if the pipeline only rotates, in which case storing
+ * orientation() in the metadata is enough for formats that support it
+ */
+bool PhotoEditPipeline::changesPixels() const
+{
+    return !m_tones.isEmpty() || m_crop != QRectF(0.0, 0.0, 1.0, 1.0) ||
+            !m_baked.isIdentity();
+}
+
+/*!
+ * \brief PhotoEditPipeline::orientation
+ * \return the orientation to display the pixels with, once the rotations have
+ * been applied, if changesPixels() is false
+ */
+Orientation PhotoEditPipeline::orientation() const
+{
+    return m_orientation;
+}
+
+/*!
+ * \brief PhotoEditPipeline::sourceRect
+ * \param size size of the source pixels
+ * \return the part of the source pixels that ends up in the result
+ */
+QRect PhotoEditPipeline::sourceRect(const QSize& size) const
+{
+    return toPixels(m_crop, size);
+}
+
+/*!
+ * \brief PhotoEditPipeline::snapsCropToBlocks
+ * \return true if the crop may be moved to line up with the blocks of a
+ * compressed image
+ */
+bool PhotoEditPipeline::snapsCropToBlocks() const
+{
+    return m_snapCrop;
+}
+
+/*!
+ * \brief PhotoEditPipeline::transform
+ * \return the transform that takes the source pixels to the result, after
+ * cropping them to sourceRect()
+ */
+QTransform PhotoEditPipeline::transform() const
+{
+    return displayTransform();
+}
+
+/*!
+ * \brief PhotoEditPipeline::apply
+ * Runs all the commands on the given pixels. The result is always displayed
+ * with TOP_LEFT_ORIGIN orientation.
+ * \param image the source pixels, without any orientation correction applied
+ * \return
+ */
+QImage PhotoEditPipeline::apply(const QImage& image) const
+{
+    if (image.isNull())
+        return image;
+
+    QRect rect = sourceRect(image.size());
+    QImage result = (rect == image.rect()) ? image : image.copy(rect);
+
+    QTransform geometry = transform();
+    if (!geometry.isIdentity())
+        result = result.transformed(geometry);
+
+    if (m_tones.isEmpty()) {
+        beginStage(PhotoEditProgress::STAGE_PROCESS, 1);
+        advance();
+        return result;
+    }
+
+    // Exposure alone, however many times, folds into a single table that
+    // works on most formats as they are
+    bool exposureOnly = true;
+    ExposureTransformation exposure;
+    Q_FOREACH(const ToneStage& stage, m_tones) {
+        if (stage.command.type != EDIT_COMPENSATE_EXPOSURE) {
+            exposureOnly = false;
+            break;
+        }
+        exposure = exposure.followedBy(exposureTransformation(stage.command));
+    }
+    if (exposureOnly && ExposureTransformation::transformsInPlace(result.format())) {
+        beginStage(PhotoEditProgress::STAGE_PROCESS, 1);
+        exposure.apply(result);
+        advance();
+        return isCancelled() ? QImage() : result;
+    }
+
+    ScanLineKernel kernel = toneKernel(image.size(),
+                                       [&image](const QRect& region, int stride) {
+        return samplePixels(image, region, stride);
+    });
+    beginStage(PhotoEditProgress::STAGE_PROCESS, result.height());
+
+    QImage::Format dest_format = result.format();
+
+    // Can't write into indexed images, due to a limitation in Qt.
+    if (dest_format == QImage::Format_Indexed8)
+        dest_format = QImage::Format_RGB32;
+
+    if (result.format() != scanLineFormat(result))
+        result = result.convertToFormat(scanLineFormat(result));
+
+    uchar* bits = result.bits();
+    const int stride = result.bytesPerLine();
+    const int width = result.width();
+    BandExecutor::run(result.height(), [&](int first, int last) {
+        for (int j = first; j < last && !isCancelled(); j++)
+            kernel(reinterpret_cast<QRgb*>(bits + j * stride), width);
+        advance(last - first);
+    });
+    if (isCancelled())
+        return QImage();
+
+    if (result.format() != dest_format)
+        result = result.convertToFormat(dest_format);
+
+    return result;
+}
+
+/*!
+ * \brief PhotoEditPipeline::setPreview
+ * Lets the tone stages compile into a ColorLut, which is faster and at most a
+ * couple of levels off. Only for pixels that are shown and never saved.
+ * \param preview
+ */
+void PhotoEditPipeline::setPreview(bool preview)
+{
+    m_preview = preview;
+}
+
+/*!
+ * \brief PhotoEditPipeline::setCancelFlag
+ * Makes apply() and the JPEG editors stop early, with a null result or
+ * failure, once the flag is set.
+ * \param cancelled set from any thread, and must outlive the pipeline
+ */
+void PhotoEditPipeline::setCancelFlag(const QAtomicInt* cancelled)
+{
+    m_cancelled = cancelled;
+}
+
+/*!
+ * \brief PhotoEditPipeline::isCancelled
+ * \return
+ */
+bool PhotoEditPipeline::isCancelled() const
+{
+    return m_cancelled && m_cancelled->load() != 0;
+}
+
+/*!
+ * \brief PhotoEditPipeline::setProgress
+ * Makes apply(), toneKernel() and the JPEG editors report how far they got.
+ * \param progress must outlive the pipeline
+ */
+void PhotoEditPipeline::setProgress(PhotoEditProgress* progress)
+{
+    m_progress = progress;
+}
+
+/*!
+ * \brief PhotoEditPipeline::beginStage
+ * Moves the progress, if any, on to a stage.
+ * \param stage
+ * \param total the units of work in the stage
+ */
+void PhotoEditPipeline::beginStage(PhotoEditProgress::Stage stage, int total) const
+{
+    if (m_progress)
+        m_progress->begin(stage, total);
+}
+
+/*!
+ * \brief PhotoEditPipeline::advance
+ * Counts units of work of the current stage as done, from any thread.
+ * \param amount
+ */
+void PhotoEditPipeline::advance(int amount) const
+{
+    if (m_progress)
+        m_progress->advance(amount);
+}
+
+/*!
+ * \brief PhotoEditPipeline::hasToneEdits
+ * \return
+ */
+bool PhotoEditPipeline::hasToneEdits() const
+{
+    return !m_tones.isEmpty();
+}
+
+/*!
+ * \brief PhotoEditPipeline::toneKernel
+ * Sets up the exposure and enhancement stages, in order, and returns a kernel
+ * that runs all of them on a scanline, in place. Enhancement looks at the
+ * pixels as the earlier stages leave them, so it gets analysed on a sample
+ * those stages already ran on. For previews, once there is an enhancement,
+ * all the stages compile into a single ColorLut, so that the pixels only take
+ * one lookup.
+ * \param size size of the source pixels
+ * \param sampler returns every stride-th pixel of every stride-th row of a
+ * region of the source pixels, or an approximation of them
+ * \return
+ */
+PhotoEditPipeline::ScanLineKernel PhotoEditPipeline::toneKernel(
+        const QSize& size, const Sampler& sampler) const
+{
+    bool swapsAxes = transform().m11() == 0.0;
+
+    int analyses = 0;
+    Q_FOREACH(const ToneStage& stage, m_tones) {
+        if (stage.command.type == EDIT_ENHANCE)
+            analyses++;
+    }
+    if (analyses > 0)
+        beginStage(PhotoEditProgress::STAGE_ANALYSE, analyses);
+
+    // Pixels that get saved go through each stage exactly
+    if (!m_preview) {
+        QList<ToneKernel> kernels;
+        Q_FOREACH(const ToneStage& stage, m_tones) {
+            if (stage.command.type == EDIT_ENHANCE) {
+                QImage sample = enhanceSample(stage.region, size, sampler, swapsAxes);
+                for (int j = 0; j < sample.height(); j++) {
+                    QRgb* line = reinterpret_cast<QRgb*>(sample.scanLine(j));
+                    Q_FOREACH(const ToneKernel& kernel, kernels)
+                        kernel(line, sample.width());
+                }
+                QSharedPointer<AutoEnhanceTransformation> enhance(
+                            new AutoEnhanceTransformation(sample));
+                kernels.append([enhance](QRgb* line, int width) {
+                    enhance->transformScanLine(line, line, width);
+                });
+                advance();
+            } else {
+                kernels.append(exposureKernel(exposureTransformation(stage.command)));
+            }
+        }
+        return [kernels](QRgb* line, int width) {
+            Q_FOREACH(const ToneKernel& kernel, kernels)
+                kernel(line, width);
+        };
+    }
+
+    // Exposures before the first enhancement, and everything from it on
+    ExposureTransformation leading;
+    ColorLut lut;
+    Q_FOREACH(const ToneStage& stage, m_tones) {
+        if (stage.command.type == EDIT_ENHANCE) {
+            QImage sample = enhanceSample(stage.region, size, sampler, swapsAxes);
+            for (int j = 0; j < sample.height(); j++) {
+                QRgb* line = reinterpret_cast<QRgb*>(sample.scanLine(j));
+                if (lut.isNull())
+                    leading.transformScanLine(line, sample.width());
+                else
+                    lut.transformScanLine(line, line, sample.width());
+            }
+
+            AutoEnhanceTransformation enhance(sample);
+            if (lut.isNull()) {
+                lut = ColorLut::compile([&leading, &enhance](QRgb pixel) {
+                    return enhance.transformRgb(leading.transformRgb(pixel));
+                });
+            } else {
+                lut = lut.folded([&enhance](QRgb pixel) {
+                    return enhance.transformRgb(pixel);
+                });
+            }
+            advance();
+        } else {
+            ExposureTransformation exposure = exposureTransformation(stage.command);
+            if (lut.isNull()) {
+                leading = leading.followedBy(exposure);
+            } else {
+                lut = lut.folded([&exposure](QRgb pixel) {
+                    return exposure.transformRgb(pixel);
+                });
+            }
+        }
+    }
+
+    if (lut.isNull())
+        return exposureKernel(leading);
+    return [lut](QRgb* line, int width) {
+        lut.transformScanLine(line, line, width);
+    };
+}
+
+/*!
+ * \brief PhotoEditPipeline::displayTransform
+ * \return
+ */
+QTransform PhotoEditPipeline::displayTransform() const
+{
+    return m_baked *
+            OrientationCorrection::fromOrientation(m_orientation).toTransform();
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_EDIT_PIPELINE_H_
+#define GALLERY_PHOTO_EDIT_PIPELINE_H_
+
+#include "photo-edit-command.h"
+#include "photo-edit-progress.h"
+
+// util
+#include "orientation.h"
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QList>
+#include <QRect>
+#include <QRectF>
+#include <QRgb>
+#include <QTransform>
+
+#include <functional>
+
+/*!
+ * \brief The PhotoEditPipeline class
+ *
+ * Applies an ordered list of edit commands to decoded pixels in one go.
+ *
+ * Rotations and crops are folded into a single region of the source pixels
+ * plus a single transform, and exposure and enhancement run together in one
+ * pass over the scanlines. The result is the same as applying the commands
+ * one after the other, without the intermediate copies and, once saved,
+ * with a single round of encoding loss.
+ */
+class PhotoEditPipeline
+{
+public:
+    typedef std::function<void(QRgb* line, int width)> ScanLineKernel;
+    typedef std::function<QImage(const QRect& region, int stride)> Sampler;
+
+    explicit PhotoEditPipeline(Orientation orientation = TOP_LEFT_ORIGIN);
+
+    void append(const PhotoEditCommand& command);
+    void append(const QList<PhotoEditCommand>& commands);
+
+    bool isEmpty() const;
+    bool changesPixels() const;
+    Orientation orientation() const;
+
+    QRect sourceRect(const QSize& size) const;
+    bool snapsCropToBlocks() const;
+    QTransform transform() const;
+
+    bool hasToneEdits() const;
+    ScanLineKernel toneKernel(const QSize& size, const Sampler& sampler) const;
+
+    QImage apply(const QImage& image) const;
+
+    void setPreview(bool preview);
+
+    void setCancelFlag(const QAtomicInt* cancelled);
+    bool isCancelled() const;
+
+    void setProgress(PhotoEditProgress* progress);
+    void beginStage(PhotoEditProgress::Stage stage, int total) const;
+    void advance(int amount = 1) const;
+
+private:
+    struct ToneStage
+    {
+        PhotoEditCommand command;
+        // The crop in effect when the command was issued, relative to the
+        // source pixels
+        QRectF region;
+    };
+
+    QTransform displayTransform() const;
+
+    int m_commandCount;
+    // Transform already applied to the source pixels by pixel edits, and
+    // orientation applied on top of it
+    QTransform m_baked;
+    Orientation m_orientation;
+    QRectF m_crop;
+    bool m_snapCrop;
+    QList<ToneStage> m_tones;
+    bool m_preview;
+    const QAtomicInt* m_cancelled;
+    PhotoEditProgress* m_progress;
+};
+
+#endif // GALLERY_PHOTO_EDIT_PIPELINE_H_
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-edit-progress.h"
+
+#include <QMutexLocker>
+
+namespace {
+// Below this, too little of the edit has been measured for the estimate to
+// mean anything
+const qreal MIN_ESTIMATE_PROGRESS = 0.02;
+} // namespace
+
+/*!
+ * \brief PhotoEditProgress::PhotoEditProgress
+ * Starts with no stage planned. The clock for the estimates starts now.
+ */
+PhotoEditProgress::PhotoEditProgress()
+    : m_stage(STAGE_NONE),
+      m_total(0),
+      m_done(0)
+{
+    for (int i = 0; i < STAGE_COUNT; i++)
+        m_weights[i] = 0;
+    m_timer.start();
+}
+
+/*!
+ * \brief PhotoEditProgress::plan
+ * Sets the share of the total work a stage takes. Stages run in the order of
+ * the enum; those that aren't planned, or planned with no weight, don't count
+ * towards the progress when they run.
+ * \param stage
+ * \param weight relative to the weights of the other stages
+ */
+void PhotoEditProgress::plan(Stage stage, int weight)
+{
+    QMutexLocker locker(&m_mutex);
+    m_weights[stage] = qMax(0, weight);
+}
+
+/*!
+ * \brief PhotoEditProgress::begin
+ * Moves on to a stage, which is done once advance() has counted total units
+ * of work.
+ * \param stage
+ * \param total
+ */
+void PhotoEditProgress::begin(Stage stage, int total)
+{
+    QMutexLocker locker(&m_mutex);
+    m_stage = stage;
+    m_total = qMax(1, total);
+    m_done.store(0);
+}
+
+/*!
+ * \brief PhotoEditProgress::advance
+ * Counts units of work of the current stage as done. It can be called from
+ * any thread.
+ * \param amount
+ */
+void PhotoEditProgress::advance(int amount)
+{
+    m_done.fetchAndAddRelaxed(amount);
+}
+
+/*!
+ * \brief PhotoEditProgress::stage
+ * \return
+ */
+PhotoEditProgress::Stage PhotoEditProgress::stage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stage;
+}
+
+/*!
+ * \brief PhotoEditProgress::progress
+ * \return how much of the planned work is done, from 0.0 to 1.0
+ */
+qreal PhotoEditProgress::progress() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    int total = 0;
+    int before = 0;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        total += m_weights[i];
+        if (i < m_stage)
+            before += m_weights[i];
+    }
+    if (total == 0)
+        return 0.0;
+
+    qreal stage = qMin(1.0, (qreal) m_done.load() / m_total);
+    return (before + stage * m_weights[m_stage]) / total;
+}
+
+/*!
+ * \brief PhotoEditProgress::estimatedRemainingMs
+ * Extrapolates the time taken so far at the rate the progress has been
+ * made, which accounts for however fast the device turns out to be.
+ * \return the estimated time left, or -1 if it can't be estimated yet
+ */
+qint64 PhotoEditProgress::estimatedRemainingMs() const
+{
+    qreal done = progress();
+    if (done < MIN_ESTIMATE_PROGRESS)
+        return -1;
+
+    return qRound64(m_timer.elapsed() * (1.0 - done) / done);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_EDIT_PROGRESS_H_
+#define GALLERY_PHOTO_EDIT_PROGRESS_H_
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+
+/*!
+ * \brief The PhotoEditProgress class
+ *
+ * Keeps track of how far an edit has got. The edit plans the stages it goes
+ * through, with their share of the total work, and the kernels count the
+ * units of work of the current stage as they get done, from any thread.
+ * Counting only touches an atomic, so it is cheap enough to do for every
+ * scanline; readers sample the progress at whatever rate suits them.
+ */
+class PhotoEditProgress
+{
+public:
+    enum Stage {
+        STAGE_NONE = 0,
+        STAGE_DECODE,
+        STAGE_ANALYSE,
+        STAGE_PROCESS,
+        STAGE_ENCODE,
+        STAGE_METADATA,
+        STAGE_COUNT
+    };
+
+    PhotoEditProgress();
+
+    void plan(Stage stage, int weight);
+    void begin(Stage stage, int total);
+    void advance(int amount = 1);
+
+    Stage stage() const;
+    qreal progress() const;
+    qint64 estimatedRemainingMs() const;
+
+private:
+    mutable QMutex m_mutex;
+    int m_weights[STAGE_COUNT];
+    Stage m_stage;
+    int m_total;
+    QAtomicInt m_done;
+    QElapsedTimer m_timer;
+};
+
+#endif // GALLERY_PHOTO_EDIT_PROGRESS_H_
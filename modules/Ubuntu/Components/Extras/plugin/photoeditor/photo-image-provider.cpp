@@ -18,15 +18,70 @@
  */
 
 #include "photo-image-provider.h"
+#include "photo-caches.h"
+#include "photo-edit-command.h"
+#include "photo-edit-history.h"
+#include "photo-edit-pipeline.h"
+#include "working-image-cache.h"
 
 #include <QtGlobal>
 #include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QUrlQuery>
 #include <QtGui/QImageReader>
 
 #include <exiv2/exiv2.hpp>
 
 const char* PhotoImageProvider::PROVIDER_ID = "photo";
 const char* EXIF_ORIENTATION_KEY = "Exif.Image.Orientation";
+const char* EXPOSURE_KEY = "exposure";
+
+// Enough for the image being edited and the one it replaces on screen
+const int PhotoImageProvider::MAX_PROXIES = 2;
+
+namespace {
+QSize scaledSize(const QSize& fullSize, const QSize& requestedSize)
+{
+    QSize loadSize(fullSize);
+
+    if (fullSize.isValid() && (requestedSize.width() > 0 || requestedSize.height() > 0)) {
+        loadSize.scale(requestedSize, Qt::KeepAspectRatio);
+        if (loadSize.width() > fullSize.width() || loadSize.height() > fullSize.height()) {
+            loadSize = fullSize;
+        }
+    }
+
+    return loadSize;
+}
+
+QImage loadImage(const QString& filePath, const QSize& requestedSize)
+{
+    // Photos being edited are at hand already, either as the edits of their
+    // session leave them or as the last edit saved them
+    QImage working = PhotoEditHistory::find(filePath);
+    if (working.isNull())
+        working = WorkingImageCache::find(filePath);
+    if (!working.isNull()) {
+        QSize loadSize = scaledSize(working.size(), requestedSize);
+        if (loadSize == working.size())
+            return working;
+        return working.scaled(loadSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QImageReader reader(filePath);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+    reader.setAutoTransform(true);
+#endif
+    QSize fullSize = reader.size();
+    QSize loadSize = scaledSize(fullSize, requestedSize);
+
+    if (loadSize != fullSize) {
+        reader.setScaledSize(loadSize);
+    }
+
+    return reader.read();
+}
+} // namespace
 
 PhotoImageProvider::PhotoImageProvider()
     : QQuickImageProvider(QQuickImageProvider::Image)
@@ -44,8 +99,7 @@ QImage PhotoImageProvider::requestImage(const QString& id,
     QString filePath = url.path();
 
     QFileInfo fileInfo(filePath);
-    QString original = fileInfo.path() + "/.original/" + fileInfo.fileName();
-    if (QFileInfo::exists(original)) {
+    if (PhotoCaches(fileInfo).hasCachedOriginal()) {
         Exiv2::Image::AutoPtr exivImage;
         try {
             exivImage = Exiv2::ImageFactory::open(filePath.toStdString());
@@ -59,29 +113,81 @@ QImage PhotoImageProvider::requestImage(const QString& id,
         }
     }
 
-    QImageReader reader(filePath);
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-    reader.setAutoTransform(true);
-#endif
-    QSize fullSize = reader.size();
-    QSize loadSize(fullSize);
+    // Previews of edits, like image://photo/<path>?exposure=0.35, are
+    // rendered from a proxy kept in memory, so that they can follow a slider
+    QUrlQuery query(url);
+    QImage image;
+    if (query.hasQueryItem(EXPOSURE_KEY)) {
+        image = proxy(filePath, requestedSize);
 
-    if (fullSize.isValid() && (requestedSize.width() > 0 || requestedSize.height() > 0)) {
-        loadSize.scale(requestedSize, Qt::KeepAspectRatio);
-        if (loadSize.width() > fullSize.width() || loadSize.height() > fullSize.height()) {
-            loadSize = fullSize;
-        }
-    }
+        PhotoEditCommand command;
+        command.type = EDIT_COMPENSATE_EXPOSURE;
+        command.exposureCompensation = query.queryItemValue(EXPOSURE_KEY).toDouble();
 
-    if (loadSize != fullSize) {
-        reader.setScaledSize(loadSize);
+        PhotoEditPipeline pipeline;
+        pipeline.append(command);
+        if (!image.isNull() && pipeline.changesPixels())
+            image = pipeline.apply(image);
+    } else {
+        image = loadImage(filePath, requestedSize);
     }
 
-    QImage image = reader.read();
-
     if (size != NULL) {
         *size = image.size();
     }
 
     return image;
 }
+
+/*!
+ * \brief PhotoImageProvider::proxy
+ * Returns the photo decoded at the requested size, decoding it only if it
+ * changed since the last request for that size, on disk or in its editing
+ * session.
+ * \param filePath
+ * \param requestedSize
+ * \return
+ */
+QImage PhotoImageProvider::proxy(const QString& filePath, const QSize& requestedSize)
+{
+    QDateTime lastModified = QFileInfo(filePath).lastModified();
+    QImage edited = PhotoEditHistory::find(filePath);
+    qint64 editedKey = edited.isNull() ? 0 : edited.cacheKey();
+
+    QMutexLocker locker(&m_proxiesMutex);
+    for (int i = 0; i < m_proxies.count(); i++) {
+        const Proxy& cached = m_proxies.at(i);
+        if (cached.path == filePath && cached.requestedSize == requestedSize) {
+            if (cached.lastModified == lastModified && cached.editedKey == editedKey) {
+                m_proxies.move(i, 0);
+                return m_proxies.first().image;
+            }
+            m_proxies.removeAt(i);
+            break;
+        }
+    }
+    locker.unlock();
+
+    // Several requests for the same new proxy may decode it at once, but they
+    // don't hold up requests for other photos meanwhile.
+    Proxy proxy;
+    proxy.path = filePath;
+    proxy.requestedSize = requestedSize;
+    proxy.lastModified = lastModified;
+    proxy.editedKey = editedKey;
+    proxy.image = loadImage(filePath, requestedSize);
+    if (proxy.image.isNull())
+        return proxy.image;
+
+    locker.relock();
+    for (int i = m_proxies.count() - 1; i >= 0; i--) {
+        if (m_proxies.at(i).path == filePath &&
+                m_proxies.at(i).requestedSize == requestedSize)
+            m_proxies.removeAt(i);
+    }
+    m_proxies.prepend(proxy);
+    while (m_proxies.count() > MAX_PROXIES)
+        m_proxies.removeLast();
+
+    return proxy.image;
+}
@@ -22,6 +22,9 @@
 
 #include <QtQuick/QQuickImageProvider>
 #include <QtGui/QImage>
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
 #include <QtCore/QString>
 #include <QtCore/QSize>
 
@@ -35,6 +38,29 @@ public:
 
     virtual QImage requestImage(const QString& id, QSize* size,
                                 const QSize& requestedSize);
+
+private:
+    /*
+     * A decoded, screen-sized copy of a photo, which previews of edits get
+     * rendered from without going back to the file.
+     */
+    struct Proxy
+    {
+        QString path;
+        QSize requestedSize;
+        QDateTime lastModified;
+        // The QImage::cacheKey() of the edited image it was scaled from, if
+        // the photo is being edited
+        qint64 editedKey;
+        QImage image;
+    };
+
+    static const int MAX_PROXIES;
+
+    QImage proxy(const QString& filePath, const QSize& requestedSize);
+
+    QMutex m_proxiesMutex;
+    QList<Proxy> m_proxies;
 };
 
 #endif // PHOTO_IMAGE_PROVIDER_H_
@@ -106,6 +106,43 @@ PhotoMetadata::PhotoMetadata(const char* filepath)
     m_image->readMetadata();
 }
 
+/*!
+ * \brief PhotoMetadata::PhotoMetadata
+ * Reads the metadata from the contents of the file, which must outlive the
+ * object; save() then writes to them rather than to the file.
+ * \param file
+ * \param data
+ * \param size
+ */
+PhotoMetadata::PhotoMetadata(const QFileInfo& file, const uchar* data, qint64 size)
+    : m_fileSourceInfo(file)
+{
+    m_image = Exiv2::ImageFactory::open(data, size);
+    m_image->readMetadata();
+}
+
+/*!
+ * \brief PhotoMetadata::readKeys
+ * \return false if the metadata could not be read
+ */
+bool PhotoMetadata::readKeys()
+{
+    if (!m_image->good())
+        return false;
+
+    Exiv2::ExifData& exif_data = m_image->exifData();
+    Exiv2::ExifData::const_iterator end = exif_data.end();
+    for (Exiv2::ExifData::const_iterator i = exif_data.begin(); i != end; i++)
+        m_keysPresent.insert(QString(i->key().c_str()));
+
+    Exiv2::XmpData& xmp_data = m_image->xmpData();
+    Exiv2::XmpData::const_iterator end1 = xmp_data.end();
+    for (Exiv2::XmpData::const_iterator i = xmp_data.begin(); i != end1; i++)
+        m_keysPresent.insert(QString(i->key().c_str()));
+
+    return true;
+}
+
 /*!
  * \brief PhotoMetadata::fromFile
  * \param filepath
@@ -117,21 +154,40 @@ PhotoMetadata* PhotoMetadata::fromFile(const char* filepath)
     try {
         result = new PhotoMetadata(filepath);
 
-        if (!result->m_image->good()) {
+        if (!result->readKeys()) {
             qDebug("Invalid image metadata in %s", filepath);
             delete result;
             return NULL;
         }
 
-        Exiv2::ExifData& exif_data = result->m_image->exifData();
-        Exiv2::ExifData::const_iterator end = exif_data.end();
-        for (Exiv2::ExifData::const_iterator i = exif_data.begin(); i != end; i++)
-            result->m_keysPresent.insert(QString(i->key().c_str()));
+        return result;
+    } catch (Exiv2::AnyError& e) {
+        qDebug("Error loading image metadata: %s", e.what());
+        delete result;
+        return NULL;
+    }
+}
 
-        Exiv2::XmpData& xmp_data = result->m_image->xmpData();
-        Exiv2::XmpData::const_iterator end1 = xmp_data.end();
-        for (Exiv2::XmpData::const_iterator i = xmp_data.begin(); i != end1; i++)
-            result->m_keysPresent.insert(QString(i->key().c_str()));
+/*!
+ * \brief PhotoMetadata::fromData
+ * Reads the metadata of a file that is already open, or mapped, without
+ * opening it again.
+ * \param file the file the data comes from
+ * \param data the contents of the file, which must outlive the metadata
+ * \param size
+ * \return
+ */
+PhotoMetadata* PhotoMetadata::fromData(const QFileInfo& file, const uchar* data, qint64 size)
+{
+    PhotoMetadata* result = NULL;
+    try {
+        result = new PhotoMetadata(file, data, size);
+
+        if (!result->readKeys()) {
+            qDebug("Invalid image metadata in %s", qPrintable(file.filePath()));
+            delete result;
+            return NULL;
+        }
 
         return result;
     } catch (Exiv2::AnyError& e) {
@@ -43,6 +43,7 @@ class PhotoMetadata : public QObject
 public:
     static PhotoMetadata* fromFile(const char* filepath);
     static PhotoMetadata* fromFile(const QFileInfo& file);
+    static PhotoMetadata* fromData(const QFileInfo& file, const uchar* data, qint64 size);
 
     QDateTime exposureTime() const;
     Orientation orientation() const;
@@ -58,7 +59,10 @@ public:
 
 private:
     PhotoMetadata(const char* filepath);
-    
+    PhotoMetadata(const QFileInfo& file, const uchar* data, qint64 size);
+
+    bool readKeys();
+
     Exiv2::Image::AutoPtr m_image;
     QSet<QString> m_keysPresent;
     QFileInfo m_fileSourceInfo;
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-pre-enhancer.h"
+#include "file-utils.h"
+#include "photo-cache-store.h"
+#include "photo-caches.h"
+#include "photo-data.h"
+#include "photo-edit-job.h"
+#include "photo-probe-cache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QTemporaryFile>
+#include <QThread>
+
+// Below this percentage, a battery that isn't charging is left alone
+const int PhotoPreEnhancePolicy::MIN_BATTERY_CAPACITY = 30;
+// In degrees Celsius, for any of the thermal zones
+const int PhotoPreEnhancePolicy::MAX_TEMPERATURE = 70;
+
+// Long enough for the user to have settled on what is on screen
+const int PhotoPreEnhancer::DEFAULT_IDLE_INTERVAL = 2000;
+
+namespace {
+const QString POWER_SUPPLY_DIR = "/sys/class/power_supply";
+const QString THERMAL_DIR = "/sys/class/thermal";
+
+// How long to wait before asking the policy again once it said no
+const int POLICY_RETRY_INTERVAL = 30000;
+
+QString readValue(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+} // namespace
+
+/*!
+ * \brief PhotoPreEnhancePolicy::~PhotoPreEnhancePolicy
+ */
+PhotoPreEnhancePolicy::~PhotoPreEnhancePolicy()
+{
+}
+
+/*!
+ * \brief PhotoPreEnhancePolicy::allowsWork
+ * Called on the thread of the PhotoPreEnhancer before each photo.
+ * \return
+ */
+bool PhotoPreEnhancePolicy::allowsWork() const
+{
+    bool charging = false;
+    int capacity = 100;
+    QDir supplies(POWER_SUPPLY_DIR);
+    Q_FOREACH(const QString& name, supplies.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QDir supply(supplies.filePath(name));
+        if (readValue(supply.filePath("type")) == "Battery") {
+            bool ok;
+            int percent = readValue(supply.filePath("capacity")).toInt(&ok);
+            if (ok)
+                capacity = qMin(capacity, percent);
+            QString status = readValue(supply.filePath("status"));
+            if (status == "Charging" || status == "Full")
+                charging = true;
+        } else if (readValue(supply.filePath("online")) == "1") {
+            charging = true;
+        }
+    }
+    if (!charging && capacity < MIN_BATTERY_CAPACITY)
+        return false;
+
+    QDir thermal(THERMAL_DIR);
+    QStringList zones = thermal.entryList(QStringList() << "thermal_zone*", QDir::Dirs);
+    Q_FOREACH(const QString& zone, zones) {
+        // In thousandths of a degree
+        bool ok;
+        int temperature = readValue(thermal.filePath(zone + "/temp")).toInt(&ok);
+        if (ok && temperature >= MAX_TEMPERATURE * 1000)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Enhances one photo on the pool of the pre-enhancer, without getting in
+ * the way of anything else that wants the processor.
+ */
+class PreEnhanceTask : public QRunnable
+{
+public:
+    PreEnhanceTask(PhotoPreEnhancer* enhancer, const QString& path)
+        : m_enhancer(enhancer),
+          m_path(path)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QThread::currentThread()->setPriority(QThread::IdlePriority);
+
+        bool success = false;
+        if (!m_enhancer->isCancelled() && QFileInfo(m_path).isFile())
+            success = m_enhancer->enhance(m_path);
+
+        QMetaObject::invokeMethod(m_enhancer, "finishPhoto", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_path), Q_ARG(bool, success));
+    }
+
+private:
+    PhotoPreEnhancer* m_enhancer;
+    QString m_path;
+};
+
+/*!
+ * \brief PhotoPreEnhancer::PhotoPreEnhancer
+ * \param parent
+ */
+PhotoPreEnhancer::PhotoPreEnhancer(QObject* parent)
+    : QObject(parent),
+      m_next(0),
+      m_running(false),
+      m_enhancing(false),
+      m_idleInterval(DEFAULT_IDLE_INTERVAL),
+      m_policy(new PhotoPreEnhancePolicy()),
+      m_job(0),
+      m_cancelled(0)
+{
+    m_pool.setMaxThreadCount(1);
+    m_idleTimer.setSingleShot(true);
+    connect(&m_idleTimer, SIGNAL(timeout()), this, SLOT(next()));
+}
+
+/*!
+ * \brief PhotoPreEnhancer::~PhotoPreEnhancer
+ * Cancels the photo being enhanced, and waits for it to stop.
+ */
+PhotoPreEnhancer::~PhotoPreEnhancer()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::paths
+ * \return
+ */
+QStringList PhotoPreEnhancer::paths() const
+{
+    return m_paths;
+}
+
+/*!
+ * \brief PhotoPreEnhancer::setPaths
+ * Sets the photos to enhance, those most likely to be opened first. They
+ * replace those not enhanced yet, and the work starts over once the editor
+ * has been idle for idleInterval.
+ * \param paths
+ */
+void PhotoPreEnhancer::setPaths(const QStringList& paths)
+{
+    if (paths == m_paths)
+        return;
+
+    m_paths = paths;
+    m_next = 0;
+    m_cancelled.store(0);
+    Q_EMIT pathsChanged();
+
+    if (m_enhancing)
+        return;
+    if (m_paths.isEmpty()) {
+        m_idleTimer.stop();
+        next();
+        return;
+    }
+    setRunning(true);
+    m_idleTimer.start(m_idleInterval);
+}
+
+/*!
+ * \brief PhotoPreEnhancer::idleInterval
+ * \return
+ */
+int PhotoPreEnhancer::idleInterval() const
+{
+    return m_idleInterval;
+}
+
+/*!
+ * \brief PhotoPreEnhancer::setIdleInterval
+ * \param msecs how long no photo must have been edited before the work
+ * starts
+ */
+void PhotoPreEnhancer::setIdleInterval(int msecs)
+{
+    if (msecs == m_idleInterval)
+        return;
+
+    m_idleInterval = msecs;
+    Q_EMIT idleIntervalChanged();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::running
+ * \return whether some photos are left to enhance, or being enhanced
+ */
+bool PhotoPreEnhancer::running() const
+{
+    return m_running;
+}
+
+/*!
+ * \brief PhotoPreEnhancer::policy
+ * \return
+ */
+PhotoPreEnhancePolicy* PhotoPreEnhancer::policy() const
+{
+    return m_policy.data();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::setPolicy
+ * \param policy taken over by the pre-enhancer, or 0 to always work
+ */
+void PhotoPreEnhancer::setPolicy(PhotoPreEnhancePolicy* policy)
+{
+    m_policy.reset(policy);
+
+    // The new one may allow what the old one didn't
+    if (m_running && !m_enhancing)
+        m_idleTimer.start(m_idleInterval);
+}
+
+/*!
+ * \brief PhotoPreEnhancer::cancel
+ * Leaves the photos not enhanced yet alone. The one being enhanced stops as
+ * soon as possible, and finished() gets emitted once it has.
+ */
+void PhotoPreEnhancer::cancel()
+{
+    m_cancelled.store(1);
+    m_idleTimer.stop();
+
+    {
+        QMutexLocker locker(&m_jobMutex);
+        if (m_job)
+            m_job->cancel();
+    }
+
+    if (!m_enhancing)
+        next();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::next
+ * Starts on the next photo, unless the device is busy with other edits or
+ * the policy says to wait.
+ */
+void PhotoPreEnhancer::next()
+{
+    if (m_enhancing)
+        return;
+
+    if (isCancelled() || m_next >= m_paths.count()) {
+        if (m_running) {
+            setRunning(false);
+            Q_EMIT finished();
+        }
+        return;
+    }
+
+    if (!PhotoEditJob::isIdle()) {
+        m_idleTimer.start(m_idleInterval);
+        return;
+    }
+    if (!m_policy.isNull() && !m_policy->allowsWork()) {
+        m_idleTimer.start(qMax(m_idleInterval, POLICY_RETRY_INTERVAL));
+        return;
+    }
+
+    m_enhancing = true;
+    m_pool.start(new PreEnhanceTask(this, m_paths.at(m_next++)));
+}
+
+/*!
+ * \brief PhotoPreEnhancer::finishPhoto
+ * \param path
+ * \param success
+ */
+void PhotoPreEnhancer::finishPhoto(const QString& path, bool success)
+{
+    m_enhancing = false;
+    if (success)
+        Q_EMIT enhanced(path);
+
+    // The paths may have changed in the meantime
+    if (m_running && m_next == 0 && !isCancelled())
+        m_idleTimer.start(m_idleInterval);
+    else
+        next();
+}
+
+void PhotoPreEnhancer::setRunning(bool running)
+{
+    if (running == m_running)
+        return;
+
+    m_running = running;
+    Q_EMIT runningChanged();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::enhance
+ * Enhances a copy of the photo, made in the store so that keeping the
+ * result takes no other copy, and keeps it under the key of the photo as
+ * it was copied.
+ * \param path
+ * \return true if the enhanced photo is in the store
+ */
+bool PhotoPreEnhancer::enhance(const QString& path)
+{
+    QFileInfo file(path);
+    PhotoProbe probe = PhotoProbeCache::probe(file);
+    if (!probe.canRead)
+        return false;
+
+    QString key = PhotoCaches::enhancedKey(file);
+    if (key.isEmpty())
+        return false;
+    if (!PhotoCacheStore::find(key).isEmpty())
+        return true;
+
+    QString root = PhotoCacheStore::root();
+    QDir().mkpath(root);
+    QTemporaryFile copy(root + "/.pre-enhance-XXXXXX." + file.suffix());
+    QFile source(file.absoluteFilePath());
+    if (!source.open(QIODevice::ReadOnly) || !copy.open() ||
+            !FileUtils::copyContents(source.handle(), copy.handle()))
+        return false;
+    copy.close();
+
+    // The photo may have changed while it was copied
+    if (PhotoCaches::enhancedKey(file) != key)
+        return false;
+
+    Orientation orientation = TOP_LEFT_ORIGIN;
+    if (PhotoData::formatHasOrientation(probe.format))
+        orientation = probe.orientation;
+
+    PhotoEditCommand command;
+    command.type = EDIT_ENHANCE;
+    PhotoEditJob job(QFileInfo(copy.fileName()), probe.format, orientation,
+                     QList<PhotoEditCommand>() << command);
+    setJob(&job);
+    bool edited = !isCancelled() && job.edit();
+    setJob(0);
+
+    return edited && !isCancelled() && !PhotoCacheStore::insert(key, copy.fileName()).isEmpty();
+}
+
+/*!
+ * \brief PhotoPreEnhancer::setJob
+ * Lets the edit of the photo be cancelled while it is being enhanced.
+ * \param job or 0 once done
+ */
+void PhotoPreEnhancer::setJob(PhotoEditJob* job)
+{
+    QMutexLocker locker(&m_jobMutex);
+    m_job = job;
+}
+
+bool PhotoPreEnhancer::isCancelled() const
+{
+    return m_cancelled.load() != 0;
+}
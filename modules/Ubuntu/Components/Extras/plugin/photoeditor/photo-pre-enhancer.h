@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_PRE_ENHANCER_H_
+#define GALLERY_PHOTO_PRE_ENHANCER_H_
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+class PhotoEditJob;
+
+/*!
+ * \brief The PhotoPreEnhancePolicy class
+ *
+ * Decides whether the device can spare the work of enhancing photos nobody
+ * asked for yet. The default one says no on a low battery that isn't being
+ * charged, and while the device runs hot, as the kernel reports them.
+ */
+class PhotoPreEnhancePolicy
+{
+public:
+    static const int MIN_BATTERY_CAPACITY;
+    static const int MAX_TEMPERATURE;
+
+    virtual ~PhotoPreEnhancePolicy();
+
+    virtual bool allowsWork() const;
+};
+
+/*!
+ * \brief The PhotoPreEnhancer class
+ *
+ * Auto-enhances photos ahead of time, while nothing else is being edited,
+ * and keeps the results in the PhotoCacheStore, from where auto-enhancing
+ * the photos for real only takes swapping the file in. The photos, most
+ * likely to be opened first, are enhanced one at a time on a thread of
+ * idle priority.
+ */
+class PhotoPreEnhancer : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QStringList paths READ paths WRITE setPaths NOTIFY pathsChanged)
+    Q_PROPERTY(int idleInterval READ idleInterval WRITE setIdleInterval NOTIFY idleIntervalChanged)
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged)
+
+public:
+    static const int DEFAULT_IDLE_INTERVAL;
+
+    explicit PhotoPreEnhancer(QObject* parent = 0);
+    virtual ~PhotoPreEnhancer();
+
+    QStringList paths() const;
+    void setPaths(const QStringList& paths);
+    int idleInterval() const;
+    void setIdleInterval(int msecs);
+    bool running() const;
+
+    PhotoPreEnhancePolicy* policy() const;
+    void setPolicy(PhotoPreEnhancePolicy* policy);
+
+    Q_INVOKABLE void cancel();
+
+Q_SIGNALS:
+    void pathsChanged();
+    void idleIntervalChanged();
+    void runningChanged();
+
+    void enhanced(const QString& path);
+    void finished();
+
+private Q_SLOTS:
+    void next();
+    void finishPhoto(const QString& path, bool success);
+
+private:
+    friend class PreEnhanceTask;
+
+    void setRunning(bool running);
+
+    // Called by the tasks, from the pool thread
+    bool enhance(const QString& path);
+    void setJob(PhotoEditJob* job);
+    bool isCancelled() const;
+
+    QStringList m_paths;
+    int m_next;
+    bool m_running;
+    bool m_enhancing;
+    int m_idleInterval;
+    QTimer m_idleTimer;
+    QThreadPool m_pool;
+    QScopedPointer<PhotoPreEnhancePolicy> m_policy;
+
+    QMutex m_jobMutex;
+    PhotoEditJob* m_job;
+    QAtomicInt m_cancelled;
+};
+
+#endif // GALLERY_PHOTO_PRE_ENHANCER_H_
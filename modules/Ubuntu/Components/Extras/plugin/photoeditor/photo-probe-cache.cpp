@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-probe-cache.h"
+
+// medialoader
+#include "photo-metadata.h"
+
+#include <QCache>
+#include <QFile>
+#include <QImageReader>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <sys/stat.h>
+
+// Enough for the photos of a gallery view and then some; entries are small
+const int PhotoProbeCache::MAX_ENTRIES = 4096;
+
+namespace {
+struct FileKey
+{
+    FileKey() : inode(0), mtime(0), mtimeNs(0), size(-1) { }
+
+    bool operator==(const FileKey& other) const
+    {
+        return inode == other.inode && mtime == other.mtime &&
+                mtimeNs == other.mtimeNs && size == other.size;
+    }
+
+    bool operator!=(const FileKey& other) const
+    {
+        return !(*this == other);
+    }
+
+    quint64 inode;
+    qint64 mtime;
+    qint64 mtimeNs;
+    qint64 size;
+};
+
+FileKey keyFromStat(const struct stat& info)
+{
+    FileKey key;
+    key.inode = info.st_ino;
+    key.mtime = info.st_mtim.tv_sec;
+    key.mtimeNs = info.st_mtim.tv_nsec;
+    key.size = info.st_size;
+    return key;
+}
+
+struct Entry
+{
+    FileKey key;
+    PhotoProbe probe;
+};
+
+struct Cache
+{
+    Cache() : entries(PhotoProbeCache::MAX_ENTRIES) { }
+
+    QMutex mutex;
+    QCache<QString, Entry> entries;
+};
+
+Cache* cache()
+{
+    static Cache instance;
+    return &instance;
+}
+
+/*
+ * Reads everything through the one open file: the image header through
+ * QImageReader, then the metadata through Exiv2 from a mapping of the file,
+ * which only pages in the parts Exiv2 looks at.
+ */
+PhotoProbe readProbe(const QFileInfo& file, FileKey* key)
+{
+    PhotoProbe probe;
+    QFile device(file.absoluteFilePath());
+    if (!device.open(QIODevice::ReadOnly))
+        return probe;
+
+    struct stat info;
+    if (fstat(device.handle(), &info) != 0)
+        return probe;
+    *key = keyFromStat(info);
+    probe.exists = true;
+
+    QImageReader reader(&device);
+    probe.canRead = reader.canRead();
+    probe.format = QString(reader.format()).toLower();
+    if (probe.format == "jpg") // Why does Qt expose two different names here?
+        probe.format = "jpeg";
+    probe.size = reader.size();
+
+    PhotoMetadata* metadata = 0;
+    uchar* data = device.size() > 0 ? device.map(0, device.size()) : 0;
+    if (data)
+        metadata = PhotoMetadata::fromData(file, data, device.size());
+    else
+        metadata = PhotoMetadata::fromFile(file);
+
+    if (metadata) {
+        probe.hasMetadata = true;
+        probe.orientation = metadata->orientation();
+        delete metadata;
+    }
+    if (data)
+        device.unmap(data);
+
+    return probe;
+}
+} // namespace
+
+/*!
+ * \brief PhotoProbeCache::probe
+ * \param file
+ * \return what the file looks like now, from the cache if it did not change
+ * since it was last probed
+ */
+PhotoProbe PhotoProbeCache::probe(const QFileInfo& file)
+{
+    QString path = file.absoluteFilePath();
+
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        remove(path);
+        return PhotoProbe();
+    }
+
+    {
+        QMutexLocker locker(&cache()->mutex);
+        Entry* entry = cache()->entries.object(path);
+        if (entry && entry->key == keyFromStat(info))
+            return entry->probe;
+    }
+
+    // Probed outside of the lock, so that slow files don't hold up the rest
+    Entry* entry = new Entry;
+    entry->probe = readProbe(file, &entry->key);
+    PhotoProbe result = entry->probe;
+
+    QMutexLocker locker(&cache()->mutex);
+    if (result.exists)
+        cache()->entries.insert(path, entry);
+    else {
+        cache()->entries.remove(path);
+        delete entry;
+    }
+    return result;
+}
+
+/*!
+ * \brief PhotoProbeCache::remove
+ * \param path
+ */
+void PhotoProbeCache::remove(const QString& path)
+{
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+
+    QMutexLocker locker(&cache()->mutex);
+    cache()->entries.remove(absolutePath);
+}
+
+/*!
+ * \brief PhotoProbeCache::clear
+ */
+void PhotoProbeCache::clear()
+{
+    QMutexLocker locker(&cache()->mutex);
+    cache()->entries.clear();
+}
+
+/*!
+ * \brief PhotoProbeCache::count
+ * \return how many files are remembered
+ */
+int PhotoProbeCache::count()
+{
+    QMutexLocker locker(&cache()->mutex);
+    return cache()->entries.count();
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_PROBE_CACHE_H_
+#define GALLERY_PHOTO_PROBE_CACHE_H_
+
+// util
+#include "orientation.h"
+
+#include <QFileInfo>
+#include <QSize>
+#include <QString>
+
+/*!
+ * \brief The PhotoProbe struct
+ *
+ * What can be told about a photo without decoding it.
+ */
+struct PhotoProbe
+{
+    PhotoProbe()
+        : exists(false),
+          canRead(false),
+          hasMetadata(false),
+          orientation(TOP_LEFT_ORIGIN) {
+    }
+
+    bool exists;
+    /// QImageReader can decode the file
+    bool canRead;
+    /// Exiv2 could read the metadata of the file
+    bool hasMetadata;
+    /// In lower case, with "jpg" given as "jpeg"
+    QString format;
+    QSize size;
+    Orientation orientation;
+};
+
+/*!
+ * \brief The PhotoProbeCache class
+ *
+ * Probes photos for their format, size and orientation, opening each file
+ * once for all of them, and remembers the results for as long as the files
+ * stay the same, as far as their inode, modification time and size tell.
+ */
+class PhotoProbeCache
+{
+public:
+    static const int MAX_ENTRIES;
+
+    static PhotoProbe probe(const QFileInfo& file);
+    static void remove(const QString& path);
+    static void clear();
+    static int count();
+};
+
+#endif // GALLERY_PHOTO_PROBE_CACHE_H_
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-validator.h"
+#include "photo-data.h"
+
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThread>
+
+// Few enough for the first results to show up quickly, and enough for the
+// signals not to cost more than looking at the files
+const int PhotoValidator::CHUNK_SIZE = 64;
+
+/*!
+ * \brief The ValidateTask class
+ * Looks at a chunk of the files on a thread of the validator's pool.
+ */
+class ValidateTask : public QRunnable
+{
+public:
+    ValidateTask(PhotoValidator* validator, int generation, const QStringList& paths)
+        : m_validator(validator),
+          m_generation(generation),
+          m_paths(paths)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QStringList valid;
+        QStringList invalid;
+        Q_FOREACH(const QString& path, m_paths) {
+            if (!m_validator->isCurrent(m_generation))
+                return;
+
+            if (PhotoData::isValid(QFileInfo(path)))
+                valid << path;
+            else
+                invalid << path;
+        }
+
+        QMetaObject::invokeMethod(m_validator, "finishChunk", Qt::QueuedConnection,
+                                  Q_ARG(int, m_generation),
+                                  Q_ARG(QStringList, valid),
+                                  Q_ARG(QStringList, invalid));
+    }
+
+private:
+    PhotoValidator* m_validator;
+    int m_generation;
+    QStringList m_paths;
+};
+
+/*!
+ * \brief PhotoValidator::PhotoValidator
+ * \param parent
+ */
+PhotoValidator::PhotoValidator(QObject* parent)
+    : QObject(parent),
+      m_generation(0),
+      m_pendingChunks(0),
+      m_running(false)
+{
+    m_pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+/*!
+ * \brief PhotoValidator::~PhotoValidator
+ */
+PhotoValidator::~PhotoValidator()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+/*!
+ * \brief PhotoValidator::maxThreadCount
+ * \return
+ */
+int PhotoValidator::maxThreadCount() const
+{
+    return m_pool.maxThreadCount();
+}
+
+/*!
+ * \brief PhotoValidator::setMaxThreadCount
+ * \param count how many files to look at at once, as many as there are
+ * cores by default
+ */
+void PhotoValidator::setMaxThreadCount(int count)
+{
+    m_pool.setMaxThreadCount(qMax(1, count));
+}
+
+/*!
+ * \brief PhotoValidator::running
+ * \return
+ */
+bool PhotoValidator::running() const
+{
+    return m_running;
+}
+
+/*!
+ * \brief PhotoValidator::validateMany
+ * Starts looking at the files, leaving aside the ones still being looked at
+ * from an earlier call, if any. validated() gets emitted for every chunk of
+ * them, and finished() once all of them are known.
+ * \param paths
+ */
+void PhotoValidator::validateMany(const QStringList& paths)
+{
+    int generation = m_generation.fetchAndAddOrdered(1) + 1;
+    m_pendingChunks = 0;
+
+    for (int i = 0; i < paths.count(); i += CHUNK_SIZE) {
+        m_pool.start(new ValidateTask(this, generation, paths.mid(i, CHUNK_SIZE)));
+        m_pendingChunks++;
+    }
+
+    bool running = m_pendingChunks > 0;
+    if (running != m_running) {
+        m_running = running;
+        Q_EMIT runningChanged();
+    }
+    if (!running)
+        Q_EMIT finished();
+}
+
+/*!
+ * \brief PhotoValidator::cancel
+ * Drops the results of the files still being looked at; finished() doesn't
+ * get emitted for them.
+ */
+void PhotoValidator::cancel()
+{
+    m_generation.fetchAndAddOrdered(1);
+    m_pendingChunks = 0;
+    if (m_running) {
+        m_running = false;
+        Q_EMIT runningChanged();
+    }
+}
+
+/*!
+ * \brief PhotoValidator::finishChunk
+ * \param generation the call to validateMany() the chunk comes from
+ * \param valid
+ * \param invalid
+ */
+void PhotoValidator::finishChunk(int generation, const QStringList& valid,
+                                 const QStringList& invalid)
+{
+    if (!isCurrent(generation))
+        return;
+
+    Q_EMIT validated(valid, invalid);
+
+    if (--m_pendingChunks == 0) {
+        m_running = false;
+        Q_EMIT runningChanged();
+        Q_EMIT finished();
+    }
+}
+
+/*!
+ * \brief PhotoValidator::isCurrent
+ * \param generation
+ * \return false if the files of that call are not wanted anymore
+ */
+bool PhotoValidator::isCurrent(int generation) const
+{
+    return m_generation.load() == generation;
+}
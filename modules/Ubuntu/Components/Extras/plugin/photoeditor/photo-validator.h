@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_PHOTO_VALIDATOR_H_
+#define GALLERY_PHOTO_VALIDATOR_H_
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+
+/*!
+ * \brief The PhotoValidator class
+ *
+ * Tells which of many files are photos that can be edited, as
+ * PhotoData::isValid() does, looking at several of them at once. The results
+ * come back in chunks as soon as they are known, in no particular order, so
+ * that a view can fill up while a large folder is still being looked at.
+ */
+class PhotoValidator : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged)
+
+public:
+    static const int CHUNK_SIZE;
+
+    explicit PhotoValidator(QObject* parent = 0);
+    virtual ~PhotoValidator();
+
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+
+    bool running() const;
+
+    Q_INVOKABLE void validateMany(const QStringList& paths);
+    Q_INVOKABLE void cancel();
+
+Q_SIGNALS:
+    void runningChanged();
+    void validated(const QStringList& valid, const QStringList& invalid);
+    void finished();
+
+private Q_SLOTS:
+    void finishChunk(int generation, const QStringList& valid,
+                     const QStringList& invalid);
+
+private:
+    friend class ValidateTask;
+
+    // Called by the tasks, from the pool threads
+    bool isCurrent(int generation) const;
+
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+    int m_pendingChunks;
+    bool m_running;
+};
+
+#endif // GALLERY_PHOTO_VALIDATOR_H_
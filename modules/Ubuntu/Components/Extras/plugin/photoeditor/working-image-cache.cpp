@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "working-image-cache.h"
+
+#include <QDateTime>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+// A 24 megapixel photo, or a couple of smaller ones
+const qint64 WorkingImageCache::DEFAULT_BUDGET = 128 * 1024 * 1024;
+
+namespace {
+struct Entry
+{
+    QString path;
+    QDateTime lastModified;
+    qint64 size;
+    bool saved;
+    QImage image;
+};
+
+struct Cache
+{
+    Cache() : budget(WorkingImageCache::DEFAULT_BUDGET) { }
+
+    void evict()
+    {
+        qint64 total = 0;
+        for (int i = 0; i < entries.count(); i++) {
+            total += entries.at(i).image.byteCount();
+            if (total > budget) {
+                while (entries.count() > i)
+                    entries.removeLast();
+                break;
+            }
+        }
+    }
+
+    int indexOf(const QString& path) const
+    {
+        for (int i = 0; i < entries.count(); i++) {
+            if (entries.at(i).path == path)
+                return i;
+        }
+        return -1;
+    }
+
+    QMutex mutex;
+    // Most recently used first
+    QList<Entry> entries;
+    qint64 budget;
+};
+
+Cache* cache()
+{
+    static Cache instance;
+    return &instance;
+}
+
+bool insertEntry(const Entry& entry)
+{
+    QMutexLocker locker(&cache()->mutex);
+    int index = cache()->indexOf(entry.path);
+    if (index >= 0)
+        cache()->entries.removeAt(index);
+
+    if (entry.image.isNull() || entry.image.byteCount() > cache()->budget)
+        return false;
+
+    cache()->entries.prepend(entry);
+    cache()->evict();
+    return true;
+}
+} // namespace
+
+/*!
+ * \brief WorkingImageCache::budget
+ * \return the most memory all the images may take, in bytes
+ */
+qint64 WorkingImageCache::budget()
+{
+    QMutexLocker locker(&cache()->mutex);
+    return cache()->budget;
+}
+
+/*!
+ * \brief WorkingImageCache::setBudget
+ * Drops the least recently used images that don't fit anymore, if any.
+ * \param bytes
+ */
+void WorkingImageCache::setBudget(qint64 bytes)
+{
+    QMutexLocker locker(&cache()->mutex);
+    cache()->budget = qMax((qint64) 0, bytes);
+    cache()->evict();
+}
+
+/*!
+ * \brief WorkingImageCache::cost
+ * \return the memory all the images take, in bytes
+ */
+qint64 WorkingImageCache::cost()
+{
+    QMutexLocker locker(&cache()->mutex);
+    qint64 total = 0;
+    Q_FOREACH(const Entry& entry, cache()->entries)
+        total += entry.image.byteCount();
+    return total;
+}
+
+/*!
+ * \brief WorkingImageCache::insert
+ * Keeps the pixels of the file as it is now, replacing the ones kept for it
+ * before, if any.
+ * \param file
+ * \param image the pixels with the orientation of the file applied
+ * \return false if the image is null or alone over budget, in which case
+ * nothing is kept for the file
+ */
+bool WorkingImageCache::insert(const QFileInfo& file, const QImage& image)
+{
+    QFileInfo current(file.absoluteFilePath());
+    if (!current.exists()) {
+        remove(current.absoluteFilePath());
+        return false;
+    }
+
+    Entry entry;
+    entry.path = current.absoluteFilePath();
+    entry.lastModified = current.lastModified();
+    entry.size = current.size();
+    entry.saved = true;
+    entry.image = image;
+    return insertEntry(entry);
+}
+
+/*!
+ * \brief WorkingImageCache::insertUnsaved
+ * Keeps the pixels of a file that is about to be replaced with them. They
+ * are handed out whatever the file looks like until insert() gets called
+ * for it once it is saved, or until they are removed if that failed.
+ * \param path
+ * \param image the pixels with the orientation of the file applied
+ * \return false if the image is null or alone over budget, in which case
+ * nothing is kept for the file
+ */
+bool WorkingImageCache::insertUnsaved(const QString& path, const QImage& image)
+{
+    Entry entry;
+    entry.path = QFileInfo(path).absoluteFilePath();
+    entry.size = -1;
+    entry.saved = false;
+    entry.image = image;
+    return insertEntry(entry);
+}
+
+/*!
+ * \brief WorkingImageCache::find
+ * \param path
+ * \return the pixels kept for the file, or a null image if there are none or
+ * the file changed since
+ */
+QImage WorkingImageCache::find(const QString& path)
+{
+    QFileInfo current(path);
+
+    QMutexLocker locker(&cache()->mutex);
+    int index = cache()->indexOf(current.absoluteFilePath());
+    if (index < 0)
+        return QImage();
+
+    const Entry& entry = cache()->entries.at(index);
+    if (entry.saved && (entry.lastModified != current.lastModified() ||
+                        entry.size != current.size())) {
+        cache()->entries.removeAt(index);
+        return QImage();
+    }
+
+    cache()->entries.move(index, 0);
+    return cache()->entries.first().image;
+}
+
+/*!
+ * \brief WorkingImageCache::remove
+ * \param path
+ */
+void WorkingImageCache::remove(const QString& path)
+{
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+
+    QMutexLocker locker(&cache()->mutex);
+    int index = cache()->indexOf(absolutePath);
+    if (index >= 0)
+        cache()->entries.removeAt(index);
+}
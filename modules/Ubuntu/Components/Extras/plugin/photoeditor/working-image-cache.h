@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GALLERY_WORKING_IMAGE_CACHE_H_
+#define GALLERY_WORKING_IMAGE_CACHE_H_
+
+#include <QFileInfo>
+#include <QImage>
+#include <QString>
+
+/*!
+ * \brief The WorkingImageCache class
+ *
+ * Keeps the decoded pixels of the photos being edited, with their
+ * orientation already applied, so that successive edits and the images shown
+ * after them don't each decode the file again.
+ *
+ * An image is only handed out while its file is the one it was decoded from
+ * or saved to, as far as the modification time and size tell; files changed
+ * behind the cache's back, like on undo, are decoded again; images that are
+ * still being saved are handed out until then. All the images
+ * together stay within a memory budget, the least recently used going first.
+ */
+class WorkingImageCache
+{
+public:
+    static const qint64 DEFAULT_BUDGET;
+
+    static qint64 budget();
+    static void setBudget(qint64 bytes);
+    static qint64 cost();
+
+    static bool insert(const QFileInfo& file, const QImage& image);
+    static bool insertUnsaved(const QString& path, const QImage& image);
+    static QImage find(const QString& path);
+    static void remove(const QString& path);
+};
+
+#endif // GALLERY_WORKING_IMAGE_CACHE_H_
@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "color-lut.h"
+#include "imaging.h"
+#include "jpeg-lossless-editor.h"
+#include "jpeg-strip-editor.h"
+#include "photo-edit-pipeline.h"
+#include "photo-image-provider.h"
+#include "photo-metadata.h"
+
+#include <QBuffer>
+#include <QColor>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QTemporaryDir>
+#include <QTest>
+
+/*
+ * Times the photo editor on generated photos of common camera resolutions as
+ * well as on the test assets. Run it through "make benchmark", or pass it the
+ * usual QTest options, like -csv or -xml, to keep the results.
+ */
+class PhotoEditorBenchmark: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+
+    void benchmarkHistogram_data();
+    void benchmarkHistogram();
+    void benchmarkEnhanceAnalysis_data();
+    void benchmarkEnhanceAnalysis();
+    void benchmarkEnhanceReference_data();
+    void benchmarkEnhanceReference();
+    void benchmarkEnhanceScanLine_data();
+    void benchmarkEnhanceScanLine();
+    void benchmarkEnhanceLut_data();
+    void benchmarkEnhanceLut();
+    void benchmarkEnhance_data();
+    void benchmarkEnhance();
+    void benchmarkExposure_data();
+    void benchmarkExposure();
+    void benchmarkCropRotate_data();
+    void benchmarkCropRotate();
+    void benchmarkJpegLossless_data();
+    void benchmarkJpegLossless();
+    void benchmarkJpegStrips_data();
+    void benchmarkJpegStrips();
+    void benchmarkMetadata_data();
+    void benchmarkMetadata();
+    void benchmarkImageProvider_data();
+    void benchmarkImageProvider();
+
+private:
+    void addInputs();
+    const QImage& decoded(const QString& path);
+    QImage applyPipeline(const QImage& image, const QList<PhotoEditCommand>& commands);
+
+    QTemporaryDir m_workingDir;
+    QString m_decodedPath;
+    QImage m_decoded;
+};
+
+namespace {
+struct GeneratedInput
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+// 2, 12, 24 and 48 megapixels
+const GeneratedInput GENERATED_INPUTS[] = {
+    { "generated_2mp.jpg", 1632, 1224 },
+    { "generated_12mp.jpg", 4000, 3000 },
+    { "generated_24mp.jpg", 6000, 4000 },
+    { "generated_48mp.jpg", 8000, 6000 }
+};
+
+/*
+ * Gradients with some noise over them, which compress about as well as
+ * photos do.
+ */
+QImage generateImage(int width, int height)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    quint32 seed = 1;
+    for (int j = 0; j < height; j++) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(j));
+        for (int i = 0; i < width; i++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 32 - 16;
+            line[i] = qRgb(qBound(0, i * 255 / width + noise, 255),
+                           qBound(0, j * 255 / height + noise, 255),
+                           qBound(0, (i + j) * 255 / (width + height) - noise, 255));
+        }
+    }
+    return image;
+}
+
+PhotoEditCommand crop(qreal x, qreal y, qreal width, qreal height)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_CROP;
+    command.crop_rectangle = QRectF(x, y, width, height);
+    return command;
+}
+
+PhotoEditCommand rotate(Orientation orientation)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ROTATE;
+    command.orientation = orientation;
+    return command;
+}
+
+PhotoEditCommand exposure(qreal value)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_COMPENSATE_EXPOSURE;
+    command.exposureCompensation = value;
+    return command;
+}
+
+PhotoEditCommand enhance()
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ENHANCE;
+    return command;
+}
+
+/*
+ * How auto-enhance was applied before it worked a scanline at a time, to
+ * compare with.
+ */
+QImage enhanceReference(const AutoEnhanceTransformation& enhance, const QImage& image)
+{
+    QImage result(image.size(), image.format());
+    for (int j = 0; j < image.height(); j++) {
+        for (int i = 0; i < image.width(); i++) {
+            QColor px = enhance.transformPixel(QColor(image.pixel(i, j)));
+            result.setPixel(i, j, px.rgb());
+        }
+    }
+    return result;
+}
+} // namespace
+
+void PhotoEditorBenchmark::initTestCase()
+{
+    QDir rc = QDir(":/assets/");
+    QDir dest = QDir(m_workingDir.path());
+    QStringList filters;
+    filters << "*.jpg";
+    Q_FOREACH(const QString &name, rc.entryList(filters))
+    {
+        QFile::copy(rc.absoluteFilePath(name), dest.absoluteFilePath(name));
+        QFile::setPermissions(dest.absoluteFilePath(name),
+                              QFile::WriteOwner | QFile::ReadOwner);
+    }
+
+    for (unsigned int i = 0; i < sizeof(GENERATED_INPUTS) / sizeof(GENERATED_INPUTS[0]); i++) {
+        const GeneratedInput& input = GENERATED_INPUTS[i];
+        QImage image = generateImage(input.width, input.height);
+        QVERIFY(image.save(dest.absoluteFilePath(input.name), "jpeg", 90));
+    }
+}
+
+void PhotoEditorBenchmark::addInputs()
+{
+    QTest::addColumn<QString>("path");
+
+    QDir dir(m_workingDir.path());
+    QStringList filters;
+    filters << "*.jpg";
+    Q_FOREACH(const QString &name, dir.entryList(filters))
+        QTest::newRow(name.toUtf8().constData()) << dir.absoluteFilePath(name);
+}
+
+/*
+ * The larger inputs take a while to decode, so the last one decoded is kept
+ * around for the next benchmark.
+ */
+const QImage& PhotoEditorBenchmark::decoded(const QString& path)
+{
+    if (path != m_decodedPath) {
+        m_decoded = QImage();
+        m_decoded.load(path);
+        m_decoded = m_decoded.convertToFormat(scanLineFormat(m_decoded));
+        m_decodedPath = path;
+    }
+    return m_decoded;
+}
+
+QImage PhotoEditorBenchmark::applyPipeline(const QImage& image,
+                                           const QList<PhotoEditCommand>& commands)
+{
+    PhotoEditPipeline pipeline;
+    pipeline.append(commands);
+    return pipeline.apply(image);
+}
+
+void PhotoEditorBenchmark::benchmarkHistogram_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkHistogram()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+
+    QBENCHMARK {
+        IntensityHistogram histogram(image);
+        Q_UNUSED(histogram);
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceAnalysis_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceAnalysis()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+
+    // With the stride the editor uses
+    QBENCHMARK {
+        AutoEnhanceTransformation enhance(image, qMax(1, image.width() / 400));
+        Q_UNUSED(enhance);
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceReference_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceReference()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+    AutoEnhanceTransformation enhance(image, qMax(1, image.width() / 400));
+
+    QBENCHMARK {
+        enhanceReference(enhance, image);
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceScanLine_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceScanLine()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+    AutoEnhanceTransformation enhance(image, qMax(1, image.width() / 400));
+
+    QBENCHMARK {
+        QImage result(image.size(), image.format());
+        for (int j = 0; j < image.height(); j++) {
+            enhance.transformScanLine(
+                        reinterpret_cast<const QRgb*>(image.constScanLine(j)),
+                        reinterpret_cast<QRgb*>(result.scanLine(j)),
+                        image.width());
+        }
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceLut_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkEnhanceLut()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+    AutoEnhanceTransformation enhance(image, qMax(1, image.width() / 400));
+    ColorLut lut = enhance.compileLut();
+
+    QBENCHMARK {
+        QImage result = image;
+        lut.apply(result);
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkEnhance_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkEnhance()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+
+    QBENCHMARK {
+        applyPipeline(image, QList<PhotoEditCommand>() << enhance());
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkExposure_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkExposure()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+
+    QBENCHMARK {
+        applyPipeline(image, QList<PhotoEditCommand>() << exposure(0.25));
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkCropRotate_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkCropRotate()
+{
+    QFETCH(QString, path);
+    const QImage& image = decoded(path);
+
+    QBENCHMARK {
+        applyPipeline(image, QList<PhotoEditCommand>() << crop(0.1, 0.1, 0.8, 0.8)
+                      << rotate(RIGHT_TOP_ORIGIN));
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkJpegLossless_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkJpegLossless()
+{
+    QFETCH(QString, path);
+
+    PhotoEditCommand command = crop(0.1, 0.1, 0.8, 0.8);
+    command.snapCropToBlocks = true;
+    PhotoEditPipeline pipeline;
+    pipeline.append(command);
+    pipeline.append(rotate(RIGHT_TOP_ORIGIN));
+
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(JpegLosslessEditor::apply(path, &buffer, pipeline));
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkJpegStrips_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkJpegStrips()
+{
+    QFETCH(QString, path);
+
+    PhotoEditPipeline pipeline;
+    pipeline.append(exposure(0.25));
+
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(JpegStripEditor::apply(path, &buffer, pipeline));
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkMetadata_data()
+{
+    addInputs();
+}
+
+void PhotoEditorBenchmark::benchmarkMetadata()
+{
+    QFETCH(QString, path);
+
+    // What the editor does after saving the edited pixels, on a copy
+    QString copyPath = QDir(m_workingDir.path()).absoluteFilePath("metadata.jpeg");
+    QFile::remove(copyPath);
+    QVERIFY(QFile::copy(path, copyPath));
+    QFile::setPermissions(copyPath, QFile::WriteOwner | QFile::ReadOwner);
+    QImage thumbnail = decoded(path).scaled(160, 160, Qt::KeepAspectRatio);
+
+    QBENCHMARK {
+        PhotoMetadata* original = PhotoMetadata::fromFile(QFileInfo(path));
+        PhotoMetadata* copy = PhotoMetadata::fromFile(QFileInfo(copyPath));
+        QVERIFY(original && copy);
+        original->copyTo(copy);
+        copy->setOrientation(TOP_LEFT_ORIGIN);
+        copy->updateThumbnail(thumbnail);
+        QVERIFY(copy->save());
+        delete original;
+        delete copy;
+    }
+
+    QFile::remove(copyPath);
+}
+
+void PhotoEditorBenchmark::benchmarkImageProvider_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QSize>("requestedSize");
+
+    QList<QPair<QString, QSize> > sizes;
+    sizes << qMakePair(QString("full"), QSize())
+          << qMakePair(QString("1920"), QSize(1920, 1920))
+          << qMakePair(QString("480"), QSize(480, 480))
+          << qMakePair(QString("128"), QSize(128, 128));
+
+    QDir dir(m_workingDir.path());
+    QStringList filters;
+    filters << "*.jpg";
+    Q_FOREACH(const QString &name, dir.entryList(filters)) {
+        for (int i = 0; i < sizes.count(); i++) {
+            QString tag = name + "@" + sizes.at(i).first;
+            QTest::newRow(tag.toUtf8().constData()) << dir.absoluteFilePath(name)
+                                                    << sizes.at(i).second;
+        }
+    }
+}
+
+void PhotoEditorBenchmark::benchmarkImageProvider()
+{
+    QFETCH(QString, path);
+    QFETCH(QSize, requestedSize);
+
+    PhotoImageProvider provider;
+    QBENCHMARK {
+        QImage image = provider.requestImage(path, 0, requestedSize);
+        QVERIFY(!image.isNull());
+    }
+}
+
+QTEST_MAIN(PhotoEditorBenchmark)
+
+#include "bench_PhotoEditor.moc"
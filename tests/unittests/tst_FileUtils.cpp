@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-utils.h"
+
+#include <QDir>
+#include <QFile>
+#include <QJSEngine>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+class FileUtilsTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+
+    void testCopy();
+    void testCopyOver();
+    void testRename();
+    void testSnapshot();
+    void testAsync();
+
+private:
+    QByteArray contents(const QString& path);
+    QString write(const QString& name, const QByteArray& contents);
+
+    QTemporaryDir m_workingDir;
+    QByteArray m_large;
+};
+
+void FileUtilsTest::initTestCase()
+{
+    // Several chunks and a bit, whichever way it gets copied
+    m_large.resize(5 * 1024 * 1024 + 123);
+    for (int i = 0; i < m_large.size(); i++)
+        m_large[i] = (char) (i * 31 + i / 4096);
+}
+
+QByteArray FileUtilsTest::contents(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+QString FileUtilsTest::write(const QString& name, const QByteArray& contents)
+{
+    QString path = QDir(m_workingDir.path()).absoluteFilePath(name);
+    QFile file(path);
+    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    file.write(contents);
+    return path;
+}
+
+void FileUtilsTest::testCopy()
+{
+    FileUtils utils;
+    QString source = write("copy-source", m_large);
+    QFile::setPermissions(source, QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup);
+    QString destination = QDir(m_workingDir.path()).absoluteFilePath("copy-destination");
+
+    QVERIFY(utils.copy(source, destination));
+    QVERIFY(contents(destination) == m_large);
+    QCOMPARE(QFile::permissions(destination), QFile::permissions(source));
+
+    // Empty files too
+    QString empty = write("copy-empty", QByteArray());
+    QVERIFY(utils.copy(empty, destination));
+    QCOMPARE(QFileInfo(destination).size(), (qint64) 0);
+
+    QVERIFY(!utils.copy(source + "-missing", destination));
+    QVERIFY(!utils.copy(m_workingDir.path(), destination));
+}
+
+void FileUtilsTest::testCopyOver()
+{
+    FileUtils utils;
+    QString source = write("over-source", QByteArray("short"));
+    QString destination = write("over-destination", m_large);
+    QFile::setPermissions(destination, QFile::ReadOwner | QFile::WriteOwner);
+    QFile::Permissions permissions = QFile::permissions(destination);
+
+    QVERIFY(utils.copy(source, destination));
+    QCOMPARE(contents(destination), QByteArray("short"));
+    QCOMPARE(QFile::permissions(destination), permissions);
+
+    QVERIFY(utils.copy(write("over-source", m_large), destination));
+    QVERIFY(contents(destination) == m_large);
+}
+
+void FileUtilsTest::testRename()
+{
+    FileUtils utils;
+    QString source = write("rename-source", m_large);
+    QString destination = QDir(m_workingDir.path()).absoluteFilePath("rename-destination");
+
+    QVERIFY(utils.rename(source, destination));
+    QVERIFY(!QFile::exists(source));
+    QVERIFY(contents(destination) == m_large);
+
+    // Over an existing file, which keeps its permissions
+    source = write("rename-source", QByteArray("short"));
+    QFile::setPermissions(destination, QFile::ReadOwner | QFile::WriteOwner);
+    QFile::Permissions permissions = QFile::permissions(destination);
+    QVERIFY(utils.rename(source, destination));
+    QVERIFY(!QFile::exists(source));
+    QCOMPARE(contents(destination), QByteArray("short"));
+    QCOMPARE(QFile::permissions(destination), permissions);
+
+    QVERIFY(!utils.rename(source, destination));
+}
+
+void FileUtilsTest::testSnapshot()
+{
+    FileUtils utils;
+    QString source = write("snapshot-source", m_large);
+    QString snapshot = QDir(m_workingDir.path()).absoluteFilePath("snapshot");
+
+    QVERIFY(utils.snapshot(source, snapshot));
+    QVERIFY(contents(snapshot) == m_large);
+    QVERIFY(utils.copy(snapshot, source));
+    QVERIFY(contents(source) == m_large);
+
+    // The snapshot stays as it was whichever way the file gets rewritten
+    QVERIFY(utils.copy(write("snapshot-other", QByteArray("copied")), source));
+    QCOMPARE(contents(source), QByteArray("copied"));
+    QVERIFY(contents(snapshot) == m_large);
+
+    QVERIFY(utils.snapshot(source, snapshot));
+    QCOMPARE(contents(snapshot), QByteArray("copied"));
+    QVERIFY(utils.rename(write("snapshot-other", QByteArray("renamed")), source));
+    QCOMPARE(contents(source), QByteArray("renamed"));
+    QCOMPARE(contents(snapshot), QByteArray("copied"));
+
+    // And the other way around
+    QVERIFY(utils.snapshot(source, snapshot));
+    QVERIFY(utils.copy(write("snapshot-other", m_large), snapshot));
+    QCOMPARE(contents(source), QByteArray("renamed"));
+
+    // Even writing into the file in place leaves the snapshot alone
+    QVERIFY(utils.snapshot(source, snapshot));
+    QFile file(source);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    file.write("R");
+    file.close();
+    QCOMPARE(contents(source), QByteArray("Renamed"));
+    QCOMPARE(contents(snapshot), QByteArray("renamed"));
+
+    QVERIFY(!utils.snapshot(source + "-missing", snapshot));
+}
+
+void FileUtilsTest::testAsync()
+{
+    FileUtils utils;
+    QSignalSpy finished(&utils, SIGNAL(operationFinished(int, QVariant)));
+    QSignalSpy busy(&utils, SIGNAL(busyChanged()));
+    QString source = write("async-source", m_large);
+    QString copied = QDir(m_workingDir.path()).absoluteFilePath("async-copy");
+    QString renamed = QDir(m_workingDir.path()).absoluteFilePath("async-renamed");
+
+    // Each operation waits for the ones started before it
+    int copy = utils.copyAsync(source, copied);
+    int rename = utils.renameAsync(copied, renamed);
+    QVERIFY(copy != rename);
+    QVERIFY(utils.busy());
+    QTRY_COMPARE(finished.count(), 2);
+    QVERIFY(!utils.busy());
+    QCOMPARE(busy.count(), 2);
+    QCOMPARE(finished.at(0).at(0).toInt(), copy);
+    QVERIFY(qvariant_cast<QVariant>(finished.at(0).at(1)).toBool());
+    QCOMPARE(finished.at(1).at(0).toInt(), rename);
+    QVERIFY(qvariant_cast<QVariant>(finished.at(1).at(1)).toBool());
+    QVERIFY(!QFile::exists(copied));
+    QVERIFY(contents(renamed) == m_large);
+
+    // The callbacks get the results
+    QJSEngine engine;
+    QJSValue results = engine.newArray();
+    engine.globalObject().setProperty("results", results);
+    QJSValue callback = engine.evaluate("(function(result) { results.push(result); })");
+    QVERIFY(callback.isCallable());
+
+    utils.removeAsync(renamed, callback);
+    utils.removeAsync(renamed, callback);
+    utils.createTemporaryDirectoryAsync(
+                QDir(m_workingDir.path()).absoluteFilePath("async-XXXXXX"), callback);
+    QTRY_COMPARE(results.property("length").toInt(), 3);
+    QCOMPARE(results.property(0).toBool(), true);
+    QCOMPARE(results.property(1).toBool(), false);
+    QString directory = results.property(2).toString();
+    QVERIFY(QFileInfo(directory).isDir());
+
+    utils.removeDirectoryAsync(directory, false, callback);
+    QTRY_COMPARE(results.property("length").toInt(), 4);
+    QCOMPARE(results.property(3).toBool(), true);
+    QVERIFY(!QFileInfo::exists(directory));
+}
+
+QTEST_MAIN(FileUtilsTest)
+
+#include "tst_FileUtils.moc"
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "photo-batch-editor.h"
+#include "photo-cache-store.h"
+#include "photo-caches.h"
+#include "photo-data.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+class PhotoEditorBatchTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+
+    void testRotate();
+    void testMemoryBudget();
+    void testFailures();
+    void testCancel();
+
+private:
+    QStringList copies(const QString& name, int count);
+
+    QTemporaryDir m_workingDir;
+    QTemporaryDir m_storeDir;
+};
+
+void PhotoEditorBatchTest::initTestCase()
+{
+    QDir rc = QDir(":/assets/");
+    QDir dest = QDir(m_workingDir.path());
+    Q_FOREACH(const QString &name, rc.entryList())
+    {
+        QFile::copy(rc.absoluteFilePath(name), dest.absoluteFilePath(name));
+        QFile::setPermissions(dest.absoluteFilePath(name),
+                              QFile::WriteOwner | QFile::ReadOwner);
+    }
+    PhotoCacheStore::setRoot(m_storeDir.path());
+}
+
+QStringList PhotoEditorBatchTest::copies(const QString& name, int count)
+{
+    QDir dir(m_workingDir.path());
+    QStringList paths;
+    for (int i = 0; i < count; i++) {
+        QString path = dir.absoluteFilePath(QString("batch%1-%2").arg(i).arg(name));
+        QFile::remove(path);
+        QFile::copy(dir.absoluteFilePath(name), path);
+        paths << path;
+    }
+    return paths;
+}
+
+void PhotoEditorBatchTest::testRotate()
+{
+    QStringList paths = copies("windmill.jpg", 6);
+
+    PhotoBatchEditor batch;
+    batch.setPaths(paths);
+    QSignalSpy finished(&batch, SIGNAL(finished()));
+    QSignalSpy files(&batch, SIGNAL(fileFinished(QString, bool)));
+
+    QVERIFY(batch.rotateRight());
+    QVERIFY(batch.running());
+    QVERIFY(!batch.autoEnhance());
+
+    QVERIFY(finished.wait(10000));
+    QVERIFY(!batch.running());
+    QCOMPARE(files.count(), paths.count());
+    QCOMPARE(batch.completedCount(), paths.count());
+    QCOMPARE(batch.failedCount(), 0);
+    QCOMPARE(batch.progress(), 1.0);
+
+    QFile pristine(QDir(m_workingDir.path()).absoluteFilePath("windmill.jpg"));
+    QVERIFY(pristine.open(QIODevice::ReadOnly));
+    QByteArray contents = pristine.readAll();
+    Q_FOREACH(const QString& path, paths) {
+        PhotoData photo;
+        photo.setPath(path);
+        QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+
+        // The photos can be reverted, as when edited one at a time
+        QFileInfo original = PhotoCaches(QFileInfo(path)).originalFile();
+        QVERIFY(!original.filePath().isEmpty());
+        QFile file(original.absoluteFilePath());
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QVERIFY(file.readAll() == contents);
+    }
+
+    // Each photo turns from its own orientation
+    QVERIFY(batch.rotateRight());
+    QVERIFY(finished.wait(10000));
+    Q_FOREACH(const QString& path, paths) {
+        PhotoData photo;
+        photo.setPath(path);
+        QVERIFY(photo.orientation() == BOTTOM_RIGHT_ORIGIN);
+
+        // And still to the photo from before the first batch
+        QFile file(PhotoCaches(QFileInfo(path)).originalFile().absoluteFilePath());
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QVERIFY(file.readAll() == contents);
+    }
+}
+
+void PhotoEditorBatchTest::testMemoryBudget()
+{
+    QStringList paths = copies("windmill.jpg", 4);
+
+    // Room for a single photo at a time, however many threads
+    PhotoBatchEditor batch;
+    batch.setPaths(paths);
+    batch.setMaxThreadCount(4);
+    batch.setMemoryBudget(QFileInfo(paths.first()).size());
+    QSignalSpy started(&batch, SIGNAL(fileStarted(QString)));
+    QSignalSpy finished(&batch, SIGNAL(finished()));
+
+    QVERIFY(batch.autoEnhance());
+    QCOMPARE(started.count(), 1);
+    QVERIFY(finished.wait(10000));
+    QCOMPARE(started.count(), paths.count());
+    QCOMPARE(batch.completedCount(), paths.count());
+
+    // And for all of them at once
+    started.clear();
+    batch.setMemoryBudget(PhotoBatchEditor::DEFAULT_MEMORY_BUDGET);
+    QVERIFY(batch.autoEnhance());
+    QCOMPARE(started.count(), paths.count());
+    QVERIFY(finished.wait(10000));
+}
+
+void PhotoEditorBatchTest::testFailures()
+{
+    QStringList paths = copies("windmill.jpg", 2);
+    paths.insert(1, QDir(m_workingDir.path()).absoluteFilePath("missing.jpg"));
+
+    PhotoBatchEditor batch;
+    batch.setPaths(paths);
+    QSignalSpy files(&batch, SIGNAL(fileFinished(QString, bool)));
+    QSignalSpy finished(&batch, SIGNAL(finished()));
+
+    QVERIFY(batch.exposureCompensation(0.2));
+    QVERIFY(finished.wait(10000));
+    QCOMPARE(batch.completedCount(), 2);
+    QCOMPARE(batch.failedCount(), 1);
+
+    Q_FOREACH(const QList<QVariant>& file, files) {
+        bool missing = file.at(0).toString() == paths.at(1);
+        QCOMPARE(file.at(1).toBool(), !missing);
+    }
+}
+
+void PhotoEditorBatchTest::testCancel()
+{
+    QStringList paths = copies("testfile.jpg", 8);
+
+    PhotoBatchEditor batch;
+    batch.setPaths(paths);
+    batch.setMaxThreadCount(1);
+    QSignalSpy finished(&batch, SIGNAL(finished()));
+
+    // The photos that weren't edited yet are left alone
+    QVERIFY(batch.autoEnhance());
+    batch.cancel();
+    QVERIFY(finished.wait(10000));
+    QVERIFY(!batch.running());
+    QVERIFY(batch.completedCount() < paths.count());
+    QCOMPARE(batch.completedCount() + batch.failedCount(), paths.count());
+
+    QFile original(QDir(m_workingDir.path()).absoluteFilePath("testfile.jpg"));
+    QVERIFY(original.open(QIODevice::ReadOnly));
+    QFile last(paths.last());
+    QVERIFY(last.open(QIODevice::ReadOnly));
+    QVERIFY(last.readAll() == original.readAll());
+}
+
+QTEST_MAIN(PhotoEditorBatchTest)
+
+#include "tst_PhotoEditorBatch.moc"
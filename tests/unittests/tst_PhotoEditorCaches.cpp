@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-existence-cache.h"
+#include "photo-cache-store.h"
+#include "photo-caches.h"
+#include "photo-edit-job.h"
+#include "photo-pre-enhancer.h"
+#include "photo-probe-cache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+namespace {
+class FixedPolicy : public PhotoPreEnhancePolicy
+{
+public:
+    explicit FixedPolicy(bool allows) : m_allows(allows) { }
+
+    bool allowsWork() const Q_DECL_OVERRIDE { return m_allows; }
+
+private:
+    bool m_allows;
+};
+} // namespace
+
+class PhotoCachesTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void testKeys();
+    void testEviction();
+    void testOriginals();
+    void testMigration();
+    void testExistenceCache();
+    void testPreEnhance();
+
+private:
+    QByteArray contents(const QString& path);
+    QString write(const QString& name, const QByteArray& contents);
+
+    QTemporaryDir* m_photosDir;
+    QTemporaryDir* m_storeDir;
+};
+
+void PhotoCachesTest::init()
+{
+    m_photosDir = new QTemporaryDir();
+    m_storeDir = new QTemporaryDir();
+    PhotoCacheStore::setRoot(m_storeDir->path());
+    PhotoCacheStore::setBudget(PhotoCacheStore::DEFAULT_BUDGET);
+}
+
+void PhotoCachesTest::cleanup()
+{
+    delete m_photosDir;
+    delete m_storeDir;
+}
+
+QByteArray PhotoCachesTest::contents(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+QString PhotoCachesTest::write(const QString& name, const QByteArray& contents)
+{
+    QString path = QDir(m_photosDir->path()).absoluteFilePath(name);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file(path);
+    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    file.write(contents);
+    return path;
+}
+
+void PhotoCachesTest::testKeys()
+{
+    QString first = write("first.jpg", QByteArray(1000, 'a'));
+    QString same = write("same.jpg", QByteArray(1000, 'a'));
+    QString other = write("other.jpg", QByteArray(1000, 'b'));
+
+    QString key = PhotoCacheStore::contentKey(first);
+    QVERIFY(!key.isEmpty());
+    QCOMPARE(PhotoCacheStore::contentKey(same), key);
+    QVERIFY(PhotoCacheStore::contentKey(other) != key);
+    QVERIFY(PhotoCacheStore::key(key, "enhance") != PhotoCacheStore::key(key, "original"));
+
+    // The same contents are only kept once
+    QString kept = PhotoCacheStore::insert(PhotoCacheStore::key(key, "enhance"), same);
+    QVERIFY(!kept.isEmpty());
+    QVERIFY(kept.startsWith(m_storeDir->path()));
+    QCOMPARE(PhotoCacheStore::find(PhotoCacheStore::key(PhotoCacheStore::contentKey(first),
+                                                        "enhance")), kept);
+    QCOMPARE(PhotoCacheStore::count(), 1);
+    QCOMPARE(PhotoCacheStore::size(), (qint64)1000);
+
+    // A changed file gets a new key
+    write("first.jpg", QByteArray(1000, 'c'));
+    QVERIFY(PhotoCacheStore::contentKey(first) != key);
+
+    // And the index outlives the process
+    PhotoCacheStore::setRoot(m_storeDir->path());
+    QCOMPARE(PhotoCacheStore::count(), 1);
+    QCOMPARE(PhotoCacheStore::find(PhotoCacheStore::key(key, "enhance")), kept);
+}
+
+void PhotoCachesTest::testEviction()
+{
+    PhotoCacheStore::setBudget(3000);
+
+    QString photo = write("photo.jpg", QByteArray(2000, 'p'));
+    QString original = PhotoCacheStore::keepOriginal(photo);
+    QVERIFY(!original.isEmpty());
+
+    QStringList keys;
+    for (int i = 0; i < 3; i++) {
+        QString file = write(QString("enhanced%1.jpg").arg(i), QByteArray(600, 'e' + i));
+        keys << PhotoCacheStore::key(PhotoCacheStore::contentKey(file), "enhance");
+        QVERIFY(!PhotoCacheStore::insert(keys.last(), file).isEmpty());
+        QTest::qWait(5);
+    }
+
+    // The least recently used made room, not the original
+    QVERIFY(PhotoCacheStore::size() <= 3000);
+    QVERIFY(PhotoCacheStore::find(keys.at(0)).isEmpty());
+    QVERIFY(!PhotoCacheStore::find(keys.at(2)).isEmpty());
+    QCOMPARE(PhotoCacheStore::original(photo), original);
+
+    // Even over budget, the original of an existing photo stays
+    PhotoCacheStore::setBudget(100);
+    PhotoCacheStore::evict();
+    QCOMPARE(PhotoCacheStore::count(), 1);
+    QCOMPARE(PhotoCacheStore::original(photo), original);
+
+    // A photo that is gone may only be away for a while
+    QFile::remove(photo);
+    PhotoCacheStore::evict();
+    QCOMPARE(PhotoCacheStore::count(), 1);
+    QCOMPARE(PhotoCacheStore::original(photo), original);
+
+    // Until its original gets discarded
+    PhotoCacheStore::discardOriginal(photo);
+    QCOMPARE(PhotoCacheStore::count(), 0);
+    QCOMPARE(PhotoCacheStore::size(), (qint64)0);
+    QVERIFY(!QFileInfo::exists(original));
+}
+
+void PhotoCachesTest::testOriginals()
+{
+    QByteArray pristine(1500, 'o');
+    QString photo = write("edited.jpg", pristine);
+    PhotoCaches caches((QFileInfo(photo)));
+    QVERIFY(!caches.hasCachedOriginal());
+    QCOMPARE(caches.pristineFile().absoluteFilePath(), QFileInfo(photo).absoluteFilePath());
+
+    QVERIFY(caches.cacheOriginal());
+    QVERIFY(caches.hasCachedOriginal());
+    QVERIFY(QFileInfo::exists(photo));
+
+    // Photos get replaced when edited, which leaves the original as it was
+    QString edited = write("edited.jpg.new", QByteArray(1200, 'x'));
+    QVERIFY(QFile::remove(photo));
+    QVERIFY(QFile::rename(edited, photo));
+    QCOMPARE(contents(caches.originalFile().absoluteFilePath()), pristine);
+
+    QVERIFY(caches.cacheEnhancedFromOriginal());
+    QVERIFY(caches.hasCachedEnhanced());
+
+    QVERIFY(caches.restoreOriginal());
+    QCOMPARE(contents(photo), pristine);
+    QVERIFY(!caches.hasCachedOriginal());
+    QCOMPARE(PhotoCacheStore::count(), 0);
+}
+
+void PhotoCachesTest::testMigration()
+{
+    QByteArray pristine(800, 'm');
+    QString photo = write("migrated.jpg", QByteArray(700, 'n'));
+    QString legacy = write(".original/migrated.jpg", pristine);
+    write(".enhanced/migrated.jpg", QByteArray(800, 'h'));
+    // Left behind by a photo that is gone
+    write(".enhanced/gone.jpg", QByteArray(800, 'g'));
+
+    PhotoCaches::migrate(m_photosDir->path());
+
+    PhotoCaches caches((QFileInfo(photo)));
+    QVERIFY(caches.hasCachedOriginal());
+    QCOMPARE(contents(caches.originalFile().absoluteFilePath()), pristine);
+    QVERIFY(caches.hasCachedEnhanced());
+    QCOMPARE(contents(caches.enhancedFile().absoluteFilePath()), QByteArray(800, 'h'));
+
+    QVERIFY(!QFileInfo::exists(legacy));
+    QVERIFY(!QFileInfo::exists(QDir(m_photosDir->path()).filePath(PhotoCaches::ORIGINAL_DIR)));
+    QVERIFY(!QFileInfo::exists(QDir(m_photosDir->path()).filePath(PhotoCaches::ENHANCED_DIR)));
+
+    // Looking for the files leaves the hidden directories alone
+    QString other = write("other.jpg", QByteArray(700, 'q'));
+    QString otherLegacy = write(".original/other.jpg", pristine);
+    QVERIFY(!PhotoCaches(QFileInfo(other)).hasCachedOriginal());
+    QVERIFY(QFileInfo::exists(otherLegacy));
+
+    // Until the directory is migrated again
+    PhotoCaches::migrate(m_photosDir->path());
+    QVERIFY(PhotoCaches(QFileInfo(other)).hasCachedOriginal());
+    QVERIFY(!QFileInfo::exists(QDir(m_photosDir->path()).filePath(PhotoCaches::ORIGINAL_DIR)));
+}
+
+void PhotoCachesTest::testExistenceCache()
+{
+    QDir directory(m_photosDir->path());
+    QString path = directory.filePath("watched.jpg");
+    QVERIFY(!FileExistenceCache::exists(path));
+    QTRY_VERIFY(FileExistenceCache::isWatched(directory.path()));
+    QVERIFY(!FileExistenceCache::exists(path));
+
+    // Changes made behind its back get noticed
+    write("watched.jpg", QByteArray(100, 'w'));
+    QTRY_VERIFY(FileExistenceCache::exists(path));
+    QFile::remove(path);
+    QTRY_VERIFY(!FileExistenceCache::exists(path));
+
+    // Missing directories are known to be missing until they get created
+    QString nested = directory.filePath(PhotoCaches::ORIGINAL_DIR + "/watched.jpg");
+    QVERIFY(!FileExistenceCache::exists(nested));
+    QTRY_VERIFY(FileExistenceCache::isWatched(directory.filePath(PhotoCaches::ORIGINAL_DIR)));
+    QVERIFY(!FileExistenceCache::exists(nested));
+    write(PhotoCaches::ORIGINAL_DIR + "/watched.jpg", QByteArray(100, 'w'));
+    QTRY_VERIFY(FileExistenceCache::exists(nested));
+
+    // Changes made by this process are seen right away once invalidated
+    QTRY_VERIFY(FileExistenceCache::isWatched(directory.filePath(PhotoCaches::ORIGINAL_DIR)));
+    QVERIFY(FileExistenceCache::exists(nested));
+    QFile::remove(nested);
+    FileExistenceCache::invalidate(nested);
+    QVERIFY(!FileExistenceCache::exists(nested));
+
+    // What work gets thrown away on is confirmed on the disk, before the
+    // watcher has a say
+    write(PhotoCaches::ORIGINAL_DIR + "/watched.jpg", QByteArray(100, 'w'));
+    QTRY_VERIFY(FileExistenceCache::exists(nested));
+    QVERIFY(FileExistenceCache::confirm(nested));
+    QFile::remove(nested);
+    QVERIFY(!FileExistenceCache::confirm(nested));
+    QVERIFY(!FileExistenceCache::exists(nested));
+
+    // Like an original removed from the store behind its back
+    QString photo = write("confirmed.jpg", QByteArray(300, 'c'));
+    QString original = PhotoCacheStore::keepOriginal(photo);
+    QVERIFY(!original.isEmpty());
+    QTRY_VERIFY(FileExistenceCache::isWatched(QFileInfo(original).absolutePath()));
+    QVERIFY(QFile::remove(original));
+    QVERIFY(PhotoCaches(QFileInfo(photo)).cacheOriginal());
+    QVERIFY(QFileInfo::exists(PhotoCaches(QFileInfo(photo)).originalFile().absoluteFilePath()));
+}
+
+void PhotoCachesTest::testPreEnhance()
+{
+    QString photo = QDir(m_photosDir->path()).absoluteFilePath("enhance.jpg");
+    QVERIFY(QFile::copy(":/assets/windmill.jpg", photo));
+    QFile::setPermissions(photo, QFile::WriteOwner | QFile::ReadOwner);
+
+    PhotoPreEnhancer enhancer;
+    enhancer.setIdleInterval(0);
+    enhancer.setPolicy(new FixedPolicy(false));
+    QSignalSpy finished(&enhancer, SIGNAL(finished()));
+    QSignalSpy enhanced(&enhancer, SIGNAL(enhanced(QString)));
+
+    // Nothing gets done while the policy says no
+    enhancer.setPaths(QStringList() << photo);
+    QTest::qWait(100);
+    QVERIFY(enhancer.running());
+    QCOMPARE(finished.count(), 0);
+    QVERIFY(PhotoCaches::enhancedVersion(QFileInfo(photo)).isEmpty());
+
+    enhancer.setPolicy(new FixedPolicy(true));
+    QTRY_COMPARE(finished.count(), 1);
+    QVERIFY(!enhancer.running());
+    QCOMPARE(enhanced.count(), 1);
+    QString cached = PhotoCaches::enhancedVersion(QFileInfo(photo));
+    QVERIFY(!cached.isEmpty());
+    QVERIFY(contents(cached) != contents(photo));
+
+    // Auto enhancing the photo then swaps the cached result in
+    QByteArray expected = contents(cached);
+    PhotoProbe probe = PhotoProbeCache::probe(QFileInfo(photo));
+    PhotoEditCommand command;
+    command.type = EDIT_ENHANCE;
+    PhotoEditJob job(QFileInfo(photo), probe.format, probe.orientation,
+                     QList<PhotoEditCommand>() << command);
+    QVERIFY(job.edit());
+    QCOMPARE(contents(photo), expected);
+}
+
+QTEST_MAIN(PhotoCachesTest);
+
+#include "tst_PhotoEditorCaches.moc"
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "band-executor.h"
+#include "color-lut.h"
+#include "imaging.h"
+
+#include <QAtomicInt>
+#include <QColor>
+#include <QDir>
+#include <QImage>
+#include <QTest>
+#include <QThread>
+#include <QVector>
+
+Q_DECLARE_METATYPE(QImage::Format)
+
+class PhotoEditorImagingTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void cleanup();
+
+    void testBandExecutor_data();
+    void testBandExecutor();
+    void testHistogram_data();
+    void testHistogram();
+    void testEnhanceScanLine_data();
+    void testEnhanceScanLine();
+    void testEnhanceLut_data();
+    void testEnhanceLut();
+    void testLutFolded();
+    void testExposure_data();
+    void testExposure();
+    void testExposureLinearLight();
+
+private:
+    void addAssets();
+    QImage loadAsset(const QString& name);
+    QImage enhanceReference(const AutoEnhanceTransformation& enhance,
+                            const QImage& image);
+    QImage enhanceScanLine(const AutoEnhanceTransformation& enhance,
+                           const QImage& image);
+};
+
+void PhotoEditorImagingTest::addAssets()
+{
+    QTest::addColumn<QString>("asset");
+
+    QStringList filters;
+    filters << "*.jpg";
+    Q_FOREACH(const QString &name, QDir(":/assets/").entryList(filters))
+        QTest::newRow(name.toUtf8().constData()) << name;
+}
+
+QImage PhotoEditorImagingTest::loadAsset(const QString& name)
+{
+    QImage image(QDir(":/assets/").absoluteFilePath(name));
+    return image.convertToFormat(scanLineFormat(image));
+}
+
+QImage PhotoEditorImagingTest::enhanceReference(
+        const AutoEnhanceTransformation& enhance, const QImage& image)
+{
+    QImage result(image.size(), image.format());
+    for (int j = 0; j < image.height(); j++) {
+        for (int i = 0; i < image.width(); i++) {
+            QColor px = enhance.transformPixel(QColor(image.pixel(i, j)));
+            result.setPixel(i, j, px.rgb());
+        }
+    }
+    return result;
+}
+
+QImage PhotoEditorImagingTest::enhanceScanLine(
+        const AutoEnhanceTransformation& enhance, const QImage& image)
+{
+    QImage result(image.size(), image.format());
+    for (int j = 0; j < image.height(); j++) {
+        enhance.transformScanLine(
+                    reinterpret_cast<const QRgb*>(image.constScanLine(j)),
+                    reinterpret_cast<QRgb*>(result.scanLine(j)),
+                    image.width());
+    }
+    return result;
+}
+
+void PhotoEditorImagingTest::cleanup()
+{
+    BandExecutor::setMaxThreadCount(QThread::idealThreadCount());
+}
+
+void PhotoEditorImagingTest::testBandExecutor_data()
+{
+    QTest::addColumn<int>("threads");
+    QTest::addColumn<int>("height");
+
+    QTest::newRow("serial") << 1 << 1000;
+    QTest::newRow("2 threads") << 2 << 1000;
+    QTest::newRow("8 threads") << 8 << 1000;
+    QTest::newRow("8 threads, odd height") << 8 << 1021;
+    QTest::newRow("8 threads, single band") << 8 << BandExecutor::MIN_BAND_HEIGHT;
+}
+
+void PhotoEditorImagingTest::testBandExecutor()
+{
+    QFETCH(int, threads);
+    QFETCH(int, height);
+
+    BandExecutor::setMaxThreadCount(threads);
+
+    QVector<QAtomicInt> visits(height);
+    QAtomicInt* counters = visits.data();
+    BandExecutor::run(height, [=](int first, int last) {
+        for (int j = first; j < last; j++)
+            counters[j].ref();
+    });
+
+    for (int j = 0; j < height; j++)
+        QCOMPARE(visits[j].load(), 1);
+
+    // The result of the enhancement must not depend on how it got split
+    QImage image = loadAsset("thorns.jpg");
+    AutoEnhanceTransformation enhance(image);
+    BandExecutor::setMaxThreadCount(1);
+    AutoEnhanceTransformation serial(image);
+
+    QImage expected = enhanceScanLine(serial, image);
+    QVERIFY(enhanceScanLine(enhance, image) == expected);
+}
+
+void PhotoEditorImagingTest::testHistogram_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<int>("stride");
+
+    QTest::newRow("RGB32") << (int) QImage::Format_RGB32 << 1;
+    QTest::newRow("RGB32, stride 3") << (int) QImage::Format_RGB32 << 3;
+    QTest::newRow("ARGB32") << (int) QImage::Format_ARGB32 << 1;
+    QTest::newRow("ARGB32 premultiplied") << (int) QImage::Format_ARGB32_Premultiplied << 1;
+    QTest::newRow("RGB888, stride 2") << (int) QImage::Format_RGB888 << 2;
+    QTest::newRow("Indexed8") << (int) QImage::Format_Indexed8 << 1;
+}
+
+void PhotoEditorImagingTest::testHistogram()
+{
+    QFETCH(int, format);
+    QFETCH(int, stride);
+
+    QImage image = loadAsset("windmill.jpg").convertToFormat((QImage::Format) format);
+
+    int counts[256] = { 0 };
+    int total = 0;
+    for (int j = 0; j < image.height(); j += stride) {
+        for (int i = 0; i < image.width(); i += stride) {
+            counts[QColor(image.pixel(i, j)).value()]++;
+            total++;
+        }
+    }
+
+    IntensityHistogram histogram(image, stride);
+    float accumulator = 0.0f;
+    for (int i = 0; i < 256; i++) {
+        accumulator += ((float) counts[i]) / ((float) total);
+        QCOMPARE(histogram.getCumulativeProbability(i), accumulator);
+    }
+}
+
+void PhotoEditorImagingTest::testEnhanceScanLine_data()
+{
+    addAssets();
+}
+
+void PhotoEditorImagingTest::testEnhanceScanLine()
+{
+    QFETCH(QString, asset);
+
+    QImage image = loadAsset(asset);
+    QVERIFY(!image.isNull());
+
+    AutoEnhanceTransformation enhance(image.scaledToWidth(400));
+    QImage reference = enhanceReference(enhance, image);
+    QImage result = enhanceScanLine(enhance, image);
+
+    int maxDifference = 0;
+    for (int j = 0; j < image.height(); j++) {
+        const QRgb* expected = reinterpret_cast<const QRgb*>(reference.constScanLine(j));
+        const QRgb* actual = reinterpret_cast<const QRgb*>(result.constScanLine(j));
+        for (int i = 0; i < image.width(); i++) {
+            maxDifference = qMax(maxDifference, qAbs(qRed(expected[i]) - qRed(actual[i])));
+            maxDifference = qMax(maxDifference, qAbs(qGreen(expected[i]) - qGreen(actual[i])));
+            maxDifference = qMax(maxDifference, qAbs(qBlue(expected[i]) - qBlue(actual[i])));
+        }
+    }
+    QVERIFY(maxDifference <= 1);
+}
+
+void PhotoEditorImagingTest::testEnhanceLut_data()
+{
+    addAssets();
+}
+
+void PhotoEditorImagingTest::testEnhanceLut()
+{
+    QFETCH(QString, asset);
+
+    QImage image = loadAsset(asset);
+    QVERIFY(!image.isNull());
+
+    AutoEnhanceTransformation enhance(image.scaledToWidth(400));
+    QImage reference = enhanceScanLine(enhance, image);
+    QImage result = image;
+    enhance.compileLut().apply(result);
+    QCOMPARE(result.format(), reference.format());
+
+    // The reference itself quantizes hue to whole degrees, so the table can
+    // only approximate it. Keep it close on average and never far off.
+    qint64 totalDifference = 0;
+    int maxDifference = 0;
+    for (int j = 0; j < image.height(); j++) {
+        const QRgb* expected = reinterpret_cast<const QRgb*>(reference.constScanLine(j));
+        const QRgb* actual = reinterpret_cast<const QRgb*>(result.constScanLine(j));
+        for (int i = 0; i < image.width(); i++) {
+            int difference = qMax(qAbs(qRed(expected[i]) - qRed(actual[i])),
+                                  qMax(qAbs(qGreen(expected[i]) - qGreen(actual[i])),
+                                       qAbs(qBlue(expected[i]) - qBlue(actual[i]))));
+            totalDifference += difference;
+            maxDifference = qMax(maxDifference, difference);
+        }
+    }
+    double meanDifference = ((double) totalDifference) /
+            ((double) image.width() * image.height());
+    QVERIFY2(meanDifference < 1.0, qPrintable(QString::number(meanDifference)));
+    QVERIFY2(maxDifference <= 8, qPrintable(QString::number(maxDifference)));
+}
+
+void PhotoEditorImagingTest::testLutFolded()
+{
+    ColorLut::Function invert = [](QRgb pixel) {
+        return qRgb(255 - qRed(pixel), 255 - qGreen(pixel), 255 - qBlue(pixel));
+    };
+    ColorLut::Function halve = [](QRgb pixel) {
+        return qRgb(qRed(pixel) / 2, qGreen(pixel) / 2, qBlue(pixel) / 2);
+    };
+
+    QVERIFY(ColorLut().isNull());
+    QCOMPARE(ColorLut().map(qRgba(1, 2, 3, 4)), qRgba(1, 2, 3, 4));
+
+    // Both functions are linear, so the tables reproduce them exactly
+    ColorLut lut = ColorLut::compile(invert);
+    QCOMPARE(lut.gridSize(), ColorLut::DEFAULT_GRID_SIZE);
+    QCOMPARE(lut.map(qRgba(10, 100, 200, 50)), qRgba(245, 155, 55, 50));
+
+    ColorLut folded = lut.folded(halve);
+    ColorLut composed = ColorLut::compile([=](QRgb pixel) {
+        return halve(invert(pixel));
+    });
+    for (int value = 0; value < 256; value += 5) {
+        QRgb pixel = qRgb(value, 255 - value, value / 3);
+        QCOMPARE(folded.map(pixel), composed.map(pixel));
+    }
+}
+
+void PhotoEditorImagingTest::testExposure_data()
+{
+    QTest::addColumn<QImage::Format>("format");
+
+    QTest::newRow("RGB32") << QImage::Format_RGB32;
+    QTest::newRow("ARGB32") << QImage::Format_ARGB32;
+    QTest::newRow("ARGB32_Premultiplied") << QImage::Format_ARGB32_Premultiplied;
+    QTest::newRow("RGB888") << QImage::Format_RGB888;
+    QTest::newRow("RGB16") << QImage::Format_RGB16;
+}
+
+void PhotoEditorImagingTest::testExposure()
+{
+    QFETCH(QImage::Format, format);
+
+    QImage source(64, 64, QImage::Format_ARGB32);
+    for (int j = 0; j < source.height(); j++) {
+        for (int i = 0; i < source.width(); i++)
+            source.setPixel(i, j, qRgba(i * 4, j * 4, 255 - i * 4, (i + j) * 2));
+    }
+    source = source.convertToFormat(format);
+    const QImage original = source;
+
+    ExposureTransformation exposure(0.25);
+    QImage image = source;
+    exposure.apply(image);
+
+    // Edited in place, without touching the copy it shared its pixels with
+    QVERIFY(source == original);
+    if (ExposureTransformation::transformsInPlace(format))
+        QCOMPARE(image.format(), format);
+
+    QImage expected = original.convertToFormat(QImage::Format_ARGB32);
+    QImage result = image.convertToFormat(QImage::Format_ARGB32);
+    for (int j = 0; j < expected.height(); j++) {
+        for (int i = 0; i < expected.width(); i++) {
+            QRgb before = expected.pixel(i, j);
+            QRgb after = result.pixel(i, j);
+            QCOMPARE(qAlpha(after), qAlpha(before));
+            if (qAlpha(before) == 0)
+                continue;
+
+            // Premultiplied pixels lose precision as alpha goes down
+            int tolerance = 0;
+            if (format == QImage::Format_ARGB32_Premultiplied)
+                tolerance = 255 / qAlpha(before) + 1;
+            QVERIFY(qAbs(qRed(after) - qMin(255, qRed(before) + 63)) <= tolerance);
+            QVERIFY(qAbs(qGreen(after) - qMin(255, qGreen(before) + 63)) <= tolerance);
+            QVERIFY(qAbs(qBlue(after) - qMin(255, qBlue(before) + 63)) <= tolerance);
+        }
+    }
+}
+
+void PhotoEditorImagingTest::testExposureLinearLight()
+{
+    ExposureTransformation none(0.0, ExposureTransformation::LINEAR_LIGHT_CURVE);
+    QVERIFY(none.isIdentity());
+
+    ExposureTransformation brighter(1.0, ExposureTransformation::LINEAR_LIGHT_CURVE);
+    QVERIFY(!brighter.isIdentity());
+    QCOMPARE(brighter.remapValue(0), 0);
+    QCOMPARE(brighter.remapValue(255), 255);
+    // Middle grey, 18% of the light, becomes 36%
+    QCOMPARE(brighter.remapValue(118), 162);
+    for (int value = 1; value < 256; value++)
+        QVERIFY(brighter.remapValue(value) >= brighter.remapValue(value - 1));
+
+    // One stop up and one down gets back where it started, but for the
+    // highlights that got clipped
+    ExposureTransformation darker(-1.0, ExposureTransformation::LINEAR_LIGHT_CURVE);
+    ExposureTransformation both = darker.followedBy(brighter);
+    for (int value = 0; value < 256; value++)
+        QVERIFY(qAbs(both.remapValue(value) - value) <= 2);
+}
+
+QTEST_MAIN(PhotoEditorImagingTest)
+
+#include "tst_PhotoEditorImaging.moc"
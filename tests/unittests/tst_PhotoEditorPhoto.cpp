@@ -15,6 +15,11 @@
  */
 
 #include "photo-data.h"
+#include "photo-edit-history.h"
+#include "photo-edit-job.h"
+#include "photo-probe-cache.h"
+#include "photo-validator.h"
+#include "working-image-cache.h"
 
 #include <QColor>
 #include <QDebug>
@@ -33,8 +38,19 @@ private Q_SLOTS:
 
     void testBasicProperties();
     void testOrientation();
+    void testProbe();
+    void testIsValid();
+    void testValidateMany();
     void testRefresh();
     void testRotate();
+    void testQueuedEdits();
+    void testQueuedExposures();
+    void testCancelOnDestruction();
+    void testWorkingImage();
+    void testSaving();
+    void testHistory();
+    void testHistorySavedInBackground();
+    void testHistoryRotationsWithoutExif();
     void testCrop();
     void testCropWithExifOrientation();
 
@@ -95,6 +111,123 @@ void PhotoEditorPhotoTest::testOrientation()
     QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
 }
 
+void PhotoEditorPhotoTest::testProbe()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testprobe.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill_rotated_90.jpg"), path);
+    PhotoProbeCache::clear();
+
+    PhotoProbe probe = PhotoProbeCache::probe(QFileInfo(path));
+    QVERIFY(probe.exists);
+    QVERIFY(probe.canRead);
+    QVERIFY(probe.hasMetadata);
+    QCOMPARE(probe.format, QString("jpeg"));
+    QCOMPARE(probe.size, QImageReader(path).size());
+    QVERIFY(probe.orientation == RIGHT_TOP_ORIGIN);
+    QCOMPARE(PhotoProbeCache::count(), 1);
+
+    // Opening the photo uses the probe made already
+    PhotoData photo;
+    photo.setPath(path);
+    QVERIFY(photo.fileFormat() == "jpeg");
+    QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+    QCOMPARE(PhotoProbeCache::count(), 1);
+
+    // A different file under the same name gets probed again
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("croptest.png"), path);
+    probe = PhotoProbeCache::probe(QFileInfo(path));
+    QCOMPARE(probe.format, QString("png"));
+    QVERIFY(probe.orientation == TOP_LEFT_ORIGIN);
+
+    QFile::remove(path);
+    QVERIFY(!PhotoProbeCache::probe(QFileInfo(path)).exists);
+    QVERIFY(!PhotoData::isValid(QFileInfo(path)));
+    QCOMPARE(PhotoProbeCache::count(), 0);
+}
+
+void PhotoEditorPhotoTest::testIsValid()
+{
+    QDir source = QDir(m_workingDir.path());
+    QVERIFY(PhotoData::isValid(QFileInfo(source.absoluteFilePath("windmill.jpg"))));
+    QVERIFY(PhotoData::isValid(QFileInfo(source.absoluteFilePath("croptest.png"))));
+    QVERIFY(!PhotoData::isValid(QFileInfo(source.absoluteFilePath("missing.jpg"))));
+
+    // The contents tell the format, not the name
+    QString path = source.absoluteFilePath("testvalid.png");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill.jpg"), path);
+    QVERIFY(PhotoData::isValid(QFileInfo(path)));
+
+    QFile text(source.absoluteFilePath("testvalid.jpg"));
+    QVERIFY(text.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    text.write("Not a photo");
+    text.close();
+    QVERIFY(!PhotoData::isValid(QFileInfo(text.fileName())));
+
+    // Starting like a photo is not enough
+    QFile corrupt(source.absoluteFilePath("testcorrupt.jpg"));
+    QVERIFY(corrupt.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    corrupt.write(QByteArray("\xff\xd8\xff", 3) + QByteArray(1024, 'x'));
+    corrupt.close();
+    QVERIFY(!PhotoData::isValid(QFileInfo(corrupt.fileName())));
+
+    // Raw files look like TIFFs
+    QFile raw(source.absoluteFilePath("testvalid.cr2"));
+    QVERIFY(raw.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    raw.write(QByteArray("II*\0", 4) + QByteArray(1024, 0));
+    raw.close();
+    QVERIFY(!PhotoData::isValid(QFileInfo(raw.fileName())));
+}
+
+void PhotoEditorPhotoTest::testValidateMany()
+{
+    QDir source = QDir(m_workingDir.path());
+    QStringList photos;
+    QStringList others;
+    for (int i = 0; i < PhotoValidator::CHUNK_SIZE * 2; i++) {
+        photos << source.absoluteFilePath("windmill.jpg");
+        others << source.absoluteFilePath(QString("missing%1.jpg").arg(i));
+    }
+
+    PhotoValidator validator;
+    QSignalSpy validated(&validator, SIGNAL(validated(QStringList, QStringList)));
+    QSignalSpy finished(&validator, SIGNAL(finished()));
+
+    validator.validateMany(photos + others);
+    QVERIFY(validator.running());
+    QVERIFY(finished.wait(5000));
+    QVERIFY(!validator.running());
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(validated.count(), 4);
+
+    QStringList valid;
+    QStringList invalid;
+    Q_FOREACH(const QList<QVariant>& chunk, validated) {
+        valid << chunk.at(0).toStringList();
+        invalid << chunk.at(1).toStringList();
+    }
+    QCOMPARE(valid.count(), photos.count());
+    invalid.sort();
+    others.sort();
+    QCOMPARE(invalid, others);
+
+    // Nothing comes back from a cancelled call
+    validated.clear();
+    finished.clear();
+    validator.validateMany(photos);
+    validator.cancel();
+    QVERIFY(!validator.running());
+    QVERIFY(!finished.wait(500));
+    QCOMPARE(validated.count(), 0);
+
+    validator.validateMany(QStringList());
+    QCOMPARE(finished.count(), 1);
+}
+
 void PhotoEditorPhotoTest::testRefresh()
 {
     // Work on a copy to avoid disturbing other tests
@@ -154,6 +287,403 @@ void PhotoEditorPhotoTest::testRotate()
     QVERIFY(photo.orientation() == TOP_LEFT_ORIGIN);
 }
 
+void PhotoEditorPhotoTest::testQueuedEdits()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testqueue.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill.jpg"), path);
+
+    PhotoData photo;
+    photo.setPath(path);
+    QVERIFY(photo.orientation() == TOP_LEFT_ORIGIN);
+    QCOMPARE(photo.pendingCount(), 0);
+
+    QSignalSpy spy(&photo, SIGNAL(editFinished()));
+
+    // The first rotation starts right away, the others wait for it and turn
+    // into a single one
+    photo.rotateRight();
+    QVERIFY(photo.busy());
+    QCOMPARE(photo.pendingCount(), 1);
+    for (int i = 0; i < 5; i++)
+        photo.rotateRight();
+    QCOMPARE(photo.pendingCount(), 2);
+
+    // Three more make a full turn, which leaves nothing to do
+    for (int i = 0; i < 3; i++)
+        photo.rotateRight();
+    QCOMPARE(photo.pendingCount(), 1);
+
+    QVERIFY(spy.wait(5000));
+    QCOMPARE(spy.count(), 1);
+    QVERIFY(!photo.busy());
+    QCOMPARE(photo.pendingCount(), 0);
+    QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+
+    // Successive exposure compensations make a single one
+    spy.clear();
+    photo.rotateRight();
+    photo.exposureCompensation(0.5);
+    photo.exposureCompensation(0.1);
+    QCOMPARE(photo.pendingCount(), 2);
+    photo.rotateRight();
+    QCOMPARE(photo.pendingCount(), 3);
+
+    QVERIFY(spy.wait(5000));
+    QCOMPARE(photo.pendingCount(), 0);
+
+    // Three turns in all, saved into the pixels along with the exposure
+    QVERIFY(photo.orientation() == TOP_LEFT_ORIGIN);
+    QImageReader reader(path);
+    QCOMPARE(reader.size(), QSize(267, 400));
+}
+
+void PhotoEditorPhotoTest::testQueuedExposures()
+{
+    // Work on copies to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString queued = source.absoluteFilePath("testexposures.png");
+    QString single = source.absoluteFilePath("testexposure.png");
+    QFile::remove(queued);
+    QFile::remove(single);
+    QFile::copy(source.absoluteFilePath("croptest.png"), queued);
+    QFile::copy(source.absoluteFilePath("croptest.png"), single);
+
+    // The compensations queued while an edit is in flight add up
+    PhotoData photo;
+    photo.setPath(queued);
+    QSignalSpy spy(&photo, SIGNAL(editFinished()));
+    photo.rotateRight();
+    QVERIFY(photo.busy());
+    photo.exposureCompensation(0.25);
+    photo.exposureCompensation(0.125);
+    photo.exposureCompensation(-0.0625);
+    QCOMPARE(photo.pendingCount(), 2);
+    QVERIFY(spy.wait(5000));
+    QCOMPARE(photo.pendingCount(), 0);
+
+    PhotoData reference;
+    reference.setPath(single);
+    QSignalSpy referenceSpy(&reference, SIGNAL(editFinished()));
+    reference.rotateRight();
+    reference.exposureCompensation(0.3125);
+    QCOMPARE(reference.pendingCount(), 2);
+    QVERIFY(referenceSpy.wait(5000));
+
+    QImage result(queued);
+    QImage expected(single);
+    QVERIFY(!expected.isNull());
+    QVERIFY(result == expected);
+}
+
+void PhotoEditorPhotoTest::testCancelOnDestruction()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testcancel.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("testfile.jpg"), path);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray before = file.readAll();
+    file.close();
+
+    // Going away cancels the edit, without waiting for it
+    PhotoData* photo = new PhotoData();
+    photo->setPath(path);
+    photo->autoEnhance();
+    QVERIFY(photo->busy());
+    delete photo;
+
+    QVERIFY(PhotoEditJob::waitForAll(5000));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == before);
+}
+
+void PhotoEditorPhotoTest::testWorkingImage()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testworking.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill.jpg"), path);
+
+    PhotoData* photo = new PhotoData();
+    photo->setPath(path);
+    QSignalSpy spy(photo, SIGNAL(editFinished()));
+
+    // Rotating through the metadata doesn't need the pixels
+    photo->rotateRight();
+    QVERIFY(spy.wait(5000));
+    QVERIFY(WorkingImageCache::find(path).isNull());
+
+    // Editing them keeps them, upright, for the next edit
+    photo->exposureCompensation(0.1);
+    QVERIFY(spy.wait(5000));
+    QImage working = WorkingImageCache::find(path);
+    QCOMPARE(working.size(), QSize(267, 400));
+
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    QImage saved = reader.read().convertToFormat(working.format());
+    QCOMPARE(saved.size(), working.size());
+    qint64 difference = 0;
+    for (int j = 0; j < saved.height(); j++) {
+        for (int i = 0; i < saved.width(); i++)
+            difference += qAbs(qGray(saved.pixel(i, j)) - qGray(working.pixel(i, j)));
+    }
+    QVERIFY(difference < 4 * saved.width() * saved.height());
+
+    // And keeps them up to date when the file gets edited without them
+    photo->rotateRight();
+    QVERIFY(spy.wait(5000));
+    QVERIFY(photo->orientation() == RIGHT_TOP_ORIGIN);
+    QCOMPARE(WorkingImageCache::find(path).size(), QSize(400, 267));
+
+    // A file changed behind the photo's back has to be decoded again
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill_rotated_90.jpg"), path);
+    QVERIFY(WorkingImageCache::find(path).isNull());
+
+    // Over budget, nothing gets kept
+    qint64 budget = WorkingImageCache::budget();
+    WorkingImageCache::setBudget(1024);
+    photo->refreshFromDisk();
+    photo->exposureCompensation(0.1);
+    QVERIFY(spy.wait(5000));
+    QVERIFY(WorkingImageCache::find(path).isNull());
+    WorkingImageCache::setBudget(budget);
+
+    photo->exposureCompensation(0.1);
+    QVERIFY(spy.wait(5000));
+    QVERIFY(!WorkingImageCache::find(path).isNull());
+
+    // The pixels go with the photo
+    delete photo;
+    QVERIFY(WorkingImageCache::find(path).isNull());
+}
+
+void PhotoEditorPhotoTest::testSaving()
+{
+    // Work on a copy, in a directory of its own, to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QDir dir(source.absoluteFilePath("saving"));
+    QVERIFY(source.mkpath("saving"));
+    QString path = dir.absoluteFilePath("testsaving.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill.jpg"), path);
+    QFile::setPermissions(path, QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup);
+    QFile::Permissions permissions = QFile::permissions(path);
+
+    PhotoData photo;
+    photo.setPath(path);
+    QSignalSpy ready(&photo, SIGNAL(resultReady()));
+    QSignalSpy finished(&photo, SIGNAL(editFinished()));
+
+    // The result shows before it is saved
+    photo.exposureCompensation(0.2);
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(ready.count(), 1);
+    QVERIFY(!photo.saving());
+    QCOMPARE(WorkingImageCache::find(path).size(), QSize(400, 267));
+
+    // The photo got replaced as it was, without leaving anything behind
+    QCOMPARE(QFile::permissions(path), permissions);
+    QCOMPARE(dir.entryList(QDir::Files | QDir::Hidden), QStringList() << "testsaving.jpg");
+    QImageReader reader(path);
+    QCOMPARE(reader.size(), QSize(400, 267));
+
+    // Rotating through the metadata replaces the photo just the same
+    photo.rotateRight();
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(ready.count(), 1);
+    QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+    QCOMPARE(QFile::permissions(path), permissions);
+    QCOMPARE(dir.entryList(QDir::Files | QDir::Hidden), QStringList() << "testsaving.jpg");
+}
+
+void PhotoEditorPhotoTest::testHistory()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testhistory.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("thorns.jpg"), path);
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray contents = file.readAll();
+    file.close();
+
+    PhotoEditHistory history;
+    QSignalSpy ready(&history, SIGNAL(ready(bool)));
+    QVERIFY(history.start(path));
+    QVERIFY(history.loading());
+    QVERIFY(ready.wait(5000));
+    QVERIFY(ready.at(0).at(0).toBool());
+    QVERIFY(!history.loading());
+    QCOMPARE(history.level(), 0);
+    QCOMPARE(history.count(), 1);
+    QVERIFY(!history.canUndo());
+    QVERIFY(qMax(history.image().width(), history.image().height()) <=
+            PhotoEditHistory::PROXY_SIZE);
+    QVERIFY(!PhotoEditHistory::find(path).isNull());
+
+    PhotoData photo;
+    photo.setPath(path);
+    photo.setHistory(&history);
+    QSignalSpy finished(&photo, SIGNAL(editFinished()));
+    QSignalSpy changed(&photo, SIGNAL(dataChanged()));
+
+    // The edits only go to the history
+    QSize size = history.image().size();
+    photo.rotateRight();
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(history.level(), 1);
+    QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+    QCOMPARE(history.image().size(), size.transposed());
+    QVERIFY(changed.count() > 0);
+
+    photo.autoEnhance();
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(history.level(), 2);
+    QCOMPARE(history.count(), 3);
+    QVERIFY(photo.orientation() == TOP_LEFT_ORIGIN);
+    QImage enhanced = history.image();
+
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == contents);
+    file.close();
+
+    // Undo and redo render from the proxies kept
+    changed.clear();
+    history.undo();
+    QCOMPARE(history.level(), 1);
+    QVERIFY(history.canRedo());
+    QVERIFY(photo.orientation() == RIGHT_TOP_ORIGIN);
+    QCOMPARE(history.image().size(), size.transposed());
+    QCOMPARE(changed.count(), 1);
+    history.setLevel(0);
+    QCOMPARE(history.image().size(), size);
+    history.redo();
+    history.redo();
+    QCOMPARE(history.level(), 2);
+    QVERIFY(history.image() == enhanced);
+
+    // A new edit drops the ones undone
+    history.undo();
+    photo.exposureCompensation(0.2);
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(history.level(), 2);
+    QCOMPARE(history.count(), 3);
+    QVERIFY(!history.canRedo());
+
+    // Saving writes them all to the photo at once
+    QVERIFY(history.save());
+    history.end();
+    QVERIFY(PhotoEditHistory::find(path).isNull());
+    photo.setHistory(0);
+    photo.refreshFromDisk();
+    QVERIFY(photo.orientation() == TOP_LEFT_ORIGIN);
+    QImage saved(path);
+    QCOMPARE(saved.size(), QImage(source.absoluteFilePath("thorns.jpg")).size().transposed());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() != contents);
+    file.close();
+}
+
+void PhotoEditorPhotoTest::testHistorySavedInBackground()
+{
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testhistoryasync.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("thorns.jpg"), path);
+    QSize size = QImage(path).size();
+
+    PhotoEditHistory history;
+    QSignalSpy ready(&history, SIGNAL(ready(bool)));
+    QVERIFY(history.start(path));
+    QVERIFY(ready.wait(5000));
+    PhotoData photo;
+    photo.setPath(path);
+    photo.setHistory(&history);
+    QSignalSpy finished(&photo, SIGNAL(editFinished()));
+    photo.rotateRight();
+    QVERIFY(finished.wait(5000));
+    QImage edited = history.image();
+
+    // The session ends right away, and its proxy stands in for the photo
+    // until the photo is written
+    QSignalSpy saved(&history, SIGNAL(saved(QString, bool)));
+    QVERIFY(history.saveAsync());
+    QVERIFY(history.saving());
+    history.end();
+    photo.setHistory(0);
+    QVERIFY(PhotoEditHistory::find(path) == edited);
+
+    QTRY_COMPARE(saved.count(), 1);
+    QCOMPARE(saved.at(0).at(0).toString(), path);
+    QVERIFY(saved.at(0).at(1).toBool());
+    QVERIFY(!history.saving());
+    QVERIFY(PhotoEditHistory::find(path).isNull());
+    QCOMPARE(QImage(path).size(), size.transposed());
+
+    // Editing the photo again decodes it once it is written, without
+    // holding up the caller
+    ready.clear();
+    QVERIFY(history.start(path));
+    QVERIFY(ready.wait(5000));
+    QVERIFY(history.saveAsync());
+    history.end();
+    ready.clear();
+    QVERIFY(history.start(path));
+    QVERIFY(!PhotoEditHistory::find(path).isNull());
+    QVERIFY(ready.wait(5000));
+    QVERIFY(ready.at(0).at(0).toBool());
+    QCOMPARE(saved.count(), 2);
+    QVERIFY(!history.saving());
+    QVERIFY(!PhotoEditHistory::find(path).isNull());
+    history.end();
+    QVERIFY(PhotoEditHistory::find(path).isNull());
+}
+
+void PhotoEditorPhotoTest::testHistoryRotationsWithoutExif()
+{
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testhistoryrotations.png");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("croptest.png"), path);
+
+    PhotoEditHistory history;
+    QSignalSpy ready(&history, SIGNAL(ready(bool)));
+    QVERIFY(history.start(path));
+    QVERIFY(ready.wait(5000));
+    PhotoData photo;
+    photo.setPath(path);
+    photo.setHistory(&history);
+    QSignalSpy finished(&photo, SIGNAL(editFinished()));
+
+    // Each turn goes on from the one before it, as it does on screen
+    photo.rotateRight();
+    QVERIFY(finished.wait(5000));
+    photo.rotateRight();
+    QVERIFY(finished.wait(5000));
+    QCOMPARE(history.level(), 2);
+    QVERIFY(history.orientation() == BOTTOM_RIGHT_ORIGIN);
+
+    QVERIFY(history.save());
+    history.end();
+    photo.setHistory(0);
+
+    // The black strip on the left ends up on the right
+    QImage saved(path);
+    QCOMPARE(saved.size(), QSize(100, 100));
+    QCOMPARE(QColor(saved.pixel(95, 50)), QColor(0, 0, 0));
+    QVERIFY(QColor(saved.pixel(5, 50)) != QColor(0, 0, 0));
+}
+
 void PhotoEditorPhotoTest::testCrop()
 {
     QDir source = QDir(m_workingDir.path());
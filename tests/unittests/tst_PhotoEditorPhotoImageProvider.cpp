@@ -38,6 +38,7 @@ private Q_SLOTS:
     void testEmptyOrInvalid();
     void testNoResize();
     void testWithResize();
+    void testExposurePreview();
 
 private:        
     PhotoImageProvider *m_provider;
@@ -107,6 +108,38 @@ void PhotoEditorPhotoImageProviderTest::testWithResize()
     QVERIFY(image.size() == small);
 }
 
+void PhotoEditorPhotoImageProviderTest::testExposurePreview()
+{
+    // Work on a copy to avoid disturbing other tests
+    QDir source = QDir(m_workingDir.path());
+    QString path = source.absoluteFilePath("testcache.jpg");
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("thorns.jpg"), path);
+
+    QSize small(1408 / 4, 768 / 4);
+    QImage plain = m_provider->requestImage(path, 0, small);
+
+    QSize size;
+    QImage image = m_provider->requestImage(path + "?exposure=0", &size, small);
+    QCOMPARE(size, small);
+    QVERIFY(image == plain);
+
+    image = m_provider->requestImage(path + "?exposure=0.25", &size, small);
+    QCOMPARE(size, small);
+    QRgb before = plain.pixel(10, 10);
+    QRgb after = image.pixel(10, 10);
+    QCOMPARE(qRed(after), qMin(255, qRed(before) + 63));
+    QCOMPARE(qGreen(after), qMin(255, qGreen(before) + 63));
+    QCOMPARE(qBlue(after), qMin(255, qBlue(before) + 63));
+
+    // The proxy follows the file when it changes
+    QTest::qSleep(10);
+    QFile::remove(path);
+    QFile::copy(source.absoluteFilePath("windmill.jpg"), path);
+    image = m_provider->requestImage(path + "?exposure=0", &size, small);
+    QCOMPARE(size, QSize(400, 267).scaled(small, Qt::KeepAspectRatio));
+}
+
 void PhotoEditorPhotoImageProviderTest::testEmptyOrInvalid()
 {
     QImage image = m_provider->requestImage("", 0, QSize());
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "imaging.h"
+#include "jpeg-lossless-editor.h"
+#include "jpeg-strip-editor.h"
+#include "photo-edit-pipeline.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QImage>
+#include <QList>
+#include <QTest>
+
+Q_DECLARE_METATYPE(Orientation)
+Q_DECLARE_METATYPE(QList<PhotoEditCommand>)
+
+class PhotoEditorPipelineTest: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testMetadataRotation();
+    void testGeometry_data();
+    void testGeometry();
+    void testTones();
+    void testOrientationFromTransform();
+    void testStrips_data();
+    void testStrips();
+    void testLossless_data();
+    void testLossless();
+    void testLosslessAlignment();
+    void testProgress();
+
+private:
+    QImage applySequentially(QImage image, Orientation orientation,
+                             const QList<PhotoEditCommand>& commands);
+};
+
+namespace {
+PhotoEditCommand rotate(Orientation orientation)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ROTATE;
+    command.orientation = orientation;
+    return command;
+}
+
+PhotoEditCommand crop(qreal x, qreal y, qreal width, qreal height)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_CROP;
+    command.crop_rectangle = QRectF(x, y, width, height);
+    return command;
+}
+
+PhotoEditCommand exposure(qreal value)
+{
+    PhotoEditCommand command;
+    command.type = EDIT_COMPENSATE_EXPOSURE;
+    command.exposureCompensation = value;
+    return command;
+}
+
+PhotoEditCommand enhance()
+{
+    PhotoEditCommand command;
+    command.type = EDIT_ENHANCE;
+    return command;
+}
+
+QTransform orientationTransform(Orientation orientation)
+{
+    return OrientationCorrection::fromOrientation(orientation).toTransform();
+}
+
+double meanDifference(const QImage& result, const QImage& expected)
+{
+    qint64 total = 0;
+    for (int j = 0; j < result.height(); j++) {
+        const QRgb* actual = reinterpret_cast<const QRgb*>(result.constScanLine(j));
+        const QRgb* wanted = reinterpret_cast<const QRgb*>(expected.constScanLine(j));
+        for (int i = 0; i < result.width(); i++) {
+            total += qAbs(qRed(actual[i]) - qRed(wanted[i])) +
+                    qAbs(qGreen(actual[i]) - qGreen(wanted[i])) +
+                    qAbs(qBlue(actual[i]) - qBlue(wanted[i]));
+        }
+    }
+    return ((double) total) / (3.0 * result.width() * result.height());
+}
+} // namespace
+
+/*
+ * What editing one command at a time used to do, with rotations stored as
+ * metadata, and without saving the intermediate results.
+ */
+QImage PhotoEditorPipelineTest::applySequentially(
+        QImage image, Orientation orientation,
+        const QList<PhotoEditCommand>& commands)
+{
+    Q_FOREACH(const PhotoEditCommand& command, commands) {
+        if (command.type == EDIT_ROTATE) {
+            orientation = command.orientation;
+            continue;
+        }
+
+        image = image.transformed(orientationTransform(orientation));
+        orientation = TOP_LEFT_ORIGIN;
+
+        if (command.type == EDIT_CROP) {
+            QRect rect;
+            rect.setX(command.crop_rectangle.x() * image.width());
+            rect.setY(command.crop_rectangle.y() * image.height());
+            rect.setWidth(command.crop_rectangle.width() * image.width());
+            rect.setHeight(command.crop_rectangle.height() * image.height());
+            image = image.copy(rect);
+        } else if (command.type == EDIT_ENHANCE) {
+            image = image.convertToFormat(scanLineFormat(image));
+            AutoEnhanceTransformation enhance(image, qMax(1, image.width() / 400));
+            for (int j = 0; j < image.height(); j++) {
+                QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(j));
+                enhance.transformScanLine(line, line, image.width());
+            }
+        } else if (command.type == EDIT_COMPENSATE_EXPOSURE) {
+            int shift = qBound(-255, (int)(255 * command.exposureCompensation), 255);
+            image = image.convertToFormat(scanLineFormat(image));
+            for (int j = 0; j < image.height(); j++) {
+                for (int i = 0; i < image.width(); i++) {
+                    QRgb pixel = image.pixel(i, j);
+                    image.setPixel(i, j, qRgb(qBound(0, qRed(pixel) + shift, 255),
+                                              qBound(0, qGreen(pixel) + shift, 255),
+                                              qBound(0, qBlue(pixel) + shift, 255)));
+                }
+            }
+        }
+    }
+
+    return image.transformed(orientationTransform(orientation));
+}
+
+void PhotoEditorPipelineTest::testMetadataRotation()
+{
+    PhotoEditPipeline pipeline(RIGHT_TOP_ORIGIN);
+    QVERIFY(pipeline.isEmpty());
+
+    pipeline.append(rotate(BOTTOM_RIGHT_ORIGIN));
+    pipeline.append(rotate(LEFT_BOTTOM_ORIGIN));
+    QVERIFY(!pipeline.isEmpty());
+    QVERIFY(!pipeline.changesPixels());
+    QCOMPARE(pipeline.orientation(), LEFT_BOTTOM_ORIGIN);
+
+    pipeline.append(PhotoEditCommand());
+    QVERIFY(!pipeline.changesPixels());
+
+    pipeline.append(crop(0.0, 0.0, 0.5, 0.5));
+    QVERIFY(pipeline.changesPixels());
+}
+
+void PhotoEditorPipelineTest::testGeometry_data()
+{
+    QTest::addColumn<Orientation>("orientation");
+    QTest::addColumn<QList<PhotoEditCommand> >("commands");
+
+    QTest::newRow("crop") << TOP_LEFT_ORIGIN
+                          << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75));
+    QTest::newRow("stored orientation, crop") << RIGHT_TOP_ORIGIN
+                          << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75));
+    QTest::newRow("rotate, crop") << TOP_LEFT_ORIGIN
+                          << (QList<PhotoEditCommand>() << rotate(RIGHT_TOP_ORIGIN)
+                              << crop(0.25, 0.125, 0.5, 0.75));
+    QTest::newRow("crop, rotate") << TOP_LEFT_ORIGIN
+                          << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75)
+                              << rotate(LEFT_BOTTOM_ORIGIN));
+    QTest::newRow("flip, crop, rotate, crop") << TOP_RIGHT_ORIGIN
+                          << (QList<PhotoEditCommand>() << crop(0.0, 0.25, 0.5, 0.5)
+                              << rotate(BOTTOM_RIGHT_ORIGIN)
+                              << crop(0.5, 0.0, 0.5, 0.5));
+    QTest::newRow("crop, exposure, rotate") << TOP_LEFT_ORIGIN
+                          << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75)
+                              << exposure(0.25) << rotate(RIGHT_TOP_ORIGIN));
+}
+
+void PhotoEditorPipelineTest::testGeometry()
+{
+    QFETCH(Orientation, orientation);
+    QFETCH(QList<PhotoEditCommand>, commands);
+
+    // Every pixel is different, so any misplaced one shows up
+    QImage image(400, 256, QImage::Format_RGB32);
+    for (int j = 0; j < image.height(); j++)
+        for (int i = 0; i < image.width(); i++)
+            image.setPixel(i, j, qRgb(i & 0xff, j, i >> 8));
+
+    PhotoEditPipeline pipeline(orientation);
+    pipeline.append(commands);
+
+    QImage expected = applySequentially(image, orientation, commands);
+    QImage result = pipeline.apply(image);
+    QCOMPARE(result.size(), expected.size());
+    QVERIFY(result == expected);
+}
+
+void PhotoEditorPipelineTest::testTones()
+{
+    QImage image(QDir(":/assets/").absoluteFilePath("thorns.jpg"));
+    QVERIFY(!image.isNull());
+
+    QList<PhotoEditCommand> commands;
+    commands << exposure(-0.125) << crop(0.25, 0.25, 0.5, 0.5) << enhance()
+             << exposure(0.0625);
+
+    PhotoEditPipeline pipeline;
+    pipeline.append(commands);
+
+    QImage expected = applySequentially(image, TOP_LEFT_ORIGIN, commands);
+    QImage result = pipeline.apply(image);
+    QCOMPARE(result.size(), expected.size());
+    QVERIFY(result.convertToFormat(expected.format()) == expected);
+
+    // Previews compile the stages into a lookup table, which interpolates
+    // between the colours it samples
+    pipeline.setPreview(true);
+    QImage preview = pipeline.apply(image);
+    QCOMPARE(preview.size(), expected.size());
+    double mean = meanDifference(preview.convertToFormat(expected.format()), expected);
+    QVERIFY2(mean < 1.0, qPrintable(QString::number(mean)));
+}
+
+void PhotoEditorPipelineTest::testOrientationFromTransform()
+{
+    for (int o = MIN_ORIENTATION; o <= MAX_ORIENTATION; o++) {
+        Orientation orientation = static_cast<Orientation>(o);
+        QTransform transform = orientationTransform(orientation);
+        QCOMPARE(OrientationCorrection::fromTransform(transform), orientation);
+        QCOMPARE(OrientationCorrection::fromTransform(transform * QTransform::fromTranslate(10, 20)),
+                 orientation);
+    }
+}
+
+void PhotoEditorPipelineTest::testStrips_data()
+{
+    QTest::addColumn<QList<PhotoEditCommand> >("commands");
+    QTest::addColumn<double>("tolerance");
+
+    QTest::newRow("exposure") << (QList<PhotoEditCommand>() << exposure(0.125)) << 2.0;
+    QTest::newRow("crop") << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75)) << 2.0;
+    QTest::newRow("rotate, crop, exposure")
+            << (QList<PhotoEditCommand>() << rotate(RIGHT_TOP_ORIGIN)
+                << crop(0.25, 0.125, 0.5, 0.75) << exposure(-0.125)) << 2.0;
+    // Enhancement gets analysed on a downscaled decode, which shifts the
+    // curve a little
+    QTest::newRow("crop, enhance")
+            << (QList<PhotoEditCommand>() << crop(0.0, 0.25, 1.0, 0.5) << enhance()) << 4.0;
+}
+
+void PhotoEditorPipelineTest::testStrips()
+{
+    QFETCH(QList<PhotoEditCommand>, commands);
+    QFETCH(double, tolerance);
+
+    QString path = QDir(":/assets/").absoluteFilePath("thorns.jpg");
+    QImage image(path);
+
+    PhotoEditPipeline pipeline;
+    pipeline.append(commands);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(JpegStripEditor::apply(path, &buffer, pipeline));
+
+    QImage result;
+    QVERIFY(result.loadFromData(buffer.data(), "jpeg"));
+    result = result.transformed(pipeline.transform()).convertToFormat(QImage::Format_RGB32);
+
+    QImage expected = pipeline.apply(image).convertToFormat(QImage::Format_RGB32);
+    QCOMPARE(result.size(), expected.size());
+
+    // Both went through a round of JPEG compression
+    double mean = meanDifference(result, expected);
+    QVERIFY2(mean < tolerance, qPrintable(QString::number(mean)));
+}
+
+void PhotoEditorPipelineTest::testLossless_data()
+{
+    QTest::addColumn<QList<PhotoEditCommand> >("commands");
+
+    // thorns.jpg is 1408x768 in MCUs of 16x8 pixels, which all of these
+    // crops line up with
+    QTest::newRow("crop") << (QList<PhotoEditCommand>() << crop(0.25, 0.125, 0.5, 0.75));
+    QTest::newRow("rotate") << (QList<PhotoEditCommand>() << rotate(RIGHT_TOP_ORIGIN));
+    QTest::newRow("rotate, crop") << (QList<PhotoEditCommand>() << rotate(RIGHT_TOP_ORIGIN)
+                                      << crop(0.25, 0.125, 0.5, 0.75));
+    QTest::newRow("flip, crop") << (QList<PhotoEditCommand>() << rotate(TOP_RIGHT_ORIGIN)
+                                    << crop(0.0, 0.5, 0.5, 0.5));
+    QTest::newRow("crop, turn") << (QList<PhotoEditCommand>() << crop(0.0, 0.0, 0.5, 0.5)
+                                    << rotate(BOTTOM_RIGHT_ORIGIN));
+}
+
+void PhotoEditorPipelineTest::testLossless()
+{
+    QFETCH(QList<PhotoEditCommand>, commands);
+
+    QString path = QDir(":/assets/").absoluteFilePath("thorns.jpg");
+    QCOMPARE(JpegLosslessEditor::blockSize(path), QSize(16, 8));
+
+    PhotoEditPipeline pipeline;
+    pipeline.append(commands);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(JpegLosslessEditor::apply(path, &buffer, pipeline));
+
+    QImage result;
+    QVERIFY(result.loadFromData(buffer.data(), "jpeg"));
+    result = result.convertToFormat(QImage::Format_RGB32);
+
+    QImage expected = pipeline.apply(QImage(path)).convertToFormat(QImage::Format_RGB32);
+    QCOMPARE(result.size(), expected.size());
+
+    // Only the chroma upsampling along the new edges, and the rounding of
+    // transposed blocks, can tell them apart
+    double mean = meanDifference(result, expected);
+    QVERIFY2(mean < 1.0, qPrintable(QString::number(mean)));
+}
+
+void PhotoEditorPipelineTest::testLosslessAlignment()
+{
+    QString path = QDir(":/assets/").absoluteFilePath("thorns.jpg");
+    PhotoEditCommand command = crop(0.01, 0.01, 0.5, 0.5);
+
+    PhotoEditPipeline unaligned;
+    unaligned.append(command);
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(!JpegLosslessEditor::apply(path, &buffer, unaligned));
+    QVERIFY(buffer.data().isEmpty());
+
+    command.snapCropToBlocks = true;
+    PhotoEditPipeline snapped;
+    snapped.append(command);
+    QVERIFY(snapped.snapsCropToBlocks());
+    QVERIFY(JpegLosslessEditor::apply(path, &buffer, snapped));
+
+    // The crop grows up and left to the grid, and keeps its other edges
+    QRect region = snapped.sourceRect(QSize(1408, 768));
+    QImage result;
+    QVERIFY(result.loadFromData(buffer.data(), "jpeg"));
+    QCOMPARE(result.width(), region.right() + 1 - region.left() / 16 * 16);
+    QCOMPARE(result.height(), region.bottom() + 1 - region.top() / 8 * 8);
+}
+
+void PhotoEditorPipelineTest::testProgress()
+{
+    PhotoEditProgress progress;
+    QCOMPARE(progress.stage(), PhotoEditProgress::STAGE_NONE);
+    QCOMPARE(progress.progress(), 0.0);
+    QCOMPARE(progress.estimatedRemainingMs(), (qint64) -1);
+
+    progress.plan(PhotoEditProgress::STAGE_DECODE, 1);
+    progress.plan(PhotoEditProgress::STAGE_PROCESS, 2);
+    progress.plan(PhotoEditProgress::STAGE_METADATA, 1);
+
+    progress.begin(PhotoEditProgress::STAGE_DECODE, 4);
+    progress.advance(2);
+    QCOMPARE(progress.progress(), 0.125);
+    QVERIFY(progress.estimatedRemainingMs() >= 0);
+
+    // Stages that weren't planned don't count
+    progress.begin(PhotoEditProgress::STAGE_ANALYSE, 1);
+    QCOMPARE(progress.stage(), PhotoEditProgress::STAGE_ANALYSE);
+    QCOMPARE(progress.progress(), 0.25);
+
+    // The pipeline counts the rows it has been through
+    QImage image = QImage(":/assets/windmill.jpg").convertToFormat(QImage::Format_RGB32);
+    PhotoEditPipeline pipeline;
+    pipeline.append(enhance());
+    pipeline.setProgress(&progress);
+    pipeline.apply(image);
+    QCOMPARE(progress.stage(), PhotoEditProgress::STAGE_PROCESS);
+    QCOMPARE(progress.progress(), 0.75);
+
+    progress.begin(PhotoEditProgress::STAGE_METADATA, 1);
+    progress.advance();
+    QCOMPARE(progress.progress(), 1.0);
+    QCOMPARE(progress.estimatedRemainingMs(), (qint64) 0);
+}
+
+QTEST_MAIN(PhotoEditorPipelineTest)
+
+#include "tst_PhotoEditorPipeline.moc"